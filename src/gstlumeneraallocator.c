@@ -0,0 +1,170 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// GstAllocator of prefaulted frame memory, used for lumenerasrc's output buffer pool
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+
+#include "gstlumeneraallocator.h"
+#include "gstlumeneraproc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_lumenera_allocator_debug);
+#define GST_CAT_DEFAULT gst_lumenera_allocator_debug
+
+typedef struct
+{
+  GstMemory mem;
+
+  GstLumeneraArena *arena;  // NULL in memory shared from a parent
+  guint8 *data;
+} GstLumeneraMemory;
+
+G_DEFINE_TYPE (GstLumeneraAllocator, gst_lumenera_allocator, GST_TYPE_ALLOCATOR);
+
+static GstMemory *
+gst_lumenera_allocator_alloc (GstAllocator * allocator, gsize size, GstAllocationParams * params)
+{
+	GstLumeneraAllocator *alloc = GST_LUMENERA_ALLOCATOR (allocator);
+	GstLumeneraMemory *mem;
+	GstLumeneraArena *arena;
+	gsize maxsize = size + params->prefix + params->padding;
+	GError *err = NULL;
+
+	// Mapped memory is page aligned, enough for any alignment asked for
+	arena = gst_lumenera_arena_new (maxsize, alloc->huge_pages, alloc->lock, &err);
+	if (!arena) {
+		GST_WARNING_OBJECT (alloc, "%s", err->message);
+		g_error_free (err);
+		return NULL;
+	}
+
+	g_atomic_int_inc (&alloc->n_memories);
+	if (arena->huge_pages)
+		g_atomic_int_inc (&alloc->n_huge_pages);
+	if (arena->locked)
+		g_atomic_int_inc (&alloc->n_locked);
+
+	mem = g_slice_new (GstLumeneraMemory);
+	mem->arena = arena;
+	mem->data = arena->data;
+	gst_memory_init (GST_MEMORY_CAST (mem), params->flags, allocator, NULL, maxsize, params->align, params->prefix, size);
+
+	return GST_MEMORY_CAST (mem);
+}
+
+static void
+gst_lumenera_allocator_free (GstAllocator * allocator, GstMemory * memory)
+{
+	GstLumeneraMemory *mem = (GstLumeneraMemory *) memory;
+
+	if (mem->arena)
+		gst_lumenera_arena_free (mem->arena);
+	g_slice_free (GstLumeneraMemory, mem);
+}
+
+static gpointer
+gst_lumenera_memory_map (GstMemory * memory, gsize maxsize, GstMapFlags flags)
+{
+	return ((GstLumeneraMemory *) memory)->data;
+}
+
+static void
+gst_lumenera_memory_unmap (GstMemory * memory)
+{
+}
+
+//
+// A view of part of the parent, which keeps the arena alive
+//
+static GstMemory *
+gst_lumenera_memory_share (GstMemory * memory, gssize offset, gssize size)
+{
+	GstLumeneraMemory *mem = (GstLumeneraMemory *) memory;
+	GstLumeneraMemory *sub;
+	GstMemory *parent = memory->parent ? memory->parent : memory;
+
+	if (size == -1)
+		size = memory->size - offset;
+
+	sub = g_slice_new (GstLumeneraMemory);
+	sub->arena = NULL;
+	sub->data = mem->data;
+	gst_memory_init (GST_MEMORY_CAST (sub), GST_MINI_OBJECT_FLAGS (parent) | GST_MINI_OBJECT_FLAG_LOCK_READONLY,
+			memory->allocator, parent, memory->maxsize, memory->align, memory->offset + offset, size);
+
+	return GST_MEMORY_CAST (sub);
+}
+
+static void
+gst_lumenera_allocator_class_init (GstLumeneraAllocatorClass * klass)
+{
+	GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+	allocator_class->alloc = gst_lumenera_allocator_alloc;
+	allocator_class->free = gst_lumenera_allocator_free;
+
+	GST_DEBUG_CATEGORY_INIT (gst_lumenera_allocator_debug, "lumeneraallocator", 0, "Prefaulted frame memory");
+}
+
+static void
+gst_lumenera_allocator_init (GstLumeneraAllocator * alloc)
+{
+	GstAllocator *allocator = GST_ALLOCATOR_CAST (alloc);
+
+	allocator->mem_type = "LumeneraMemory";
+	allocator->mem_map = gst_lumenera_memory_map;
+	allocator->mem_unmap = gst_lumenera_memory_unmap;
+	allocator->mem_share = gst_lumenera_memory_share;
+
+	GST_OBJECT_FLAG_SET (alloc, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
+}
+
+GstAllocator *
+gst_lumenera_allocator_new (gboolean huge_pages, gboolean lock)
+{
+	GstLumeneraAllocator *alloc = g_object_new (GST_TYPE_LUMENERA_ALLOCATOR, NULL);
+
+	gst_object_ref_sink (alloc);
+	alloc->huge_pages = huge_pages;
+	alloc->lock = lock;
+
+	return GST_ALLOCATOR_CAST (alloc);
+}
+
+GstBufferPool *
+gst_lumenera_allocator_pool_new (GstAllocator * allocator, GstCaps * caps, guint size, guint min_buffers)
+{
+	GstBufferPool *pool = gst_buffer_pool_new ();
+	GstStructure *config = gst_buffer_pool_get_config (pool);
+
+	gst_buffer_pool_config_set_params (config, caps, size, min_buffers, 0);
+	gst_buffer_pool_config_set_allocator (config, allocator, NULL);
+	if (!gst_buffer_pool_set_config (pool, config)) {
+		gst_object_unref (pool);
+		return NULL;
+	}
+
+	return pool;
+}
@@ -0,0 +1,64 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _GST_LUMENERA_ALLOCATOR_H_
+#define _GST_LUMENERA_ALLOCATOR_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+// Memory for frames that is ready before the first frame arrives. Each GstMemory is its own
+// GstLumeneraArena (see gstlumeneraproc.h): huge pages where the kernel has them, locked when
+// RLIMIT_MEMLOCK permits, and faulted in when allocated rather than by the first frame written to it.
+#define GST_TYPE_LUMENERA_ALLOCATOR   (gst_lumenera_allocator_get_type())
+#define GST_LUMENERA_ALLOCATOR(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_LUMENERA_ALLOCATOR,GstLumeneraAllocator))
+#define GST_IS_LUMENERA_ALLOCATOR(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_LUMENERA_ALLOCATOR))
+
+typedef struct _GstLumeneraAllocator GstLumeneraAllocator;
+typedef struct _GstLumeneraAllocatorClass GstLumeneraAllocatorClass;
+
+struct _GstLumeneraAllocator
+{
+  GstAllocator parent;
+
+  gboolean huge_pages;
+  gboolean lock;
+
+  // of the memory allocated so far, updated atomically
+  volatile gint n_memories;
+  volatile gint n_huge_pages;  // from the hugetlb pool
+  volatile gint n_locked;
+};
+
+struct _GstLumeneraAllocatorClass
+{
+  GstAllocatorClass parent_class;
+};
+
+GType gst_lumenera_allocator_get_type (void);
+
+GstAllocator *gst_lumenera_allocator_new (gboolean huge_pages, gboolean lock);
+
+// A pool of buffers of size bytes from allocator, min_buffers of them allocated when it is activated
+GstBufferPool *gst_lumenera_allocator_pool_new (GstAllocator * allocator, GstCaps * caps, guint size, guint min_buffers);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,283 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+/**
+ * SECTION:element-lumenerabayerunpack
+ *
+ * Unpacks the packed 10 and 12 bit Bayer output of lumenerasrc to 16 bit little endian Bayer,
+ * least significant bit aligned, that bayer2rgb and other raw tools read.
+ *
+ * <refsect2>
+ * <title>Example launch lines</title>
+ * |[
+ * gst-launch-1.0 lumenerasrc ! video/x-bayer,format=rggb12p ! matroskamux ! filesink location=raw.mkv
+ * gst-launch-1.0 filesrc location=raw.mkv ! matroskademux ! lumenerabayerunpack ! bayer2rgb ! videoconvert ! autovideosink
+ * ]|
+ * Records packed 12 bit frames and plays them back.
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h> // for strlen
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+
+#include "gstlumenerabayerunpack.h"
+#include "gstlumeneraproc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_lumenera_bayer_unpack_debug);
+#define GST_CAT_DEFAULT gst_lumenera_bayer_unpack_debug
+
+/* prototypes */
+static GstCaps *gst_lumenera_bayer_unpack_transform_caps (GstBaseTransform * trans,
+		GstPadDirection direction, GstCaps * caps, GstCaps * filter);
+static gboolean gst_lumenera_bayer_unpack_get_unit_size (GstBaseTransform * trans,
+		GstCaps * caps, gsize * size);
+static gboolean gst_lumenera_bayer_unpack_set_caps (GstBaseTransform * trans,
+		GstCaps * incaps, GstCaps * outcaps);
+static GstFlowReturn gst_lumenera_bayer_unpack_transform (GstBaseTransform * trans,
+		GstBuffer * inbuf, GstBuffer * outbuf);
+
+// pad templates
+static GstStaticPadTemplate gst_lumenera_bayer_unpack_sink_template =
+		GST_STATIC_PAD_TEMPLATE ("sink",
+				GST_PAD_SINK,
+				GST_PAD_ALWAYS,
+				GST_STATIC_CAPS (GST_LUMENERA_BAYER_PACKED_CAPS)
+		);
+
+static GstStaticPadTemplate gst_lumenera_bayer_unpack_src_template =
+		GST_STATIC_PAD_TEMPLATE ("src",
+				GST_PAD_SRC,
+				GST_PAD_ALWAYS,
+				GST_STATIC_CAPS ("video/x-bayer, "
+						"format = (string) { rggb10le, grbg10le, gbrg10le, bggr10le, rggb12le, grbg12le, gbrg12le, bggr12le }, "
+						"width = (int) [ 1, max ], height = (int) [ 1, max ], framerate = (fraction) [ 0, max ]")
+		);
+
+/* class initialisation */
+
+G_DEFINE_TYPE (GstLumeneraBayerUnpack, gst_lumenera_bayer_unpack, GST_TYPE_BASE_TRANSFORM);
+
+static void
+gst_lumenera_bayer_unpack_class_init (GstLumeneraBayerUnpackClass * klass)
+{
+	GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+	GstBaseTransformClass *gstbasetransform_class = GST_BASE_TRANSFORM_CLASS (klass);
+
+	GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, "lumenerabayerunpack", 0,
+			"lumenera packed Bayer unpacker");
+
+	gst_element_class_add_pad_template (gstelement_class,
+			gst_static_pad_template_get (&gst_lumenera_bayer_unpack_sink_template));
+	gst_element_class_add_pad_template (gstelement_class,
+			gst_static_pad_template_get (&gst_lumenera_bayer_unpack_src_template));
+
+	gst_element_class_set_static_metadata (gstelement_class,
+			"lumenera Bayer Unpacker", "Filter/Converter/Video",
+			"Unpacks packed 10 and 12 bit Bayer from lumenerasrc to 16 bit Bayer", "Paul R. Barber <paul.barber@oncology.ox.ac.uk>");
+
+	gstbasetransform_class->transform_caps = GST_DEBUG_FUNCPTR (gst_lumenera_bayer_unpack_transform_caps);
+	gstbasetransform_class->get_unit_size = GST_DEBUG_FUNCPTR (gst_lumenera_bayer_unpack_get_unit_size);
+	gstbasetransform_class->set_caps = GST_DEBUG_FUNCPTR (gst_lumenera_bayer_unpack_set_caps);
+	gstbasetransform_class->transform = GST_DEBUG_FUNCPTR (gst_lumenera_bayer_unpack_transform);
+}
+
+static void
+gst_lumenera_bayer_unpack_init (GstLumeneraBayerUnpack * unpack)
+{
+}
+
+gint
+gst_lumenera_bayer_packed_bits (const gchar * format)
+{
+	if (!format || strlen (format) != 7 || format[6] != 'p')
+		return 0;
+	if (format[4] == '1' && format[5] == '0')
+		return 10;
+	if (format[4] == '1' && format[5] == '2')
+		return 12;
+	return 0;
+}
+
+// Bits per pixel of an unpacked 16 bit Bayer format string, 0 if it is not one we produce
+static gint
+gst_lumenera_bayer_unpacked_bits (const gchar * format)
+{
+	if (!format || strlen (format) != 8 || format[6] != 'l' || format[7] != 'e')
+		return 0;
+	if (format[4] == '1' && format[5] == '0')
+		return 10;
+	if (format[4] == '1' && format[5] == '2')
+		return 12;
+	return 0;
+}
+
+//
+// Add the format on the other side of the element for format, going in direction, to list: rggb12p <-> rggb12le
+//
+static void
+gst_lumenera_bayer_unpack_append_format (GValue * list, const gchar * format, GstPadDirection direction)
+{
+	GValue v = G_VALUE_INIT;
+
+	if (direction == GST_PAD_SINK && gst_lumenera_bayer_packed_bits (format)) {
+		g_value_init (&v, G_TYPE_STRING);
+		g_value_take_string (&v, g_strdup_printf ("%.6sle", format));
+	}
+	else if (direction == GST_PAD_SRC && gst_lumenera_bayer_unpacked_bits (format)) {
+		g_value_init (&v, G_TYPE_STRING);
+		g_value_take_string (&v, g_strdup_printf ("%.6sp", format));
+	}
+	else
+		return;
+
+	gst_value_list_append_and_take_value (list, &v);
+}
+
+static GstCaps *
+gst_lumenera_bayer_unpack_transform_caps (GstBaseTransform * trans,
+		GstPadDirection direction, GstCaps * caps, GstCaps * filter)
+{
+	GstCaps *res = gst_caps_new_empty ();
+	guint i, j;
+
+	// Only the format changes, size and frame rate pass through
+	for (i = 0; i < gst_caps_get_size (caps); i++) {
+		GstStructure *s = gst_structure_copy (gst_caps_get_structure (caps, i));
+		const GValue *format = gst_structure_get_value (s, "format");
+		GValue list = G_VALUE_INIT;
+
+		g_value_init (&list, GST_TYPE_LIST);
+		if (format && G_VALUE_HOLDS_STRING (format))
+			gst_lumenera_bayer_unpack_append_format (&list, g_value_get_string (format), direction);
+		else if (format && GST_VALUE_HOLDS_LIST (format)) {
+			for (j = 0; j < gst_value_list_get_size (format); j++) {
+				const GValue *v = gst_value_list_get_value (format, j);
+
+				if (G_VALUE_HOLDS_STRING (v))
+					gst_lumenera_bayer_unpack_append_format (&list, g_value_get_string (v), direction);
+			}
+		}
+
+		if (gst_value_list_get_size (&list) > 0) {
+			gst_structure_take_value (s, "format", &list);
+			gst_caps_append_structure (res, s);
+		}
+		else {
+			g_value_unset (&list);
+			gst_structure_free (s);
+		}
+	}
+
+	GST_DEBUG_OBJECT (trans, "Transformed %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT, caps, res);
+
+	if (filter) {
+		GstCaps *tmp = gst_caps_intersect_full (filter, res, GST_CAPS_INTERSECT_FIRST);
+		gst_caps_unref (res);
+		res = tmp;
+	}
+
+	return res;
+}
+
+// Rows of packed Bayer are not padded, 16 bit Bayer rows are padded to 4 pixels as bayer2rgb expects
+static gboolean
+gst_lumenera_bayer_unpack_get_unit_size (GstBaseTransform * trans, GstCaps * caps, gsize * size)
+{
+	GstStructure *s = gst_caps_get_structure (caps, 0);
+	const gchar *format = gst_structure_get_string (s, "format");
+	gint width, height, bits;
+
+	if (!gst_structure_get_int (s, "width", &width) || !gst_structure_get_int (s, "height", &height))
+		return FALSE;
+
+	if ((bits = gst_lumenera_bayer_packed_bits (format)))
+		*size = (gsize) width * bits / 8 * height;
+	else if (gst_lumenera_bayer_unpacked_bits (format))
+		*size = (gsize) GST_ROUND_UP_4 (width) * 2 * height;
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
+static gboolean
+gst_lumenera_bayer_unpack_set_caps (GstBaseTransform * trans, GstCaps * incaps, GstCaps * outcaps)
+{
+	GstLumeneraBayerUnpack *unpack = GST_LUMENERA_BAYER_UNPACK (trans);
+	GstStructure *s = gst_caps_get_structure (incaps, 0);
+
+	GST_DEBUG_OBJECT (unpack, "in caps %" GST_PTR_FORMAT " out caps %" GST_PTR_FORMAT, incaps, outcaps);
+
+	unpack->bits = gst_lumenera_bayer_packed_bits (gst_structure_get_string (s, "format"));
+	if (!unpack->bits || !gst_structure_get_int (s, "width", &unpack->width)
+			|| !gst_structure_get_int (s, "height", &unpack->height))
+		return FALSE;
+
+	// Groups of pixels never straddle a row
+	if (unpack->width % (unpack->bits == 10 ? 4 : 2)) {
+		GST_ERROR_OBJECT (unpack, "Width %d does not fit whole %d bit pixel groups", unpack->width, unpack->bits);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static GstFlowReturn
+gst_lumenera_bayer_unpack_transform (GstBaseTransform * trans, GstBuffer * inbuf, GstBuffer * outbuf)
+{
+	GstLumeneraBayerUnpack *unpack = GST_LUMENERA_BAYER_UNPACK (trans);
+	gsize in_stride = (gsize) unpack->width * unpack->bits / 8;
+	gsize out_stride = (gsize) GST_ROUND_UP_4 (unpack->width) * 2;
+	GstMapInfo in, out;
+	gint y;
+
+	if (!gst_buffer_map (inbuf, &in, GST_MAP_READ))
+		return GST_FLOW_ERROR;
+	if (!gst_buffer_map (outbuf, &out, GST_MAP_WRITE)) {
+		gst_buffer_unmap (inbuf, &in);
+		return GST_FLOW_ERROR;
+	}
+
+	if (in.size < in_stride * unpack->height || out.size < out_stride * unpack->height) {
+		GST_ELEMENT_ERROR (unpack, STREAM, FORMAT, ("Buffer too small for %dx%d frame.", unpack->width, unpack->height), (NULL));
+		gst_buffer_unmap (outbuf, &out);
+		gst_buffer_unmap (inbuf, &in);
+		return GST_FLOW_ERROR;
+	}
+
+	for (y = 0; y < unpack->height; y++) {
+		guint16 *dst = (guint16 *) (out.data + y * out_stride);
+		const guint8 *src = in.data + y * in_stride;
+
+		if (unpack->bits == 10)
+			gst_lumenera_proc_unpack10 (dst, src, unpack->width);
+		else
+			gst_lumenera_proc_unpack12 (dst, src, unpack->width);
+	}
+
+	gst_buffer_unmap (outbuf, &out);
+	gst_buffer_unmap (inbuf, &in);
+
+	return GST_FLOW_OK;
+}
@@ -0,0 +1,63 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef _GST_LUMENERA_BAYER_UNPACK_H_
+#define _GST_LUMENERA_BAYER_UNPACK_H_
+
+#include <gst/base/gstbasetransform.h>
+
+G_BEGIN_DECLS
+
+// Packed 10 and 12 bit Bayer, as produced by lumenerasrc, see gst_lumenera_proc_pack10/12.
+// Rows are not padded so the width must be a multiple of 4 (10 bit) or 2 (12 bit).
+#define GST_LUMENERA_BAYER_PACKED_CAPS \
+  "video/x-bayer, " \
+  "format = (string) { rggb10p, grbg10p, gbrg10p, bggr10p, rggb12p, grbg12p, gbrg12p, bggr12p }, " \
+  "width = (int) [ 1, max ], height = (int) [ 1, max ], framerate = (fraction) [ 0, max ]"
+
+#define GST_TYPE_LUMENERA_BAYER_UNPACK   (gst_lumenera_bayer_unpack_get_type())
+#define GST_LUMENERA_BAYER_UNPACK(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_LUMENERA_BAYER_UNPACK,GstLumeneraBayerUnpack))
+#define GST_LUMENERA_BAYER_UNPACK_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_LUMENERA_BAYER_UNPACK,GstLumeneraBayerUnpackClass))
+#define GST_IS_LUMENERA_BAYER_UNPACK(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_LUMENERA_BAYER_UNPACK))
+
+typedef struct _GstLumeneraBayerUnpack GstLumeneraBayerUnpack;
+typedef struct _GstLumeneraBayerUnpackClass GstLumeneraBayerUnpackClass;
+
+struct _GstLumeneraBayerUnpack
+{
+  GstBaseTransform base_bayer_unpack;
+
+  gint width;
+  gint height;
+  gint bits;  // 10 or 12
+};
+
+struct _GstLumeneraBayerUnpackClass
+{
+  GstBaseTransformClass base_bayer_unpack_class;
+};
+
+GType gst_lumenera_bayer_unpack_get_type (void);
+
+// Bits per pixel of a packed Bayer format string, 0 if it is not one
+gint gst_lumenera_bayer_packed_bits (const gchar * format);
+
+G_END_DECLS
+
+#endif
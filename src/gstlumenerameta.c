@@ -0,0 +1,142 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h> // for memcpy
+
+#include "gstlumenerametaprivate.h"
+
+GType
+gst_lumenera_frame_meta_api_get_type (void)
+{
+	static volatile GType type = 0;
+	// No tags, the values describe the capture and stay valid whatever is done to the pixels
+	static const gchar *tags[] = { NULL };
+
+	if (g_once_init_enter (&type)) {
+		GType _type = gst_meta_api_type_register (GST_LUMENERA_FRAME_META_API_NAME, tags);
+		g_once_init_leave (&type, _type);
+	}
+	return type;
+}
+
+static gboolean
+gst_lumenera_frame_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+	GstLumeneraFrameMeta *fmeta = (GstLumeneraFrameMeta *) meta;
+
+	memset ((guint8 *) fmeta + sizeof (GstMeta), 0, sizeof (GstLumeneraFrameMeta) - sizeof (GstMeta));
+	fmeta->conversion_time = GST_CLOCK_TIME_NONE;
+
+	return TRUE;
+}
+
+static gboolean
+gst_lumenera_frame_meta_transform (GstBuffer * dest, GstMeta * meta,
+		GstBuffer * buffer, GQuark type, gpointer data)
+{
+	GstLumeneraFrameMeta *smeta = (GstLumeneraFrameMeta *) meta;
+	GstLumeneraFrameMeta *dmeta;
+
+	// Copy along with the buffer, it does not depend on the memory
+	if (GST_META_TRANSFORM_IS_COPY (type)) {
+		dmeta = gst_buffer_add_lumenera_frame_meta (dest);
+		if (!dmeta)
+			return FALSE;
+		memcpy ((guint8 *) dmeta + sizeof (GstMeta), (guint8 *) smeta + sizeof (GstMeta),
+				sizeof (GstLumeneraFrameMeta) - sizeof (GstMeta));
+	}
+
+	return TRUE;
+}
+
+const GstMetaInfo *
+gst_lumenera_frame_meta_get_info (void)
+{
+	static const GstMetaInfo *meta_info = NULL;
+
+	if (g_once_init_enter (&meta_info)) {
+		const GstMetaInfo *mi = gst_meta_register (GST_LUMENERA_FRAME_META_API_TYPE,
+				"GstLumeneraFrameMeta", sizeof (GstLumeneraFrameMeta),
+				gst_lumenera_frame_meta_init, (GstMetaFreeFunction) NULL,
+				gst_lumenera_frame_meta_transform);
+		g_once_init_leave (&meta_info, mi);
+	}
+	return meta_info;
+}
+
+GstLumeneraFrameMeta *
+gst_buffer_add_lumenera_frame_meta (GstBuffer * buffer)
+{
+	return (GstLumeneraFrameMeta *) gst_buffer_add_meta (buffer, GST_LUMENERA_FRAME_META_INFO, NULL);
+}
+
+GType
+gst_lumenera_stats_meta_api_get_type (void)
+{
+	static volatile GType type = 0;
+	static const gchar *tags[] = { NULL };
+
+	if (g_once_init_enter (&type)) {
+		GType _type = gst_meta_api_type_register (GST_LUMENERA_STATS_META_API_NAME, tags);
+		g_once_init_leave (&type, _type);
+	}
+	return type;
+}
+
+static gboolean
+gst_lumenera_stats_meta_transform (GstBuffer * dest, GstMeta * meta,
+		GstBuffer * buffer, GQuark type, gpointer data)
+{
+	GstLumeneraStatsMeta *smeta = (GstLumeneraStatsMeta *) meta;
+
+	if (GST_META_TRANSFORM_IS_COPY (type))
+		return gst_buffer_add_lumenera_stats_meta (dest, &(smeta->stats)) != NULL;
+
+	return TRUE;
+}
+
+const GstMetaInfo *
+gst_lumenera_stats_meta_get_info (void)
+{
+	static const GstMetaInfo *meta_info = NULL;
+
+	if (g_once_init_enter (&meta_info)) {
+		const GstMetaInfo *mi = gst_meta_register (GST_LUMENERA_STATS_META_API_TYPE,
+				"GstLumeneraStatsMeta", sizeof (GstLumeneraStatsMeta),
+				(GstMetaInitFunction) NULL, (GstMetaFreeFunction) NULL,
+				gst_lumenera_stats_meta_transform);
+		g_once_init_leave (&meta_info, mi);
+	}
+	return meta_info;
+}
+
+GstLumeneraStatsMeta *
+gst_buffer_add_lumenera_stats_meta (GstBuffer * buffer, const GstLumeneraFrameStats * stats)
+{
+	GstLumeneraStatsMeta *meta = (GstLumeneraStatsMeta *) gst_buffer_add_meta (buffer, GST_LUMENERA_STATS_META_INFO, NULL);
+
+	if (meta)
+		memcpy (&(meta->stats), stats, sizeof (GstLumeneraFrameStats));
+
+	return meta;
+}
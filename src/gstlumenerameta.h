@@ -0,0 +1,113 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Per frame capture metadata attached by lumenerasrc to every buffer, and frame statistics
+// attached when frame-statistics is enabled.
+//
+// This header is installed so other elements can read the meta without linking to the plugin,
+// gst_buffer_get_lumenera_frame_meta() looks the API type up by name and returns NULL when
+// the plugin has not been loaded or the buffer does not carry the meta. What only the plugin
+// defines is in gstlumenerametaprivate.h.
+//
+
+#ifndef _GST_LUMENERA_META_H_
+#define _GST_LUMENERA_META_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_LUMENERA_FRAME_META_API_NAME "GstLumeneraFrameMetaAPI"
+#define GST_LUMENERA_STATS_META_API_NAME "GstLumeneraStatsMetaAPI"
+
+typedef struct _GstLumeneraFrameMeta GstLumeneraFrameMeta;
+
+struct _GstLumeneraFrameMeta
+{
+  GstMeta meta;
+
+  guint64 frame_number;   // camera frame counter, or the element's frame count where the camera has none
+  guint64 timestamp;      // capture time (ns), camera clock if hw_timestamp else host monotonic clock
+  gboolean hw_timestamp;  // timestamp and frame_number came from the camera
+
+  gdouble exposure;  // ms
+  gint gain;         // master gain 0-100%
+  gfloat rgain;
+  gfloat ggain;
+  gfloat bgain;
+  gint settings_generation;  // increments each time new settings are applied, see lumenera-settings-applied
+
+  gfloat temperature;          // sensor temperature (C), sampled in the background
+  gboolean temperature_valid;
+
+  GstClockTime conversion_time;  // time spent converting the raw frame (ns)
+  guint accumulated_frames;      // raw frames averaged or summed into this one, see accumulate-frames
+  gdouble focus_score;           // see focus-metric, higher is sharper
+  gboolean focus_valid;
+};
+
+static inline GstLumeneraFrameMeta *
+gst_buffer_get_lumenera_frame_meta (GstBuffer * buffer)
+{
+  GType api = g_type_from_name (GST_LUMENERA_FRAME_META_API_NAME);
+
+  return api ? (GstLumeneraFrameMeta *) gst_buffer_get_meta (buffer, api) : NULL;
+}
+
+typedef enum
+{
+  GST_LUMENERA_CHANNEL_RED = 0,
+  GST_LUMENERA_CHANNEL_GREEN = 1,  // both greens of the Bayer pattern, and every pixel of a monochrome sensor
+  GST_LUMENERA_CHANNEL_BLUE = 2
+} GstLumeneraChannel;
+
+#define GST_LUMENERA_STATS_CHANNELS 3
+#define GST_LUMENERA_STATS_BINS 256
+
+// Statistics of the raw frame that was demosaiced into the buffer, after any correction and accumulation
+typedef struct
+{
+  guint subsample;  // every subsample'th 2x2 Bayer cell was counted in each direction
+  guint64 pixels[GST_LUMENERA_STATS_CHANNELS];
+  guint64 saturated[GST_LUMENERA_STATS_CHANNELS];  // pixels at the top bin
+  gdouble mean[GST_LUMENERA_STATS_CHANNELS];
+  guint32 histogram[GST_LUMENERA_STATS_CHANNELS][GST_LUMENERA_STATS_BINS];
+} GstLumeneraFrameStats;
+
+typedef struct _GstLumeneraStatsMeta GstLumeneraStatsMeta;
+
+struct _GstLumeneraStatsMeta
+{
+  GstMeta meta;
+
+  GstLumeneraFrameStats stats;
+};
+
+static inline GstLumeneraStatsMeta *
+gst_buffer_get_lumenera_stats_meta (GstBuffer * buffer)
+{
+  GType api = g_type_from_name (GST_LUMENERA_STATS_META_API_NAME);
+
+  return api ? (GstLumeneraStatsMeta *) gst_buffer_get_meta (buffer, api) : NULL;
+}
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,47 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// The meta registration and add functions, defined in the plugin and not installed
+//
+
+#ifndef _GST_LUMENERA_META_PRIVATE_H_
+#define _GST_LUMENERA_META_PRIVATE_H_
+
+#include "gstlumenerameta.h"
+
+G_BEGIN_DECLS
+
+GType gst_lumenera_frame_meta_api_get_type (void);
+const GstMetaInfo *gst_lumenera_frame_meta_get_info (void);
+GstLumeneraFrameMeta *gst_buffer_add_lumenera_frame_meta (GstBuffer * buffer);
+
+#define GST_LUMENERA_FRAME_META_API_TYPE (gst_lumenera_frame_meta_api_get_type())
+#define GST_LUMENERA_FRAME_META_INFO (gst_lumenera_frame_meta_get_info())
+
+GType gst_lumenera_stats_meta_api_get_type (void);
+const GstMetaInfo *gst_lumenera_stats_meta_get_info (void);
+GstLumeneraStatsMeta *gst_buffer_add_lumenera_stats_meta (GstBuffer * buffer, const GstLumeneraFrameStats * stats);
+
+#define GST_LUMENERA_STATS_META_API_TYPE (gst_lumenera_stats_meta_api_get_type())
+#define GST_LUMENERA_STATS_META_INFO (gst_lumenera_stats_meta_get_info())
+
+G_END_DECLS
+
+#endif
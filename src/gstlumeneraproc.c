@@ -0,0 +1,1439 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for CPU_SET, pthread_setaffinity_np and sched_getcpu
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h> // for memcpy
+#include <unistd.h> // for syscall
+#include <sys/mman.h> // for madvise
+#include <sys/resource.h> // for setpriority
+#include <sys/syscall.h> // for SYS_gettid, SYS_getcpu and SYS_move_pages
+
+#include "gstlumeneraproc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define LU_TAP_STRIP            8       // columns sampled each side of the tap seam, even to keep the Bayer phase
+#define LU_TAP_GAIN_MIN         0.5
+#define LU_TAP_GAIN_MAX         2.0     // keeps (pixel * gain) << 4 inside a signed 16 bit lane
+#define LU_FOCUS_CHUNK          64      // vectors summed in 32 bit lanes before widening, |gradient| <= 2040
+#define LU_HUGE_PAGE_SIZE       (2 * 1024 * 1024)
+
+static gint
+gst_lumenera_proc_index_compare (const void * a, const void * b)
+{
+	guint32 ia = *(const guint32 *) a, ib = *(const guint32 *) b;
+
+	return ia < ib ? -1 : ia > ib;
+}
+
+//
+// Fill lut from a string, either a single gamma value or 256 table entries
+// separated by commas or spaces. Returns FALSE, leaving lut untouched, if the string is not valid.
+//
+gboolean
+gst_lumenera_proc_lut_parse (const gchar * str, guint8 * lut)
+{
+	gchar **tokens;
+	gdouble values[256];
+	guint8 table[256];
+	gint i, n = 0;
+	gboolean ok = TRUE;
+
+	tokens = g_strsplit_set (str, ", \t\n", -1);
+	for (i = 0; tokens[i] && ok; i++) {
+		gchar *end;
+
+		if (tokens[i][0] == '\0')
+			continue;
+		if (n >= 256) {
+			ok = FALSE;
+			break;
+		}
+		values[n] = g_ascii_strtod (tokens[i], &end);
+		ok = (*end == '\0');
+		n++;
+	}
+	g_strfreev (tokens);
+
+	if (!ok)
+		return FALSE;
+
+	if (n == 1) {
+		// A lone value is a gamma
+		if (values[0] <= 0.0)
+			return FALSE;
+		gst_lumenera_proc_lut_gamma (table, values[0]);
+	}
+	else if (n == 256) {
+		for (i = 0; i < 256; i++) {
+			if (values[i] < 0.0 || values[i] > 255.0 || values[i] != (gint) values[i])
+				return FALSE;
+			table[i] = (guint8) values[i];
+		}
+	}
+	else
+		return FALSE;
+
+	memcpy (lut, table, 256);
+	return TRUE;
+}
+
+//
+// Display gamma curve, output = 255 * (input / 255) ^ (1 / gamma), so 1.0 is the identity
+//
+void
+gst_lumenera_proc_lut_gamma (guint8 * lut, gdouble gamma)
+{
+	gint i;
+
+	for (i = 0; i < 256; i++)
+		lut[i] = (guint8) CLAMP (floor (255.0 * pow (i / 255.0, 1.0 / gamma) + 0.5), 0, 255);
+}
+
+//
+// dst[i] = lut[src[i]], dst may be src.
+// There is no byte gather before AVX-512 VBMI, and emulating one with shuffles costs more than the
+// lookups themselves, so this is an unrolled scalar loop: the table sits in L1, the bytes are
+// read and written 8 at a time and the loop is bound by the loads, not the lookups.
+//
+void
+gst_lumenera_proc_lut_apply (guint8 * dst, const guint8 * src, gsize n, const guint8 * lut)
+{
+	gsize i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		guint64 in, out;
+
+		memcpy (&in, src + i, 8);
+		out  = (guint64) lut[in & 0xff];
+		out |= (guint64) lut[(in >> 8) & 0xff] << 8;
+		out |= (guint64) lut[(in >> 16) & 0xff] << 16;
+		out |= (guint64) lut[(in >> 24) & 0xff] << 24;
+		out |= (guint64) lut[(in >> 32) & 0xff] << 32;
+		out |= (guint64) lut[(in >> 40) & 0xff] << 40;
+		out |= (guint64) lut[(in >> 48) & 0xff] << 48;
+		out |= (guint64) lut[in >> 56] << 56;
+		memcpy (dst + i, &out, 8);
+	}
+	for (; i < n; i++)
+		dst[i] = lut[src[i]];
+}
+
+//
+// Add the columns just either side of the seam to the calibration statistics.
+// The scene is continuous across the seam, so over a few frames both strips see the same light.
+//
+void
+gst_lumenera_proc_tap_accumulate (GstLumeneraTapStats * stats, const guint8 * raw, gint width, gint height)
+{
+	gint half = width / 2;
+	gint x, y, side;
+
+	if (half < LU_TAP_STRIP)
+		return;
+
+	for (y = 0; y < height; y++) {
+		const guint8 *row = raw + (gsize) y * width;
+
+		for (side = 0; side < 2; side++) {
+			gint x0 = side ? half : half - LU_TAP_STRIP;
+
+			for (x = x0; x < x0 + LU_TAP_STRIP; x++) {
+				gdouble v = row[x];
+
+				stats->sum[side][y & 1][x & 1] += v;
+				stats->sum2[side][y & 1][x & 1] += v * v;
+			}
+		}
+		stats->n[y & 1][0] += LU_TAP_STRIP / 2;
+		stats->n[y & 1][1] += LU_TAP_STRIP / 2;
+	}
+}
+
+//
+// Gain and offset per Bayer site that give the right strip the mean and spread of the left one
+//
+void
+gst_lumenera_proc_tap_solve (const GstLumeneraTapStats * stats, GstLumeneraTapCorrection * tap)
+{
+	gint r, c;
+
+	for (r = 0; r < 2; r++) {
+		for (c = 0; c < 2; c++) {
+			gdouble n = stats->n[r][c];
+			gdouble mean_l, mean_r, var_l, var_r, gain = 1.0;
+
+			if (n == 0) {
+				tap->gain[r][c] = 4096;
+				tap->offset[r][c] = 0;
+				continue;
+			}
+			mean_l = stats->sum[0][r][c] / n;
+			mean_r = stats->sum[1][r][c] / n;
+			var_l = stats->sum2[0][r][c] / n - mean_l * mean_l;
+			var_r = stats->sum2[1][r][c] / n - mean_r * mean_r;
+
+			// A flat scene says nothing about gain, only correct the offset then
+			if (var_l > 1.0 && var_r > 1.0)
+				gain = CLAMP (sqrt (var_l / var_r), LU_TAP_GAIN_MIN, LU_TAP_GAIN_MAX);
+
+			tap->gain[r][c] = (gint16) floor (gain * 4096.0 + 0.5);
+			tap->offset[r][c] = (gint16) CLAMP (floor ((mean_l - gain * mean_r) * 16.0 + 0.5), -2048, 2047);
+		}
+	}
+}
+
+//
+// out = ((in << 8) * gain) >> 16 is in * gain in Q4, the offset is added in Q4 and the result rounded
+//
+static inline guint8
+gst_lumenera_proc_tap_pixel (guint8 in, gint gain, gint offset)
+{
+	gint v = ((((guint) in << 8) * (guint) gain) >> 16) + offset;
+
+	return (guint8) CLAMP ((v + 8) >> 4, 0, 255);
+}
+
+static void
+gst_lumenera_proc_tap_row (guint8 * dst, const guint8 * src, gint x0, gint n, const gint16 * gain, const gint16 * offset)
+{
+	gint i = 0;
+	gint p = x0 & 1;  // Bayer phase of the first pixel
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+		const __m128i round = _mm_set1_epi16 (8);
+		const __m128i g = _mm_setr_epi16 (gain[p], gain[!p], gain[p], gain[!p], gain[p], gain[!p], gain[p], gain[!p]);
+		const __m128i o = _mm_setr_epi16 (offset[p], offset[!p], offset[p], offset[!p], offset[p], offset[!p], offset[p], offset[!p]);
+
+		// 16 pixels at a time, an even count so the phase of the gain vectors holds
+		for (; i + 16 <= n; i += 16) {
+			__m128i in = _mm_loadu_si128 ((const __m128i *) (src + i));
+			__m128i lo = _mm_slli_epi16 (_mm_unpacklo_epi8 (in, zero), 8);
+			__m128i hi = _mm_slli_epi16 (_mm_unpackhi_epi8 (in, zero), 8);
+
+			lo = _mm_adds_epi16 (_mm_mulhi_epu16 (lo, g), o);
+			hi = _mm_adds_epi16 (_mm_mulhi_epu16 (hi, g), o);
+			lo = _mm_srai_epi16 (_mm_adds_epi16 (lo, round), 4);
+			hi = _mm_srai_epi16 (_mm_adds_epi16 (hi, round), 4);
+			_mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (lo, hi));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		gint c = (p + i) & 1;
+
+		dst[i] = gst_lumenera_proc_tap_pixel (src[i], gain[c], offset[c]);
+	}
+}
+
+//
+// Map a calibration file, checking its header. The pages are only read, so they are shared with
+// the page cache and cost nothing to load again.
+//
+GstLumeneraCalFrame *
+gst_lumenera_cal_frame_load (const gchar * path, GstLumeneraCalKind kind, GError ** error)
+{
+	GMappedFile *file;
+	const guint8 *data;
+	GstLumeneraCalFrame *cal;
+	guint16 version, file_kind;
+	guint32 width, height;
+	gsize length, expected;
+
+	if (G_BYTE_ORDER != G_LITTLE_ENDIAN) {
+		g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "Calibration files are only supported on little endian hosts");
+		return NULL;
+	}
+
+	file = g_mapped_file_new (path, FALSE, error);
+	if (!file)
+		return NULL;
+
+	data = (const guint8 *) g_mapped_file_get_contents (file);
+	length = g_mapped_file_get_length (file);
+	if (length < GST_LUMENERA_CAL_HEADER_SIZE || memcmp (data, GST_LUMENERA_CAL_MAGIC, 4) != 0)
+		goto invalid;
+
+	memcpy (&version, data + 4, 2);
+	memcpy (&file_kind, data + 6, 2);
+	memcpy (&width, data + 8, 4);
+	memcpy (&height, data + 12, 4);
+	version = GUINT16_FROM_LE (version);
+	file_kind = GUINT16_FROM_LE (file_kind);
+	width = GUINT32_FROM_LE (width);
+	height = GUINT32_FROM_LE (height);
+
+	if (kind == GST_LUMENERA_CAL_DEFECTS) {
+		guint32 count;
+
+		if (length < GST_LUMENERA_CAL_HEADER_SIZE + 4)
+			goto invalid;
+		memcpy (&count, data + GST_LUMENERA_CAL_HEADER_SIZE, 4);
+		expected = GST_LUMENERA_CAL_HEADER_SIZE + 4 + (gsize) GUINT32_FROM_LE (count) * 4;
+	}
+	else
+		expected = GST_LUMENERA_CAL_HEADER_SIZE + (gsize) width * height * (kind == GST_LUMENERA_CAL_FLAT ? 2 : 1);
+	if (version != GST_LUMENERA_CAL_VERSION || file_kind != kind || width == 0 || height == 0 || length != expected)
+		goto invalid;
+
+	// The indices are used to write into frames, so they must be in order and inside the frame
+	if (kind == GST_LUMENERA_CAL_DEFECTS) {
+		const guint32 *index = (const guint32 *) (data + GST_LUMENERA_CAL_HEADER_SIZE + 4);
+		gsize i, count = (length - GST_LUMENERA_CAL_HEADER_SIZE - 4) / 4;
+
+		for (i = 0; i < count; i++)
+			if (index[i] >= (gsize) width * height || (i > 0 && index[i] <= index[i - 1]))
+				goto invalid;
+	}
+
+	// Every page is used for every frame, read them in now rather than fault them in on the streaming thread
+	madvise ((gpointer) data, length, MADV_WILLNEED);
+
+	cal = g_new0 (GstLumeneraCalFrame, 1);
+	cal->refcount = 1;
+	cal->kind = kind;
+	cal->width = width;
+	cal->height = height;
+	cal->file = file;
+	switch (kind) {
+	case GST_LUMENERA_CAL_FLAT:
+		cal->flat = (const guint16 *) (data + GST_LUMENERA_CAL_HEADER_SIZE);
+		break;
+	case GST_LUMENERA_CAL_DEFECTS:
+		cal->defects = (const guint32 *) (data + GST_LUMENERA_CAL_HEADER_SIZE + 4);
+		cal->n_defects = (length - GST_LUMENERA_CAL_HEADER_SIZE - 4) / 4;
+		break;
+	case GST_LUMENERA_CAL_DARK:
+	default:
+		cal->dark = data + GST_LUMENERA_CAL_HEADER_SIZE;
+		break;
+	}
+
+	return cal;
+
+	invalid:
+	g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL, "%s is not a valid %s calibration file", path,
+			gst_lumenera_cal_kind_name (kind));
+	g_mapped_file_unref (file);
+	return NULL;
+}
+
+GstLumeneraCalFrame *
+gst_lumenera_cal_frame_ref (GstLumeneraCalFrame * cal)
+{
+	g_atomic_int_inc (&cal->refcount);
+	return cal;
+}
+
+void
+gst_lumenera_cal_frame_unref (GstLumeneraCalFrame * cal)
+{
+	if (g_atomic_int_dec_and_test (&cal->refcount)) {
+		g_mapped_file_unref (cal->file);
+		g_free (cal);
+	}
+}
+
+const gchar *
+gst_lumenera_cal_kind_name (GstLumeneraCalKind kind)
+{
+	switch (kind) {
+	case GST_LUMENERA_CAL_FLAT:
+		return "flat";
+	case GST_LUMENERA_CAL_DEFECTS:
+		return "defects";
+	case GST_LUMENERA_CAL_DARK:
+	default:
+		return "dark";
+	}
+}
+
+static void
+gst_lumenera_cal_write_header (guint8 * out, GstLumeneraCalKind kind, gint width, gint height)
+{
+	guint16 version = GUINT16_TO_LE (GST_LUMENERA_CAL_VERSION), file_kind = GUINT16_TO_LE (kind);
+	guint32 w = GUINT32_TO_LE (width), h = GUINT32_TO_LE (height);
+
+	memcpy (out, GST_LUMENERA_CAL_MAGIC, 4);
+	memcpy (out + 4, &version, 2);
+	memcpy (out + 6, &file_kind, 2);
+	memcpy (out + 8, &w, 4);
+	memcpy (out + 12, &h, 4);
+}
+
+//
+// Write a calibration file from the sum of frames raw frames. A flat field has the dark frame,
+// if given, subtracted and is normalised to the mean of each Bayer site so colour balance is kept.
+//
+gboolean
+gst_lumenera_cal_frame_write (const gchar * path, GstLumeneraCalKind kind, const guint32 * sum, guint frames,
+		const guint8 * dark, gint width, gint height, GError ** error)
+{
+	gsize i, n = (gsize) width * height;
+	gsize size = GST_LUMENERA_CAL_HEADER_SIZE + n * (kind == GST_LUMENERA_CAL_FLAT ? 2 : 1);
+	guint8 *out = g_malloc (size);
+	gboolean ok;
+
+	gst_lumenera_cal_write_header (out, kind, width, height);
+
+	if (kind == GST_LUMENERA_CAL_DARK) {
+		guint8 *pix = out + GST_LUMENERA_CAL_HEADER_SIZE;
+
+		for (i = 0; i < n; i++)
+			pix[i] = (guint8) MIN ((sum[i] + frames / 2) / frames, 255);
+	}
+	else {
+		guint16 *pix = (guint16 *) (out + GST_LUMENERA_CAL_HEADER_SIZE);
+		gdouble site_sum[2][2] = { { 0, 0 }, { 0, 0 } }, site_mean[2][2];
+		guint64 site_n[2][2] = { { 0, 0 }, { 0, 0 } };
+		gint x, y;
+
+		for (y = 0; y < height; y++)
+			for (x = 0; x < width; x++) {
+				i = (gsize) y * width + x;
+				site_sum[y & 1][x & 1] += (gdouble) sum[i] / frames - (dark ? dark[i] : 0);
+				site_n[y & 1][x & 1]++;
+			}
+		for (y = 0; y < 2; y++)
+			for (x = 0; x < 2; x++)
+				site_mean[y][x] = site_n[y][x] ? site_sum[y][x] / site_n[y][x] : 0;
+
+		for (y = 0; y < height; y++)
+			for (x = 0; x < width; x++) {
+				gdouble v;
+
+				i = (gsize) y * width + x;
+				v = (gdouble) sum[i] / frames - (dark ? dark[i] : 0);
+				// Dead pixels are left alone
+				pix[i] = GUINT16_TO_LE (v > 0.5 ? (guint16) CLAMP (floor (site_mean[y & 1][x & 1] / v * 4096.0 + 0.5), 1, 65535) : 4096);
+			}
+	}
+
+	ok = g_file_set_contents (path, (const gchar *) out, size, error);
+	g_free (out);
+
+	return ok;
+}
+
+//
+// Median of the same colour neighbours of (x, y) two pixels away, skipping those in the sorted list
+// defects when given. Returns FALSE if there are none.
+//
+static gboolean
+gst_lumenera_proc_neighbour_median (const guint8 * raw, gint width, gint height, gint x, gint y,
+		const guint32 * defects, guint n, guint8 * median)
+{
+	static const gint offsets[8][2] = { {-2, -2}, {0, -2}, {2, -2}, {-2, 0}, {2, 0}, {-2, 2}, {0, 2}, {2, 2} };
+	guint8 v[8];
+	gint k, j, count = 0;
+
+	for (k = 0; k < 8; k++) {
+		gint nx = x + offsets[k][0], ny = y + offsets[k][1];
+		guint32 index;
+		guint8 value;
+
+		if (nx < 0 || ny < 0 || nx >= width || ny >= height)
+			continue;
+		index = (guint32) ny * width + nx;
+		if (defects && bsearch (&index, defects, n, sizeof (guint32), gst_lumenera_proc_index_compare))
+			continue;
+
+		// Insertion sort as we go, eight at most
+		value = raw[index];
+		for (j = count; j > 0 && v[j - 1] > value; j--)
+			v[j] = v[j - 1];
+		v[j] = value;
+		count++;
+	}
+	if (count == 0)
+		return FALSE;
+
+	*median = (count & 1) ? v[count / 2] : (v[count / 2 - 1] + v[count / 2] + 1) / 2;
+	return TRUE;
+}
+
+//
+// Find hot pixels in the mean of frames dark frames, those more than threshold above the median of their
+// same colour neighbours, and write them as a defect map
+//
+gboolean
+gst_lumenera_cal_defects_write (const gchar * path, const guint32 * sum, guint frames, guint threshold,
+		gint width, gint height, guint * n_defects, GError ** error)
+{
+	gsize i, n = (gsize) width * height;
+	guint8 *mean = g_malloc (n);
+	GArray *found = g_array_new (FALSE, FALSE, sizeof (guint32));
+	guint8 *out;
+	gsize size;
+	guint32 count;
+	gint x, y;
+	gboolean ok;
+
+	for (i = 0; i < n; i++)
+		mean[i] = (guint8) MIN ((sum[i] + frames / 2) / frames, 255);
+
+	for (y = 0; y < height; y++)
+		for (x = 0; x < width; x++) {
+			guint32 index = (guint32) y * width + x;
+			guint8 median;
+
+			if (gst_lumenera_proc_neighbour_median (mean, width, height, x, y, NULL, 0, &median)
+					&& mean[index] > median + threshold)
+				g_array_append_val (found, index);
+		}
+
+	size = GST_LUMENERA_CAL_HEADER_SIZE + 4 + found->len * 4;
+	out = g_malloc (size);
+	gst_lumenera_cal_write_header (out, GST_LUMENERA_CAL_DEFECTS, width, height);
+	count = GUINT32_TO_LE (found->len);
+	memcpy (out + GST_LUMENERA_CAL_HEADER_SIZE, &count, 4);
+	for (i = 0; i < found->len; i++) {
+		guint32 index = GUINT32_TO_LE (g_array_index (found, guint32, i));
+
+		memcpy (out + GST_LUMENERA_CAL_HEADER_SIZE + 4 + i * 4, &index, 4);
+	}
+
+	ok = g_file_set_contents (path, (const gchar *) out, size, error);
+	if (n_defects)
+		*n_defects = found->len;
+
+	g_free (out);
+	g_array_free (found, TRUE);
+	g_free (mean);
+
+	return ok;
+}
+
+//
+// Only the listed pixels are touched, so the cost follows the number of defects, not the frame size
+//
+void
+gst_lumenera_proc_defects_correct (guint8 * raw, gint width, gint height, const guint32 * defects, guint n)
+{
+	guint i;
+
+	for (i = 0; i < n; i++) {
+		gint x = defects[i] % width, y = defects[i] / width;
+		guint8 median;
+
+		if (gst_lumenera_proc_neighbour_median (raw, width, height, x, y, defects, n, &median))
+			raw[defects[i]] = median;
+	}
+}
+
+//
+// Sums of each Bayer site over the block, a row at a time so the raw frame is read in order
+//
+void
+gst_lumenera_proc_preview (guint8 * dst, gint dst_stride, const guint8 * raw, gboolean raw16, gint width, gint y0, gint y1,
+		gint factor, gint red, gint blue)
+{
+	gint out_width = width / factor, cells = factor * factor / 4;
+	gint oy, ox, y, x;
+
+	for (oy = y0 / factor; oy < y1 / factor; oy++) {
+		guint8 *out = dst + oy * dst_stride;
+
+		for (ox = 0; ox < out_width; ox++) {
+			guint32 sum[4] = { 0, 0, 0, 0 };
+
+			for (y = 0; y < factor; y++) {
+				gsize row = (gsize) (oy * factor + y) * width + ox * factor;
+
+				if (raw16) {
+					const guint8 *p = raw + row * 2 + 1;  // upper byte, little endian
+
+					for (x = 0; x < factor; x++)
+						sum[(y & 1) * 2 + (x & 1)] += p[x * 2];
+				}
+				else {
+					const guint8 *p = raw + row;
+
+					for (x = 0; x < factor; x++)
+						sum[(y & 1) * 2 + (x & 1)] += p[x];
+				}
+			}
+
+			if (red == blue) {
+				out[ox * 3] = out[ox * 3 + 1] = out[ox * 3 + 2] = (sum[0] + sum[1] + sum[2] + sum[3]) / (4 * cells);
+			}
+			else {
+				out[ox * 3] = sum[red] / cells;
+				out[ox * 3 + 1] = (sum[0] + sum[1] + sum[2] + sum[3] - sum[red] - sum[blue]) / (2 * cells);
+				out[ox * 3 + 2] = sum[blue] / cells;
+			}
+		}
+	}
+}
+
+GstLumeneraArena *
+gst_lumenera_arena_new (gsize size, gboolean huge_pages, gboolean lock, GError ** error)
+{
+	GstLumeneraArena *arena = g_new0 (GstLumeneraArena, 1);
+	void *data = MAP_FAILED;
+
+	arena->size = size;
+	if (huge_pages) {
+		arena->size = (size + LU_HUGE_PAGE_SIZE - 1) / LU_HUGE_PAGE_SIZE * LU_HUGE_PAGE_SIZE;
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+		data = mmap (NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+		arena->huge_pages = (data != MAP_FAILED);
+#endif
+	}
+
+	if (data == MAP_FAILED) {
+		data = mmap (NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (data == MAP_FAILED) {
+			g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno), "Could not map %" G_GSIZE_FORMAT " bytes: %s",
+					arena->size, g_strerror (errno));
+			g_free (arena);
+			return NULL;
+		}
+#ifdef MADV_HUGEPAGE
+		// Before the pages are touched, or they are small pages until khugepaged gets to them
+		if (huge_pages)
+			madvise (data, arena->size, MADV_HUGEPAGE);
+#endif
+	}
+	arena->data = data;
+
+	if (lock)
+		arena->locked = (mlock (data, arena->size) == 0);
+	if (!arena->locked && !arena->huge_pages)
+		memset (data, 0, arena->size);  // mlock and MAP_POPULATE fault the pages in, otherwise touch them
+
+	return arena;
+}
+
+void
+gst_lumenera_arena_free (GstLumeneraArena * arena)
+{
+	if (arena->locked)
+		munlock (arena->data, arena->size);
+	munmap (arena->data, arena->size);
+	g_free (arena);
+}
+
+static gboolean
+lu_cpus_parse (const gchar * cpus, cpu_set_t * set)
+{
+	const gchar *p = cpus;
+
+	CPU_ZERO (set);
+	while (*p) {
+		gchar *end;
+		gulong first, last;
+
+		first = last = strtoul (p, &end, 10);
+		if (end == p)
+			return FALSE;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul (p, &end, 10);
+			if (end == p || last < first)
+				return FALSE;
+		}
+		if (last >= CPU_SETSIZE)
+			return FALSE;
+		for (; first <= last; first++)
+			CPU_SET (first, set);
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return FALSE;
+		p = end;
+	}
+
+	return CPU_COUNT (set) > 0;
+}
+
+gboolean
+gst_lumenera_cpus_valid (const gchar * cpus)
+{
+	cpu_set_t set;
+
+	return !cpus || !*cpus || lu_cpus_parse (cpus, &set);
+}
+
+//
+// The affinity as a list of ranges, "0-3,6"
+//
+static void
+lu_cpus_format (const cpu_set_t * set, gchar * str, gsize size)
+{
+	gsize len = 0;
+	gint cpu, first = -1;
+
+	str[0] = '\0';
+	for (cpu = 0; cpu <= CPU_SETSIZE; cpu++) {
+		gboolean in = cpu < CPU_SETSIZE && CPU_ISSET (cpu, set);
+
+		if (in && first < 0)
+			first = cpu;
+		else if (!in && first >= 0) {
+			if (cpu - 1 > first)
+				len += g_snprintf (str + len, size - MIN (len, size), "%s%d-%d", len ? "," : "", first, cpu - 1);
+			else
+				len += g_snprintf (str + len, size - MIN (len, size), "%s%d", len ? "," : "", first);
+			first = -1;
+		}
+	}
+}
+
+gboolean
+gst_lumenera_thread_schedule (const gchar * cpus, gint priority, GstLumeneraThreadSched * applied)
+{
+	pthread_t self = pthread_self ();
+	struct sched_param param;
+	cpu_set_t set;
+	gboolean ok = TRUE;
+	guint cpu = 0, node = 0;
+
+	if (cpus && *cpus)
+		ok = lu_cpus_parse (cpus, &set) && pthread_setaffinity_np (self, sizeof (set), &set) == 0;
+
+	if (priority > 0) {
+		memset (&param, 0, sizeof (param));
+		param.sched_priority = CLAMP (priority, sched_get_priority_min (SCHED_FIFO), sched_get_priority_max (SCHED_FIFO));
+		if (pthread_setschedparam (self, SCHED_FIFO, &param) != 0) {
+			struct rlimit rl;
+			gint nice = -10;
+
+			// RLIMIT_NICE allows nice values down to 20 - rlim_cur, on Linux the nice value is per thread
+			if (getrlimit (RLIMIT_NICE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+				nice = MAX (nice, 20 - (gint) rl.rlim_cur);
+			if (nice < 0)
+				setpriority (PRIO_PROCESS, syscall (SYS_gettid), nice);
+			ok = FALSE;
+		}
+	}
+
+	memset (applied, 0, sizeof (GstLumeneraThreadSched));
+	applied->set = TRUE;
+	if (pthread_getschedparam (self, &applied->policy, &param) == 0)
+		applied->priority = param.sched_priority;
+	if (applied->policy != SCHED_FIFO && applied->policy != SCHED_RR) {
+		applied->priority = getpriority (PRIO_PROCESS, syscall (SYS_gettid));
+	}
+	if (pthread_getaffinity_np (self, sizeof (set), &set) == 0)
+		lu_cpus_format (&set, applied->cpus, sizeof (applied->cpus));
+	applied->node = -1;
+#ifdef SYS_getcpu
+	if (syscall (SYS_getcpu, &cpu, &node, NULL) == 0)
+		applied->node = node;
+#endif
+
+	return ok;
+}
+
+G_STATIC_ASSERT (sizeof (cpu_set_t) <= sizeof (((GstLumeneraThreadSaved *) NULL)->affinity));
+
+void
+gst_lumenera_thread_save (GstLumeneraThreadSaved * saved)
+{
+	pthread_t self = pthread_self ();
+	struct sched_param param;
+
+	memset (saved, 0, sizeof (GstLumeneraThreadSaved));
+	if (pthread_getschedparam (self, &saved->policy, &param) != 0)
+		return;
+	saved->priority = param.sched_priority;
+	errno = 0;
+	saved->nice = getpriority (PRIO_PROCESS, syscall (SYS_gettid));
+	if (saved->nice == -1 && errno != 0)
+		return;
+	if (pthread_getaffinity_np (self, sizeof (cpu_set_t), (cpu_set_t *) saved->affinity) != 0)
+		return;
+	saved->saved = TRUE;
+}
+
+//
+// Going back to time-sharing and a higher nice value are always permitted, so this only fails if the
+// original affinity names CPUs since taken offline
+//
+void
+gst_lumenera_thread_restore (GstLumeneraThreadSaved * saved)
+{
+	pthread_t self = pthread_self ();
+	struct sched_param param;
+
+	if (!saved->saved)
+		return;
+
+	memset (&param, 0, sizeof (param));
+	param.sched_priority = saved->priority;
+	pthread_setschedparam (self, saved->policy, &param);
+	setpriority (PRIO_PROCESS, syscall (SYS_gettid), saved->nice);
+	pthread_setaffinity_np (self, sizeof (cpu_set_t), (const cpu_set_t *) saved->affinity);
+	saved->saved = FALSE;
+}
+
+const gchar *
+gst_lumenera_sched_policy_name (gint policy)
+{
+	switch (policy) {
+	case SCHED_FIFO:
+		return "fifo";
+	case SCHED_RR:
+		return "rr";
+#ifdef SCHED_BATCH
+	case SCHED_BATCH:
+		return "batch";
+#endif
+#ifdef SCHED_IDLE
+	case SCHED_IDLE:
+		return "idle";
+#endif
+	default:
+		return "other";
+	}
+}
+
+//
+// move_pages with no target nodes only reports where each page is, no libnuma needed
+//
+gint
+gst_lumenera_memory_node (gconstpointer p)
+{
+#ifdef SYS_move_pages
+	void *page = (void *) ((guintptr) p & ~((guintptr) sysconf (_SC_PAGESIZE) - 1));
+	int status = -1;
+
+	if (p && syscall (SYS_move_pages, 0, 1UL, &page, NULL, &status, 0) == 0 && status >= 0)
+		return status;
+#endif
+	return -1;
+}
+
+//
+// sum += raw, 16 pixels per step
+//
+void
+gst_lumenera_proc_accumulate (guint32 * sum, const guint8 * raw, gsize n)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128 ((const __m128i *) (raw + i));
+			__m128i lo = _mm_unpacklo_epi8 (v, zero);
+			__m128i hi = _mm_unpackhi_epi8 (v, zero);
+			__m128i *s = (__m128i *) (sum + i);
+
+			_mm_storeu_si128 (s, _mm_add_epi32 (_mm_loadu_si128 (s), _mm_unpacklo_epi16 (lo, zero)));
+			_mm_storeu_si128 (s + 1, _mm_add_epi32 (_mm_loadu_si128 (s + 1), _mm_unpackhi_epi16 (lo, zero)));
+			_mm_storeu_si128 (s + 2, _mm_add_epi32 (_mm_loadu_si128 (s + 2), _mm_unpacklo_epi16 (hi, zero)));
+			_mm_storeu_si128 (s + 3, _mm_add_epi32 (_mm_loadu_si128 (s + 3), _mm_unpackhi_epi16 (hi, zero)));
+		}
+	}
+#endif
+	for (; i < n; i++)
+		sum[i] += raw[i];
+}
+
+// 16 bit sums hold up to 257 frames without overflow and halve the memory traffic
+void
+gst_lumenera_proc_accumulate16 (guint16 * sum, const guint8 * raw, gsize n)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128 ((const __m128i *) (raw + i));
+			__m128i *s = (__m128i *) (sum + i);
+
+			_mm_storeu_si128 (s, _mm_add_epi16 (_mm_loadu_si128 (s), _mm_unpacklo_epi8 (v, zero)));
+			_mm_storeu_si128 (s + 1, _mm_add_epi16 (_mm_loadu_si128 (s + 1), _mm_unpackhi_epi8 (v, zero)));
+		}
+	}
+#endif
+	for (; i < n; i++)
+		sum[i] += raw[i];
+}
+
+#ifdef __SSE2__
+// Four 32 bit sums scaled and rounded to the nearest integer
+static inline __m128i
+gst_lumenera_proc_scale4 (__m128i sum, __m128 scale)
+{
+	return _mm_cvtps_epi32 (_mm_mul_ps (_mm_cvtepi32_ps (sum), scale));
+}
+#endif
+
+//
+// dst = sum * scale rounded and saturated to 8 bits, clearing sum for the next block.
+// A scale of 1 / frames averages, 1 gives the saturated sum.
+//
+void
+gst_lumenera_proc_accumulate_finish (guint8 * dst, guint32 * sum, gsize n, gfloat scale)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+		const __m128 vscale = _mm_set1_ps (scale);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i *s = (__m128i *) (sum + i);
+			__m128i a = gst_lumenera_proc_scale4 (_mm_loadu_si128 (s), vscale);
+			__m128i b = gst_lumenera_proc_scale4 (_mm_loadu_si128 (s + 1), vscale);
+			__m128i c = gst_lumenera_proc_scale4 (_mm_loadu_si128 (s + 2), vscale);
+			__m128i d = gst_lumenera_proc_scale4 (_mm_loadu_si128 (s + 3), vscale);
+
+			_mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (_mm_packs_epi32 (a, b), _mm_packs_epi32 (c, d)));
+			_mm_storeu_si128 (s, zero);
+			_mm_storeu_si128 (s + 1, zero);
+			_mm_storeu_si128 (s + 2, zero);
+			_mm_storeu_si128 (s + 3, zero);
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = (guint8) MIN (lrintf (sum[i] * scale), 255);
+		sum[i] = 0;
+	}
+}
+
+void
+gst_lumenera_proc_accumulate_finish16 (guint8 * dst, guint16 * sum, gsize n, gfloat scale)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+		const __m128 vscale = _mm_set1_ps (scale);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i *s = (__m128i *) (sum + i);
+			__m128i lo = _mm_loadu_si128 (s);
+			__m128i hi = _mm_loadu_si128 (s + 1);
+			__m128i a = gst_lumenera_proc_scale4 (_mm_unpacklo_epi16 (lo, zero), vscale);
+			__m128i b = gst_lumenera_proc_scale4 (_mm_unpackhi_epi16 (lo, zero), vscale);
+			__m128i c = gst_lumenera_proc_scale4 (_mm_unpacklo_epi16 (hi, zero), vscale);
+			__m128i d = gst_lumenera_proc_scale4 (_mm_unpackhi_epi16 (hi, zero), vscale);
+
+			_mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (_mm_packs_epi32 (a, b), _mm_packs_epi32 (c, d)));
+			_mm_storeu_si128 (s, zero);
+			_mm_storeu_si128 (s + 1, zero);
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		dst[i] = (guint8) MIN (lrintf (sum[i] * scale), 255);
+		sum[i] = 0;
+	}
+}
+
+//
+// Exponential running average, acc += (raw - acc) * weight and dst is acc rounded.
+// A weight of 1 starts it from raw. dst may be raw.
+//
+void
+gst_lumenera_proc_running_average (guint8 * dst, gfloat * acc, const guint8 * raw, gsize n, gfloat weight)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+		const __m128 vweight = _mm_set1_ps (weight);
+		__m128i q[4];
+		gint k;
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128 ((const __m128i *) (raw + i));
+			__m128i lo = _mm_unpacklo_epi8 (v, zero);
+			__m128i hi = _mm_unpackhi_epi8 (v, zero);
+			__m128i in[4];
+
+			in[0] = _mm_unpacklo_epi16 (lo, zero);
+			in[1] = _mm_unpackhi_epi16 (lo, zero);
+			in[2] = _mm_unpacklo_epi16 (hi, zero);
+			in[3] = _mm_unpackhi_epi16 (hi, zero);
+			for (k = 0; k < 4; k++) {
+				__m128 a = _mm_loadu_ps (acc + i + 4 * k);
+
+				a = _mm_add_ps (a, _mm_mul_ps (_mm_sub_ps (_mm_cvtepi32_ps (in[k]), a), vweight));
+				_mm_storeu_ps (acc + i + 4 * k, a);
+				q[k] = _mm_cvtps_epi32 (a);
+			}
+			_mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi16 (_mm_packs_epi32 (q[0], q[1]), _mm_packs_epi32 (q[2], q[3])));
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		acc[i] += (raw[i] - acc[i]) * weight;
+		dst[i] = (guint8) CLAMP (lrintf (acc[i]), 0, 255);
+	}
+}
+
+//
+// Histograms are scatter bound, so rather than vectors each row parity counts into four tables by
+// column (x & 3), neighbouring pixels never wait on each other's increment, then they are merged by site.
+//
+void
+gst_lumenera_proc_histogram (guint32 (*hist)[256], const guint8 * raw, gint width, gint y0, gint y1, gint step)
+{
+	guint32 h[2][4][256];
+	gint x, y, r, i;
+
+	memset (h, 0, sizeof (h));
+
+	for (y = y0; y < y1; y += 2 * step) {
+		for (r = 0; r < 2 && y + r < y1; r++) {
+			const guint8 *p = raw + (gsize) (y + r) * width;
+			guint32 (*t)[256] = h[r];
+
+			if (step == 1) {
+				for (x = 0; x + 4 <= width; x += 4) {
+					t[0][p[x]]++;
+					t[1][p[x + 1]]++;
+					t[2][p[x + 2]]++;
+					t[3][p[x + 3]]++;
+				}
+				for (; x < width; x++)
+					t[x & 3][p[x]]++;
+			}
+			else {
+				for (x = 0; x + 1 < width; x += 2 * step) {
+					t[0][p[x]]++;
+					t[1][p[x + 1]]++;
+				}
+			}
+		}
+	}
+
+	for (r = 0; r < 2; r++)
+		for (i = 0; i < 256; i++) {
+			hist[r * 2][i] += h[r][0][i] + h[r][2][i];
+			hist[r * 2 + 1][i] += h[r][1][i] + h[r][3][i];
+		}
+}
+
+//
+// One row of the green image, the sum of the two greens of each 2x2 cell of raw rows row0 and row1
+//
+static void
+gst_lumenera_proc_green_row (gint16 * dst, const guint8 * row0, const guint8 * row1, gint cells, gboolean green_first)
+{
+	gint a = green_first ? 0 : 1;  // green column in row0, row1 has it in the other column
+	gint i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i low = _mm_set1_epi16 (0x00ff);
+
+		for (; i + 8 <= cells; i += 8) {
+			__m128i v0 = _mm_loadu_si128 ((const __m128i *) (row0 + 2 * i));
+			__m128i v1 = _mm_loadu_si128 ((const __m128i *) (row1 + 2 * i));
+			__m128i g0 = a ? _mm_srli_epi16 (v0, 8) : _mm_and_si128 (v0, low);
+			__m128i g1 = a ? _mm_and_si128 (v1, low) : _mm_srli_epi16 (v1, 8);
+
+			_mm_storeu_si128 ((__m128i *) (dst + i), _mm_add_epi16 (g0, g1));
+		}
+	}
+#endif
+	for (; i < cells; i++)
+		dst[i] = row0[2 * i + a] + row1[2 * i + 1 - a];
+}
+
+typedef struct
+{
+	gint16 *rows[3];  // green image rows above, at and below the current one
+	gint16 *buffer;
+	gint cells_x;
+	gint cells_y;
+	const guint8 *raw;
+	gint stride;
+	gboolean green_first;
+} GstLumeneraGreenWindow;
+
+static gboolean
+gst_lumenera_proc_green_window_init (GstLumeneraGreenWindow * win, const guint8 * raw, gint stride,
+		gint x, gint y, gint width, gint height, gboolean green_first)
+{
+	gint k;
+
+	win->cells_x = width / 2;
+	win->cells_y = height / 2;
+	if (win->cells_x < 3 || win->cells_y < 3)
+		return FALSE;
+
+	win->raw = raw + (gsize) (y & ~1) * stride + (x & ~1);
+	win->stride = stride;
+	win->green_first = green_first;
+	win->buffer = g_new (gint16, 3 * win->cells_x);
+	for (k = 0; k < 3; k++) {
+		win->rows[k] = win->buffer + k * win->cells_x;
+		gst_lumenera_proc_green_row (win->rows[k], win->raw + (gsize) 2 * k * stride, win->raw + (gsize) (2 * k + 1) * stride,
+				win->cells_x, green_first);
+	}
+
+	return TRUE;
+}
+
+// Move the window down a row of cells, cy is the new centre row
+static void
+gst_lumenera_proc_green_window_next (GstLumeneraGreenWindow * win, gint cy)
+{
+	gint16 *top = win->rows[0];
+
+	win->rows[0] = win->rows[1];
+	win->rows[1] = win->rows[2];
+	win->rows[2] = top;
+	gst_lumenera_proc_green_row (top, win->raw + (gsize) 2 * (cy + 1) * win->stride,
+			win->raw + (gsize) (2 * (cy + 1) + 1) * win->stride, win->cells_x, win->green_first);
+}
+
+#ifdef __SSE2__
+static inline gint64
+gst_lumenera_proc_hsum32 (__m128i v)
+{
+	gint32 lanes[4];
+
+	_mm_storeu_si128 ((__m128i *) lanes, v);
+	return (gint64) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+//
+// Variance of the 4 neighbour Laplacian, in single pixel levels
+//
+gdouble
+gst_lumenera_proc_focus_laplacian (const guint8 * raw, gint stride, gint x, gint y, gint width, gint height,
+		gboolean green_first)
+{
+	GstLumeneraGreenWindow win;
+	gint64 sum = 0, sum2 = 0, n;
+	gint cx, cy;
+
+	if (!gst_lumenera_proc_green_window_init (&win, raw, stride, x, y, width, height, green_first))
+		return -1.0;
+
+	for (cy = 1; cy < win.cells_y - 1; cy++) {
+		const gint16 *t = win.rows[0], *m = win.rows[1], *b = win.rows[2];
+
+		cx = 1;
+#ifdef __SSE2__
+		{
+			const __m128i ones = _mm_set1_epi16 (1);
+
+			while (cx + 8 <= win.cells_x - 1) {
+				__m128i vsum = _mm_setzero_si128 (), vsum2 = _mm_setzero_si128 ();
+				gint k;
+
+				for (k = 0; k < LU_FOCUS_CHUNK && cx + 8 <= win.cells_x - 1; k++, cx += 8) {
+					__m128i c = _mm_loadu_si128 ((const __m128i *) (m + cx));
+					__m128i lap = _mm_add_epi16 (_mm_add_epi16 (_mm_loadu_si128 ((const __m128i *) (t + cx)),
+							_mm_loadu_si128 ((const __m128i *) (b + cx))),
+							_mm_add_epi16 (_mm_loadu_si128 ((const __m128i *) (m + cx - 1)),
+							_mm_loadu_si128 ((const __m128i *) (m + cx + 1))));
+
+					lap = _mm_sub_epi16 (lap, _mm_slli_epi16 (c, 2));
+					vsum = _mm_add_epi32 (vsum, _mm_madd_epi16 (lap, ones));
+					vsum2 = _mm_add_epi32 (vsum2, _mm_madd_epi16 (lap, lap));
+				}
+				sum += gst_lumenera_proc_hsum32 (vsum);
+				sum2 += gst_lumenera_proc_hsum32 (vsum2);
+			}
+		}
+#endif
+		for (; cx < win.cells_x - 1; cx++) {
+			gint lap = t[cx] + b[cx] + m[cx - 1] + m[cx + 1] - 4 * m[cx];
+
+			sum += lap;
+			sum2 += lap * lap;
+		}
+
+		if (cy + 1 < win.cells_y - 1)
+			gst_lumenera_proc_green_window_next (&win, cy + 1);
+	}
+	g_free (win.buffer);
+
+	// The green image is the sum of two pixels
+	n = (gint64) (win.cells_x - 2) * (win.cells_y - 2);
+	return ((gdouble) sum2 / n - ((gdouble) sum / n) * ((gdouble) sum / n)) / 4.0;
+}
+
+//
+// Mean squared Sobel gradient magnitude, in single pixel levels
+//
+gdouble
+gst_lumenera_proc_focus_tenengrad (const guint8 * raw, gint stride, gint x, gint y, gint width, gint height,
+		gboolean green_first)
+{
+	GstLumeneraGreenWindow win;
+	gint64 sum2 = 0, n;
+	gint cx, cy;
+
+	if (!gst_lumenera_proc_green_window_init (&win, raw, stride, x, y, width, height, green_first))
+		return -1.0;
+
+	for (cy = 1; cy < win.cells_y - 1; cy++) {
+		const gint16 *t = win.rows[0], *m = win.rows[1], *b = win.rows[2];
+
+		cx = 1;
+#ifdef __SSE2__
+		while (cx + 8 <= win.cells_x - 1) {
+			__m128i vsum2 = _mm_setzero_si128 ();
+			gint k;
+
+			for (k = 0; k < LU_FOCUS_CHUNK && cx + 8 <= win.cells_x - 1; k++, cx += 8) {
+				__m128i tl = _mm_loadu_si128 ((const __m128i *) (t + cx - 1));
+				__m128i tc = _mm_loadu_si128 ((const __m128i *) (t + cx));
+				__m128i tr = _mm_loadu_si128 ((const __m128i *) (t + cx + 1));
+				__m128i ml = _mm_loadu_si128 ((const __m128i *) (m + cx - 1));
+				__m128i mr = _mm_loadu_si128 ((const __m128i *) (m + cx + 1));
+				__m128i bl = _mm_loadu_si128 ((const __m128i *) (b + cx - 1));
+				__m128i bc = _mm_loadu_si128 ((const __m128i *) (b + cx));
+				__m128i br = _mm_loadu_si128 ((const __m128i *) (b + cx + 1));
+				__m128i gx, gy;
+
+				gx = _mm_add_epi16 (_mm_sub_epi16 (tr, tl), _mm_sub_epi16 (br, bl));
+				gx = _mm_add_epi16 (gx, _mm_slli_epi16 (_mm_sub_epi16 (mr, ml), 1));
+				gy = _mm_add_epi16 (_mm_sub_epi16 (bl, tl), _mm_sub_epi16 (br, tr));
+				gy = _mm_add_epi16 (gy, _mm_slli_epi16 (_mm_sub_epi16 (bc, tc), 1));
+				vsum2 = _mm_add_epi32 (vsum2, _mm_add_epi32 (_mm_madd_epi16 (gx, gx), _mm_madd_epi16 (gy, gy)));
+			}
+			sum2 += gst_lumenera_proc_hsum32 (vsum2);
+		}
+#endif
+		for (; cx < win.cells_x - 1; cx++) {
+			gint gx = (t[cx + 1] - t[cx - 1]) + 2 * (m[cx + 1] - m[cx - 1]) + (b[cx + 1] - b[cx - 1]);
+			gint gy = (b[cx - 1] + 2 * b[cx] + b[cx + 1]) - (t[cx - 1] + 2 * t[cx] + t[cx + 1]);
+
+			sum2 += gx * gx + gy * gy;
+		}
+
+		if (cy + 1 < win.cells_y - 1)
+			gst_lumenera_proc_green_window_next (&win, cy + 1);
+	}
+	g_free (win.buffer);
+
+	n = (gint64) (win.cells_x - 2) * (win.cells_y - 2);
+	return (gdouble) sum2 / n / 4.0;
+}
+
+//
+// 8 pixels per step: the upper bytes are packed with packus, the low bits of each group of 4 are
+// gathered by madd into one byte per 64 bit lane
+//
+void
+gst_lumenera_proc_pack10 (guint8 * dst, const guint16 * src, gsize n, guint shift)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i count = _mm_cvtsi32_si128 (shift);
+		const __m128i mask = _mm_set1_epi16 (0x3ff);
+		const __m128i three = _mm_set1_epi16 (3);
+		const __m128i weight = _mm_setr_epi16 (1, 4, 16, 64, 1, 4, 16, 64);
+		union { __m128i v; guint8 b[16]; } hi, lo;
+
+		for (; i + 8 <= n; i += 8, dst += 10) {
+			__m128i v = _mm_and_si128 (_mm_srl_epi16 (_mm_loadu_si128 ((const __m128i *) (src + i)), count), mask);
+			__m128i l = _mm_madd_epi16 (_mm_and_si128 (v, three), weight);
+
+			hi.v = _mm_srli_epi16 (v, 2);
+			hi.v = _mm_packus_epi16 (hi.v, hi.v);
+			lo.v = _mm_add_epi32 (l, _mm_srli_epi64 (l, 32));
+			memcpy (dst, hi.b, 4);
+			dst[4] = lo.b[0];
+			memcpy (dst + 5, hi.b + 4, 4);
+			dst[9] = lo.b[8];
+		}
+	}
+#endif
+	for (; i + 4 <= n; i += 4, dst += 5) {
+		guint a = (src[i] >> shift) & 0x3ff, b = (src[i + 1] >> shift) & 0x3ff;
+		guint c = (src[i + 2] >> shift) & 0x3ff, d = (src[i + 3] >> shift) & 0x3ff;
+
+		dst[0] = a >> 2;
+		dst[1] = b >> 2;
+		dst[2] = c >> 2;
+		dst[3] = d >> 2;
+		dst[4] = (a & 3) | (b & 3) << 2 | (c & 3) << 4 | (d & 3) << 6;
+	}
+}
+
+//
+// 8 pixels per step: each pair is assembled into the low 24 bits of a 32 bit lane, then two lanes
+// are joined into 48 bits of each 64 bit lane
+//
+void
+gst_lumenera_proc_pack12 (guint8 * dst, const guint16 * src, gsize n, guint shift)
+{
+	gsize i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i count = _mm_cvtsi32_si128 (shift);
+		const __m128i mask = _mm_set1_epi16 (0xfff);
+		const __m128i low16 = _mm_set1_epi32 (0xffff);
+		const __m128i fifteen = _mm_set1_epi32 (15);
+		const __m128i low32 = _mm_set_epi32 (0, -1, 0, -1);
+		union { __m128i v; guint8 b[16]; } out;
+
+		for (; i + 8 <= n; i += 8, dst += 12) {
+			__m128i v = _mm_and_si128 (_mm_srl_epi16 (_mm_loadu_si128 ((const __m128i *) (src + i)), count), mask);
+			__m128i a = _mm_and_si128 (v, low16);
+			__m128i b = _mm_srli_epi32 (v, 16);
+			__m128i p = _mm_or_si128 (
+					_mm_or_si128 (_mm_srli_epi32 (a, 4), _mm_slli_epi32 (_mm_srli_epi32 (b, 4), 8)),
+					_mm_or_si128 (_mm_slli_epi32 (_mm_and_si128 (a, fifteen), 16),
+							_mm_slli_epi32 (_mm_and_si128 (b, fifteen), 20)));
+
+			out.v = _mm_or_si128 (_mm_and_si128 (p, low32), _mm_srli_epi64 (_mm_andnot_si128 (low32, p), 8));
+			memcpy (dst, out.b, 6);
+			memcpy (dst + 6, out.b + 8, 6);
+		}
+	}
+#endif
+	for (; i + 2 <= n; i += 2, dst += 3) {
+		guint a = (src[i] >> shift) & 0xfff, b = (src[i + 1] >> shift) & 0xfff;
+
+		dst[0] = a >> 4;
+		dst[1] = b >> 4;
+		dst[2] = (a & 15) | (b & 15) << 4;
+	}
+}
+
+void
+gst_lumenera_proc_unpack10 (guint16 * dst, const guint8 * src, gsize n)
+{
+	gsize i;
+
+	for (i = 0; i + 4 <= n; i += 4, src += 5) {
+		dst[i] = src[0] << 2 | (src[4] & 3);
+		dst[i + 1] = src[1] << 2 | (src[4] >> 2 & 3);
+		dst[i + 2] = src[2] << 2 | (src[4] >> 4 & 3);
+		dst[i + 3] = src[3] << 2 | src[4] >> 6;
+	}
+}
+
+void
+gst_lumenera_proc_unpack12 (guint16 * dst, const guint8 * src, gsize n)
+{
+	gsize i;
+
+	for (i = 0; i + 2 <= n; i += 2, src += 3) {
+		dst[i] = src[0] << 4 | (src[2] & 15);
+		dst[i + 1] = src[1] << 4 | src[2] >> 4;
+	}
+}
+
+//
+// out = min (255, (((in - dark) << 8) * flat) >> 16 rounded from Q4), the subtraction saturates at 0
+//
+static void
+gst_lumenera_proc_dark_flat_row (guint8 * dst, const guint8 * src, const guint8 * dark, const guint16 * flat, gint n)
+{
+	gint i = 0;
+
+#ifdef __SSE2__
+	{
+		const __m128i zero = _mm_setzero_si128 ();
+		const __m128i round = _mm_set1_epi16 (8);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128 ((const __m128i *) (src + i));
+
+			if (dark)
+				v = _mm_subs_epu8 (v, _mm_loadu_si128 ((const __m128i *) (dark + i)));
+			if (flat) {
+				__m128i lo = _mm_slli_epi16 (_mm_unpacklo_epi8 (v, zero), 8);
+				__m128i hi = _mm_slli_epi16 (_mm_unpackhi_epi8 (v, zero), 8);
+
+				lo = _mm_mulhi_epu16 (lo, _mm_loadu_si128 ((const __m128i *) (flat + i)));
+				hi = _mm_mulhi_epu16 (hi, _mm_loadu_si128 ((const __m128i *) (flat + i + 8)));
+				lo = _mm_srli_epi16 (_mm_adds_epu16 (lo, round), 4);
+				hi = _mm_srli_epi16 (_mm_adds_epu16 (hi, round), 4);
+				v = _mm_packus_epi16 (lo, hi);
+			}
+			_mm_storeu_si128 ((__m128i *) (dst + i), v);
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		guint v = src[i];
+
+		if (dark)
+			v = v > dark[i] ? v - dark[i] : 0;
+		if (flat) {
+			v = ((v << 8) * flat[i]) >> 16;
+			v = MIN (v + 8, 65535) >> 4;
+			v = MIN (v, 255);
+		}
+		dst[i] = (guint8) v;
+	}
+}
+
+void
+gst_lumenera_proc_raw (guint8 * dst, const guint8 * src, gint width, gint height,
+		const guint8 * dark, const guint16 * flat, const GstLumeneraTapCorrection * tap, const guint8 * lut)
+{
+	gint half = width / 2;
+	gint y;
+
+	for (y = 0; y < height; y++) {
+		gsize row = (gsize) y * width;
+		const guint8 *in = src + row;
+		guint8 *out = dst + row;
+
+		if (dark || flat) {
+			gst_lumenera_proc_dark_flat_row (out, in, dark ? dark + row : NULL, flat ? flat + row : NULL, width);
+			in = out;  // the row is in cache, carry on in place
+		}
+		if (tap && !flat) {
+			if (out != in)
+				memcpy (out, in, half);
+			gst_lumenera_proc_tap_row (out + half, in + half, half, width - half, tap->gain[y & 1], tap->offset[y & 1]);
+			in = out;
+		}
+		if (lut)
+			gst_lumenera_proc_lut_apply (out, in, width, lut);
+		else if (out != in)
+			memcpy (out, in, width);
+	}
+}
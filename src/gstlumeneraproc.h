@@ -0,0 +1,188 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Processing kernels applied to raw (Bayer) frames before they are converted to RGB
+//
+
+#ifndef _GST_LUMENERA_PROC_H_
+#define _GST_LUMENERA_PROC_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// 8 bit lookup table
+gboolean gst_lumenera_proc_lut_parse (const gchar * str, guint8 * lut);
+void gst_lumenera_proc_lut_gamma (guint8 * lut, gdouble gamma);
+void gst_lumenera_proc_lut_apply (guint8 * dst, const guint8 * src, gsize n, const guint8 * lut);
+
+// Dual tap (2x1) correction, the right half of the sensor is matched to the left half.
+// Each of the four Bayer sites has its own gain and offset, indexed [row parity][column parity].
+typedef struct
+{
+  gint16 gain[2][2];    // Q12, 4096 is unity
+  gint16 offset[2][2];  // Q4
+} GstLumeneraTapCorrection;
+
+// Statistics of the columns either side of the tap seam, [side][row parity][column parity]
+typedef struct
+{
+  gdouble sum[2][2][2];
+  gdouble sum2[2][2][2];
+  guint64 n[2][2];
+} GstLumeneraTapStats;
+
+void gst_lumenera_proc_tap_accumulate (GstLumeneraTapStats * stats, const guint8 * raw, gint width, gint height);
+void gst_lumenera_proc_tap_solve (const GstLumeneraTapStats * stats, GstLumeneraTapCorrection * tap);
+
+// Calibration frames are files of a 16 byte header followed by one value per raw pixel.
+// The header is the magic "LUCF", then little endian guint16 version (1), guint16 kind,
+// guint32 width and guint32 height. Dark frames hold the guint8 dark level of each pixel,
+// flat fields the little endian guint16 Q12 gain (4096 is unity) to apply after the dark is subtracted.
+// Defect maps instead hold a guint32 count and then the count indices (y * width + x) of defective
+// pixels in increasing order, all little endian.
+#define GST_LUMENERA_CAL_MAGIC "LUCF"
+#define GST_LUMENERA_CAL_VERSION 1
+#define GST_LUMENERA_CAL_HEADER_SIZE 16
+
+typedef enum
+{
+  GST_LUMENERA_CAL_DARK = 0,
+  GST_LUMENERA_CAL_FLAT = 1,
+  GST_LUMENERA_CAL_DEFECTS = 2
+} GstLumeneraCalKind;
+
+typedef struct
+{
+  volatile gint refcount;
+  GstLumeneraCalKind kind;
+  gint width;
+  gint height;
+  GMappedFile *file;
+  const guint8 *dark;   // pixels of a dark frame, or NULL
+  const guint16 *flat;  // pixels of a flat field, or NULL
+  const guint32 *defects;  // sorted indices of a defect map, or NULL
+  guint n_defects;
+} GstLumeneraCalFrame;
+
+GstLumeneraCalFrame *gst_lumenera_cal_frame_load (const gchar * path, GstLumeneraCalKind kind, GError ** error);
+GstLumeneraCalFrame *gst_lumenera_cal_frame_ref (GstLumeneraCalFrame * cal);
+void gst_lumenera_cal_frame_unref (GstLumeneraCalFrame * cal);
+const gchar *gst_lumenera_cal_kind_name (GstLumeneraCalKind kind);
+gboolean gst_lumenera_cal_frame_write (const gchar * path, GstLumeneraCalKind kind, const guint32 * sum, guint frames,
+    const guint8 * dark, gint width, gint height, GError ** error);
+gboolean gst_lumenera_cal_defects_write (const gchar * path, const guint32 * sum, guint frames, guint threshold,
+    gint width, gint height, guint * n_defects, GError ** error);
+
+// Anonymous memory for raw frames captured at full rate, faulted in up front so capture never waits on
+// the kernel. With huge_pages it comes from the hugetlb pool when that has room, otherwise transparent
+// huge pages are asked for. Locking is best effort, locked is FALSE if mlock failed (RLIMIT_MEMLOCK).
+typedef struct
+{
+  guint8 *data;
+  gsize size;
+  gboolean huge_pages;  // from the hugetlb pool
+  gboolean locked;
+} GstLumeneraArena;
+
+GstLumeneraArena *gst_lumenera_arena_new (gsize size, gboolean huge_pages, gboolean lock, GError ** error);
+void gst_lumenera_arena_free (GstLumeneraArena * arena);
+
+// CPU affinity and scheduling of the calling thread. cpus is a list such as "2", "4-7" or "0,2-3", NULL or
+// empty to leave the affinity alone, priority a SCHED_FIFO priority, 0 to leave the policy alone. When
+// SCHED_FIFO is not permitted the thread is given the lowest nice value RLIMIT_NICE allows instead.
+// applied is what the thread ends up with, read back from the kernel. FALSE if anything asked for was refused.
+typedef struct
+{
+  gboolean set;         // a thread has been scheduled
+  gint policy;          // SCHED_FIFO, SCHED_OTHER, ...
+  gint priority;        // realtime priority, or the nice value when time-shared
+  gchar cpus[64];       // affinity, in the same form as cpus
+  gint node;            // NUMA node of the CPU the thread was on, -1 if unknown
+} GstLumeneraThreadSched;
+
+gboolean gst_lumenera_cpus_valid (const gchar * cpus);
+gboolean gst_lumenera_thread_schedule (const gchar * cpus, gint priority, GstLumeneraThreadSched * applied);
+const gchar *gst_lumenera_sched_policy_name (gint policy);
+
+// The calling thread's policy, priority, nice value and affinity, saved before it is first scheduled so a
+// thread that is handed on, such as a task pool thread, can be given them back by the same thread
+typedef struct
+{
+  gboolean saved;
+  gint policy;
+  gint priority;
+  gint nice;
+  guint64 affinity[16];  // cpu_set_t
+} GstLumeneraThreadSaved;
+
+void gst_lumenera_thread_save (GstLumeneraThreadSaved * saved);
+void gst_lumenera_thread_restore (GstLumeneraThreadSaved * saved);
+
+// NUMA node holding the page at p, -1 if unknown or not faulted in yet
+gint gst_lumenera_memory_node (gconstpointer p);
+
+// Temporal accumulation of raw frames
+void gst_lumenera_proc_accumulate (guint32 * sum, const guint8 * raw, gsize n);
+void gst_lumenera_proc_accumulate16 (guint16 * sum, const guint8 * raw, gsize n);
+void gst_lumenera_proc_accumulate_finish (guint8 * dst, guint32 * sum, gsize n, gfloat scale);
+void gst_lumenera_proc_accumulate_finish16 (guint8 * dst, guint16 * sum, gsize n, gfloat scale);
+void gst_lumenera_proc_running_average (guint8 * dst, gfloat * acc, const guint8 * raw, gsize n, gfloat weight);
+
+// Histogram of each Bayer site, hist[(y & 1) * 2 + (x & 1)], added to hist. Rows y0 (even) to y1 are
+// counted, taking every step'th 2x2 cell in each direction.
+void gst_lumenera_proc_histogram (guint32 (*hist)[256], const guint8 * raw, gint width, gint y0, gint y1, gint step);
+
+// Focus scores of the green channel in the region x, y, width, height of a raw Bayer frame, computed on the
+// half resolution image of the green pair in each 2x2 cell. green_first is TRUE when the cell's greens are at
+// (0,0) and (1,1) (GRBG, GBRG), FALSE for (1,0) and (0,1) (RGGB, BGGR). Returns -1 if the region is too small.
+gdouble gst_lumenera_proc_focus_laplacian (const guint8 * raw, gint stride, gint x, gint y, gint width, gint height,
+    gboolean green_first);
+gdouble gst_lumenera_proc_focus_tenengrad (const guint8 * raw, gint stride, gint x, gint y, gint width, gint height,
+    gboolean green_first);
+
+// Replace each listed pixel by the median of its same colour neighbours that are not listed, in place
+void gst_lumenera_proc_defects_correct (guint8 * raw, gint width, gint height, const guint32 * defects, guint n);
+
+// Packed raw, MIPI CSI-2 style: RAW10 holds the upper 8 bits of 4 pixels then a byte of their low 2 bits,
+// pixel 0 in bits 0-1. RAW12 holds the upper 8 bits of 2 pixels then a byte of their low 4 bits, pixel 0 in
+// bits 0-3. Pixels are taken from src >> shift, n must be a multiple of 4 (RAW10) or 2 (RAW12).
+// The unpackers write the pixels least significant bit aligned.
+void gst_lumenera_proc_pack10 (guint8 * dst, const guint16 * src, gsize n, guint shift);
+void gst_lumenera_proc_pack12 (guint8 * dst, const guint16 * src, gsize n, guint shift);
+void gst_lumenera_proc_unpack10 (guint16 * dst, const guint8 * src, gsize n);
+void gst_lumenera_proc_unpack12 (guint16 * dst, const guint8 * src, gsize n);
+
+// Binned RGB preview of a raw frame, each factor x factor block (factor even) of rows y0 (a multiple of factor)
+// to y1 becomes one pixel of dst, the mean of its red, green and blue sites. red and blue are the sites
+// (y & 1) * 2 + (x & 1) of those colours, the same site for a monochrome sensor, which gives grey.
+// 16 bit frames are most significant bit aligned and only their upper byte is used.
+void gst_lumenera_proc_preview (guint8 * dst, gint dst_stride, const guint8 * raw, gboolean raw16, gint width, gint y0, gint y1,
+    gint factor, gint red, gint blue);
+
+// Dark frame subtraction, flat field, tap correction and lookup table fused in one pass over the frame,
+// row by row, any of them may be NULL. Tap correction is skipped with a flat field, which already
+// includes the gain of each tap. dst may be src.
+void gst_lumenera_proc_raw (guint8 * dst, const guint8 * src, gint width, gint height,
+    const guint8 * dark, const guint16 * flat, const GstLumeneraTapCorrection * tap, const guint8 * lut);
+
+G_END_DECLS
+
+#endif
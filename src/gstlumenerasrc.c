@@ -38,6 +38,7 @@
 //#define OVERRIDE_FILL  !!! NOT IMPLEMENTED !!!
 #define OVERRIDE_CREATE
 
+#include <stdio.h> // for sscanf
 #include <unistd.h> // for usleep
 #include <string.h> // for memcpy
 
@@ -50,6 +51,9 @@
 #include <gst/video/video.h>
 
 #include "gstlumenerasrc.h"
+#include "gstlumenerametaprivate.h"
+#include "gstlumeneraproc.h"
+#include "gstlumenerabayerunpack.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_lumenera_src_debug);
 #define GST_CAT_DEFAULT gst_lumenera_src_debug
@@ -66,6 +70,25 @@ static gboolean gst_lumenera_src_start (GstBaseSrc * src);
 static gboolean gst_lumenera_src_stop (GstBaseSrc * src);
 static GstCaps *gst_lumenera_src_get_caps (GstBaseSrc * src, GstCaps * filter);
 static gboolean gst_lumenera_src_set_caps (GstBaseSrc * src, GstCaps * caps);
+static gboolean gst_lumenera_src_event (GstBaseSrc * src, GstEvent * event);
+static gboolean gst_lumenera_src_unlock (GstBaseSrc * src);
+static gboolean gst_lumenera_src_unlock_stop (GstBaseSrc * src);
+static GstStateChangeReturn gst_lumenera_src_change_state (GstElement * element, GstStateChange transition);
+static GstPad *gst_lumenera_src_request_new_pad (GstElement * element, GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_lumenera_src_release_pad (GstElement * element, GstPad * pad);
+static void gst_lumenera_src_free_capture (GstLumeneraSrc * src);
+static GstPadProbeReturn gst_lumenera_src_main_event_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static void gst_lumenera_src_publish_params (GstLumeneraSrc * src, guint property_id, gfloat value);
+static void gst_lumenera_src_set_lut (GstLumeneraSrc * src, const gchar * str);
+static void gst_lumenera_src_push_lut (GstLumeneraSrc * src);
+static void gst_lumenera_src_set_calibration (GstLumeneraSrc * src, GstLumeneraCalKind kind, const gchar * path);
+static gboolean gst_lumenera_src_capture_calibration (GstLumeneraSrc * src, const gchar * kind, guint frames, const gchar * path);
+static void gst_lumenera_src_free_statistics (GstLumeneraSrc * src);
+static void gst_lumenera_src_set_focus_roi (GstLumeneraSrc * src, const gchar * str);
+static void gst_lumenera_src_set_roi (GstLumeneraSrc * src, const gchar * str);
+static BYTE *gst_lumenera_src_process_raw (GstLumeneraSrc * src, BYTE * raw);
+static gboolean gst_lumenera_src_apply_params (GstLumeneraSrc * src, gboolean force);
+static gboolean gst_lumenera_src_trigger (GstLumeneraSrc * src);
 
 #ifdef OVERRIDE_CREATE
 	static GstFlowReturn gst_lumenera_src_create (GstPushSrc * src, GstBuffer ** buf);
@@ -76,6 +99,17 @@ static gboolean gst_lumenera_src_set_caps (GstBaseSrc * src, GstCaps * caps);
 
 //static GstCaps *gst_lumenera_src_create_caps (GstLumeneraSrc * src);
 static void gst_lumenera_src_reset (GstLumeneraSrc * src);
+static GstStructure *gst_lumenera_src_create_stats (GstLumeneraSrc * src);
+
+enum
+{
+	SIGNAL_TRIGGER,
+	SIGNAL_CAPTURE_CALIBRATION,
+	LAST_SIGNAL
+};
+
+static guint gst_lumenera_src_signals[LAST_SIGNAL] = { 0 };
+
 enum
 {
 	PROP_0,
@@ -89,7 +123,45 @@ enum
 	PROP_HORIZ_FLIP,
 	PROP_VERT_FLIP,
 	PROP_WHITEBALANCE,
-	PROP_MAXFRAMERATE
+	PROP_MAXFRAMERATE,
+	PROP_TRIGGERMODE,
+	PROP_TRIGGERPIN,
+	PROP_CAPTUREENGINE,
+	PROP_TIMEOUT,
+	PROP_REFRESHINTERVAL,
+	PROP_CONTROLLEAD,
+	PROP_LUT,
+	PROP_TAPCORRECTION,
+	PROP_TAPCALIBRATIONFRAMES,
+	PROP_DARKFRAME,
+	PROP_FLATFIELD,
+	PROP_ACCUMULATEFRAMES,
+	PROP_ACCUMULATEMODE,
+	PROP_FRAMESTATISTICS,
+	PROP_STATISTICSSUBSAMPLE,
+	PROP_STATISTICSTHREADS,
+	PROP_STATISTICSINTERVAL,
+	PROP_FOCUSMETRIC,
+	PROP_FOCUSROI,
+	PROP_FOCUSINTERVAL,
+	PROP_DEFECTMAP,
+	PROP_DEFECTTHRESHOLD,
+	PROP_BURSTFRAMES,
+	PROP_BURSTHUGEPAGES,
+	PROP_BURSTLOCKMEMORY,
+	PROP_PRETRIGGERSECONDS,
+	PROP_TAPCONFIGURATION,
+	PROP_BINNING,
+	PROP_ROI,
+	PROP_PROFILE,
+	PROP_FRAMEHUGEPAGES,
+	PROP_FRAMELOCKMEMORY,
+	PROP_CAPTURECPU,
+	PROP_WORKERCPUS,
+	PROP_REALTIMEPRIORITY,
+	PROP_DECIMATE,
+	PROP_OUTPUTFRAMERATE,
+	PROP_STATS
 };
 
 
@@ -106,6 +178,44 @@ enum
 #define DEFAULT_PROP_VERT_FLIP          0
 #define DEFAULT_PROP_WHITEBALANCE       GST_WB_DISABLED
 #define DEFAULT_PROP_MAXFRAMERATE       25
+#define DEFAULT_PROP_TRIGGERMODE        GST_TRIGGER_FREE_RUN
+#define DEFAULT_PROP_TRIGGERPIN         0
+#define DEFAULT_PROP_CAPTUREENGINE      GST_ENGINE_CALLBACK
+#define DEFAULT_PROP_TIMEOUT            5000
+#define DEFAULT_PROP_REFRESHINTERVAL    1000
+#define DEFAULT_PROP_CONTROLLEAD        1
+#define DEFAULT_PROP_TAPCORRECTION      GST_TAP_CORRECTION_NATIVE
+#define DEFAULT_PROP_TAPCALIBRATIONFRAMES 8
+#define DEFAULT_PROP_ACCUMULATEFRAMES   1
+#define DEFAULT_PROP_ACCUMULATEMODE     GST_ACCUMULATE_AVERAGE
+#define DEFAULT_PROP_FRAMESTATISTICS    FALSE
+#define DEFAULT_PROP_STATISTICSSUBSAMPLE 1
+#define DEFAULT_PROP_STATISTICSTHREADS  0
+#define DEFAULT_PROP_STATISTICSINTERVAL 1000
+#define DEFAULT_PROP_FOCUSMETRIC        GST_FOCUS_METRIC_NONE
+#define DEFAULT_PROP_FOCUSINTERVAL      100
+#define DEFAULT_PROP_DEFECTTHRESHOLD    32
+#define DEFAULT_PROP_BURSTFRAMES        0
+#define DEFAULT_PROP_BURSTHUGEPAGES     FALSE
+#define DEFAULT_PROP_BURSTLOCKMEMORY    FALSE
+#define DEFAULT_PROP_PRETRIGGERSECONDS  0
+#define DEFAULT_PROP_TAPCONFIGURATION   GST_TAP_CONFIGURATION_DUAL
+#define DEFAULT_PROP_BINNING            1
+#define DEFAULT_PROP_FRAMEHUGEPAGES     TRUE
+#define DEFAULT_PROP_FRAMELOCKMEMORY    TRUE
+#define DEFAULT_PROP_CAPTURECPU         -1
+#define DEFAULT_PROP_REALTIMEPRIORITY   0
+#define DEFAULT_PROP_DECIMATE           1
+
+#define LU_TAKE_VIDEO_SLICE_MS          100     // LucamTakeVideoEx waits in slices so unlock is never missed for long
+#define LU_OUTPUT_BUFFERS               4       // output buffers allocated by set_caps, more are added if downstream holds on to them
+#define LU_PREVIEW_BAND                 32      // rows converted and binned together, a multiple of the largest preview factor
+
+// Properties the application has set, which a profile leaves alone
+#define LU_SET_TAPCONFIGURATION         (1 << 0)
+#define LU_SET_CAPTUREENGINE            (1 << 1)
+#define LU_SET_BINNING                  (1 << 2)
+#define LU_SET_ROI                      (1 << 3)
 
 #define DEFAULT_LU_VIDEO_FORMAT GST_VIDEO_FORMAT_RGB
 // Put matching type text in the pad template below
@@ -116,9 +226,23 @@ static GstStaticPadTemplate gst_lumenera_src_template =
 				GST_PAD_SRC,
 				GST_PAD_ALWAYS,
 				GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE
-						("{ RGB }"))
+						("{ RGB }") "; "
+						"video/x-bayer, format = (string) { rggb, grbg, gbrg, bggr }, "
+						"width = " GST_VIDEO_SIZE_RANGE ", height = " GST_VIDEO_SIZE_RANGE ", "
+						"framerate = " GST_VIDEO_FPS_RANGE "; "
+						GST_LUMENERA_BAYER_PACKED_CAPS)
+		);
+
+// preview pads, binned RGB at a half, quarter or eighth of the sensor size, picked by downstream caps
+static GstStaticPadTemplate gst_lumenera_src_preview_template =
+		GST_STATIC_PAD_TEMPLATE ("preview_%u",
+				GST_PAD_SRC,
+				GST_PAD_REQUEST,
+				GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ RGB }"))
 		);
 
+static GQuark preview_quark;  // GstLumeneraPreview of a preview pad
+
 // error check, use in functions where 'src' is declared and initialised
 #define LUEXECANDCHECK(function)\
 {\
@@ -154,6 +278,131 @@ whitebalance_get_type (void)
   return whitebalance_type;
 }
 
+#define TYPE_TRIGGERMODE (triggermode_get_type ())
+static GType
+triggermode_get_type (void)
+{
+  static GType triggermode_type = 0;
+
+  if (!triggermode_type) {
+    static GEnumValue trigger_types[] = {
+	  { GST_TRIGGER_FREE_RUN, "Free running video stream.", "free-run" },
+	  { GST_TRIGGER_HARDWARE, "One frame per hardware trigger on the trigger pin.", "hardware" },
+	  { GST_TRIGGER_SOFTWARE, "One frame per software trigger (trigger action signal or lumenera-trigger event).", "software" },
+      { 0, NULL, NULL },
+    };
+
+    triggermode_type =
+	g_enum_register_static ("TriggerModeType", trigger_types);
+  }
+
+  return triggermode_type;
+}
+
+#define TYPE_CAPTUREENGINE (captureengine_get_type ())
+static GType
+captureengine_get_type (void)
+{
+  static GType captureengine_type = 0;
+
+  if (!captureengine_type) {
+    static GEnumValue engine_types[] = {
+	  { GST_ENGINE_CALLBACK, "SDK streaming callback converts frames, handed over to the streaming thread.", "callback" },
+	  { GST_ENGINE_PULL, "Streaming thread pulls raw frames with LucamTakeVideoEx and converts them itself.", "pull" },
+      { 0, NULL, NULL },
+    };
+
+    captureengine_type =
+	g_enum_register_static ("CaptureEngineType", engine_types);
+  }
+
+  return captureengine_type;
+}
+
+#define TYPE_TAPCONFIGURATION (tapconfiguration_get_type ())
+static GType
+tapconfiguration_get_type (void)
+{
+  static GType tapconfiguration_type = 0;
+
+  if (!tapconfiguration_type) {
+    static GEnumValue tap_types[] = {
+	  { GST_TAP_CONFIGURATION_SINGLE, "Sensor read out through one tap.", "single" },
+	  { GST_TAP_CONFIGURATION_DUAL, "Sensor read out through two taps, left and right halves.", "dual" },
+	  { GST_TAP_CONFIGURATION_QUAD, "Sensor read out through four taps, one per quadrant.", "quad" },
+      { 0, NULL, NULL },
+    };
+
+    tapconfiguration_type =
+	g_enum_register_static ("TapConfigurationType", tap_types);
+  }
+
+  return tapconfiguration_type;
+}
+
+#define TYPE_TAPCORRECTION (tapcorrection_get_type ())
+static GType
+tapcorrection_get_type (void)
+{
+  static GType tapcorrection_type = 0;
+
+  if (!tapcorrection_type) {
+    static GEnumValue tap_types[] = {
+	  { GST_TAP_CORRECTION_OFF, "No dual tap correction.", "off" },
+	  { GST_TAP_CORRECTION_SDK, "LucamPerformDualTapCorrection on every raw frame.", "sdk" },
+	  { GST_TAP_CORRECTION_NATIVE, "In-plugin gain and offset correction, calibrated from the first frames.", "native" },
+      { 0, NULL, NULL },
+    };
+
+    tapcorrection_type =
+	g_enum_register_static ("TapCorrectionType", tap_types);
+  }
+
+  return tapcorrection_type;
+}
+
+#define TYPE_ACCUMULATEMODE (accumulatemode_get_type ())
+static GType
+accumulatemode_get_type (void)
+{
+  static GType accumulatemode_type = 0;
+
+  if (!accumulatemode_type) {
+    static GEnumValue accumulate_types[] = {
+	  { GST_ACCUMULATE_AVERAGE, "Average of each block of frames, one frame out per block.", "average" },
+	  { GST_ACCUMULATE_RUNNING_AVERAGE, "Exponential running average, every frame out.", "running-average" },
+	  { GST_ACCUMULATE_SUM, "Sum of each block of frames saturated to 8 bits, one frame out per block.", "sum" },
+      { 0, NULL, NULL },
+    };
+
+    accumulatemode_type =
+	g_enum_register_static ("AccumulateModeType", accumulate_types);
+  }
+
+  return accumulatemode_type;
+}
+
+#define TYPE_FOCUSMETRIC (focusmetric_get_type ())
+static GType
+focusmetric_get_type (void)
+{
+  static GType focusmetric_type = 0;
+
+  if (!focusmetric_type) {
+    static GEnumValue focus_types[] = {
+	  { GST_FOCUS_METRIC_NONE, "No focus score.", "none" },
+	  { GST_FOCUS_METRIC_LAPLACIAN, "Variance of the Laplacian.", "laplacian" },
+	  { GST_FOCUS_METRIC_TENENGRAD, "Mean squared Sobel gradient (Tenengrad).", "tenengrad" },
+      { 0, NULL, NULL },
+    };
+
+    focusmetric_type =
+	g_enum_register_static ("FocusMetricType", focus_types);
+  }
+
+  return focusmetric_type;
+}
+
 static void
 gst_lumenera_set_camera_exposure (GstLumeneraSrc * src, gboolean send)
 {  // How should the pipeline be told/respond to a change in frame rate - seems to be ok with a push source
@@ -206,6 +455,10 @@ gst_lumenera_set_camera_whitebalance (GstLumeneraSrc * src)
 		LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN2, &gain_green2, &flags);
 		LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_BLUE, &(src->bgain), &flags);
 		GST_DEBUG_OBJECT(src, "White balance set: R %f G1 %f G2 %f B %f", src->rgain, src->ggain, gain_green2, src->bgain);
+		// Keep the parameter block in step so the next frame boundary does not undo the balance
+		gst_lumenera_src_publish_params(src, PROP_RGAIN, src->rgain);
+		gst_lumenera_src_publish_params(src, PROP_GGAIN, src->ggain);
+		gst_lumenera_src_publish_params(src, PROP_BGAIN, src->bgain);
 		break;
 	case GST_WB_DISABLED:
 	default:
@@ -238,6 +491,13 @@ gst_lumenera_src_class_init (GstLumeneraSrcClass * klass)
 
 	gst_element_class_add_pad_template (gstelement_class,
 			gst_static_pad_template_get (&gst_lumenera_src_template));
+	gst_element_class_add_pad_template (gstelement_class,
+			gst_static_pad_template_get (&gst_lumenera_src_preview_template));
+	preview_quark = g_quark_from_static_string ("lumenera-preview");
+
+	gstelement_class->change_state = GST_DEBUG_FUNCPTR (gst_lumenera_src_change_state);
+	gstelement_class->request_new_pad = GST_DEBUG_FUNCPTR (gst_lumenera_src_request_new_pad);
+	gstelement_class->release_pad = GST_DEBUG_FUNCPTR (gst_lumenera_src_release_pad);
 
 	gst_element_class_set_static_metadata (gstelement_class,
 			"lumenera Video Source", "Source/Video",
@@ -247,6 +507,12 @@ gst_lumenera_src_class_init (GstLumeneraSrcClass * klass)
 	gstbasesrc_class->stop = GST_DEBUG_FUNCPTR (gst_lumenera_src_stop);
 	gstbasesrc_class->get_caps = GST_DEBUG_FUNCPTR (gst_lumenera_src_get_caps);
 	gstbasesrc_class->set_caps = GST_DEBUG_FUNCPTR (gst_lumenera_src_set_caps);
+	gstbasesrc_class->event = GST_DEBUG_FUNCPTR (gst_lumenera_src_event);
+	gstbasesrc_class->unlock = GST_DEBUG_FUNCPTR (gst_lumenera_src_unlock);
+	gstbasesrc_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_lumenera_src_unlock_stop);
+
+	klass->trigger = GST_DEBUG_FUNCPTR (gst_lumenera_src_trigger);
+	klass->capture_calibration = GST_DEBUG_FUNCPTR (gst_lumenera_src_capture_calibration);
 
 #ifdef OVERRIDE_CREATE
 	gstpushsrc_class->create = GST_DEBUG_FUNCPTR (gst_lumenera_src_create);
@@ -265,11 +531,11 @@ gst_lumenera_src_class_init (GstLumeneraSrcClass * klass)
 	// Exposure property
 	g_object_class_install_property (gobject_class, PROP_EXPOSURE,
 	  g_param_spec_double("exposure", "Exposure", "Camera sensor exposure time (ms).", 0.01, 2000, DEFAULT_PROP_EXPOSURE,
-          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE | GST_PARAM_MUTABLE_PLAYING)));
 	// Gain property
 	g_object_class_install_property (gobject_class, PROP_GAIN,
 	  g_param_spec_int("gain", "Gain", "Camera sensor master gain.", 0, 100, DEFAULT_PROP_GAIN,
-          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE | GST_PARAM_MUTABLE_PLAYING)));
 	// Black Level property
 //	g_object_class_install_property (gobject_class, PROP_BLACKLEVEL,
 //	  g_param_spec_int("blacklevel", "Black Level", "Camera sensor black level offset.", 0, 255, DEFAULT_PROP_BLACKLEVEL,
@@ -277,15 +543,15 @@ gst_lumenera_src_class_init (GstLumeneraSrcClass * klass)
 	// R gain property
 	g_object_class_install_property (gobject_class, PROP_RGAIN,
 			g_param_spec_float("rgain", "Red Gain", "Camera sensor red channel gain.", 1.0, 3.984375, DEFAULT_PROP_RGAIN,
-          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE | GST_PARAM_MUTABLE_PLAYING)));
 	// G gain property
 	g_object_class_install_property (gobject_class, PROP_GGAIN,
 			g_param_spec_float("ggain", "Green Gain", "Camera sensor green channel gain.", 1.0, 3.984375, DEFAULT_PROP_GGAIN,
-          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE | GST_PARAM_MUTABLE_PLAYING)));
 	// B gain property
 	g_object_class_install_property (gobject_class, PROP_BGAIN,
 			g_param_spec_float("bgain", "Blue Gain", "Camera sensor blue channel gain.", 1.0, 3.984375, DEFAULT_PROP_BGAIN,
-          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE | GST_PARAM_MUTABLE_PLAYING)));
 	// vflip property
 	g_object_class_install_property (gobject_class, PROP_VERT_FLIP,
 	  g_param_spec_int("vflip", "Vertical flip", "Image up-down flip.", 0, 1, DEFAULT_PROP_HORIZ_FLIP,
@@ -303,6 +569,217 @@ gst_lumenera_src_class_init (GstLumeneraSrcClass * klass)
 	  g_param_spec_double("maxframerate", "Maximum Frame Rate", "Camera sensor maximum allowed frame rate (fps)."
 			  "The frame rate will be determined from the exposure time, up to this maximum value when short exposures are used", 10, 200, DEFAULT_PROP_MAXFRAMERATE,
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Trigger mode property
+	g_object_class_install_property (gobject_class, PROP_TRIGGERMODE,
+	  g_param_spec_enum("trigger-mode", "Trigger Mode", "Free running stream, or one frame per hardware or software trigger.", TYPE_TRIGGERMODE, DEFAULT_PROP_TRIGGERMODE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Trigger pin property
+	g_object_class_install_property (gobject_class, PROP_TRIGGERPIN,
+	  g_param_spec_int("trigger-pin", "Trigger Pin", "Camera input pin used for the hardware trigger (LUCAM_PROP_TRIGGER_PIN).", 0, 3, DEFAULT_PROP_TRIGGERPIN,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Capture engine property
+	g_object_class_install_property (gobject_class, PROP_CAPTUREENGINE,
+	  g_param_spec_enum("capture-engine", "Capture Engine", "How free running frames are delivered: SDK streaming callback or pulled on the streaming thread.", TYPE_CAPTUREENGINE, DEFAULT_PROP_CAPTUREENGINE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Timeout property
+	g_object_class_install_property (gobject_class, PROP_TIMEOUT,
+	  g_param_spec_uint("timeout", "Frame Timeout", "Time to wait for a frame before counting a timeout and posting a warning (ms). "
+			  "In hardware trigger mode this is how long each wait for a trigger lasts.", 1, G_MAXINT, DEFAULT_PROP_TIMEOUT,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Refresh interval property
+	g_object_class_install_property (gobject_class, PROP_REFRESHINTERVAL,
+	  g_param_spec_uint("property-refresh-interval", "Property Refresh Interval", "Interval between background reads of exposure and gains from the camera, "
+			  "reading these properties returns the last values read (ms). 0 reads them only after they are set.", 0, G_MAXINT, DEFAULT_PROP_REFRESHINTERVAL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Control lead property
+	g_object_class_install_property (gobject_class, PROP_CONTROLLEAD,
+	  g_param_spec_uint("control-lead-frames", "Control Lead Frames", "Controlled properties are synced this many frames ahead of the next frame, "
+			  "so a change reaches the camera in time to take effect on the frame with that running time.", 0, 16, DEFAULT_PROP_CONTROLLEAD,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// LUT property
+	g_object_class_install_property (gobject_class, PROP_LUT,
+	  g_param_spec_string("lut", "Lookup Table", "8 bit lookup table applied to the raw frame: a gamma value (output = 255*(input/255)^(1/gamma)) "
+			  "or 256 comma separated entries 0-255. Loaded into the camera where supported. Empty for none.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Tap correction property
+	g_object_class_install_property (gobject_class, PROP_TAPCORRECTION,
+	  g_param_spec_enum("tap-correction", "Tap Correction", "Removes the seam between the two halves of a dual tap sensor, only applied when tap-configuration is dual.",
+			  TYPE_TAPCORRECTION, DEFAULT_PROP_TAPCORRECTION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Tap calibration frames property
+	g_object_class_install_property (gobject_class, PROP_TAPCALIBRATIONFRAMES,
+	  g_param_spec_uint("tap-calibration-frames", "Tap Calibration Frames", "Number of frames used to calibrate native tap correction, "
+			  "setting it starts a new calibration.", 1, 1000, DEFAULT_PROP_TAPCALIBRATIONFRAMES,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Dark frame property
+	g_object_class_install_property (gobject_class, PROP_DARKFRAME,
+	  g_param_spec_string("dark-frame", "Dark Frame", "Calibration file subtracted from every raw frame, see the capture-calibration signal. Empty for none.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Flat field property
+	g_object_class_install_property (gobject_class, PROP_FLATFIELD,
+	  g_param_spec_string("flat-field", "Flat Field", "Calibration file of per pixel gains applied to every raw frame after the dark frame, "
+			  "see the capture-calibration signal. Replaces native tap correction. Empty for none.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Accumulate frames property
+	g_object_class_install_property (gobject_class, PROP_ACCUMULATEFRAMES,
+	  g_param_spec_uint("accumulate-frames", "Accumulate Frames", "Number of raw frames combined into each output frame, "
+			  "see accumulate-mode. 1 for none.", 1, 1024, DEFAULT_PROP_ACCUMULATEFRAMES,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Accumulate mode property
+	g_object_class_install_property (gobject_class, PROP_ACCUMULATEMODE,
+	  g_param_spec_enum("accumulate-mode", "Accumulate Mode", "How accumulate-frames raw frames are combined.",
+			  TYPE_ACCUMULATEMODE, DEFAULT_PROP_ACCUMULATEMODE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Frame statistics property
+	g_object_class_install_property (gobject_class, PROP_FRAMESTATISTICS,
+	  g_param_spec_boolean("frame-statistics", "Frame Statistics", "Histogram, mean and saturated pixel count of each colour "
+			  "from the raw frame, attached to every buffer as GstLumeneraStatsMeta and posted as a lumenera-frame-statistics message, "
+			  "see statistics-interval.",
+			  DEFAULT_PROP_FRAMESTATISTICS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Statistics subsample property
+	g_object_class_install_property (gobject_class, PROP_STATISTICSSUBSAMPLE,
+	  g_param_spec_uint("statistics-subsample", "Statistics Subsample", "Count every nth 2x2 Bayer cell in each direction for the frame statistics.",
+			  1, 64, DEFAULT_PROP_STATISTICSSUBSAMPLE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Statistics threads property
+	g_object_class_install_property (gobject_class, PROP_STATISTICSTHREADS,
+	  g_param_spec_uint("statistics-threads", "Statistics Threads", "Threads sharing the frame statistics, 0 for one per processor.",
+			  0, 64, DEFAULT_PROP_STATISTICSTHREADS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Statistics interval property
+	g_object_class_install_property (gobject_class, PROP_STATISTICSINTERVAL,
+	  g_param_spec_uint("statistics-interval", "Statistics Interval", "Least time between lumenera-frame-statistics messages (ms), "
+			  "the meta is still attached to every buffer. 0 posts one for every frame.", 0, G_MAXINT, DEFAULT_PROP_STATISTICSINTERVAL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Focus metric property
+	g_object_class_install_property (gobject_class, PROP_FOCUSMETRIC,
+	  g_param_spec_enum("focus-metric", "Focus Metric", "Focus score of the green channel in focus-roi of every raw frame, "
+			  "in the frame meta and posted as a lumenera-focus message, see focus-interval.",
+			  TYPE_FOCUSMETRIC, DEFAULT_PROP_FOCUSMETRIC,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Focus ROI property
+	g_object_class_install_property (gobject_class, PROP_FOCUSROI,
+	  g_param_spec_string("focus-roi", "Focus ROI", "Region of the raw frame for the focus score as \"x,y,width,height\". Empty for the whole frame.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Focus interval property
+	g_object_class_install_property (gobject_class, PROP_FOCUSINTERVAL,
+	  g_param_spec_uint("focus-interval", "Focus Interval", "Least time between lumenera-focus messages (ms), "
+			  "the score is still in the meta of every buffer. 0 posts one for every frame.", 0, G_MAXINT, DEFAULT_PROP_FOCUSINTERVAL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Defect map property
+	g_object_class_install_property (gobject_class, PROP_DEFECTMAP,
+	  g_param_spec_string("defect-map", "Defect Map", "Calibration file listing defective pixels, each replaced by the median of its "
+			  "same colour neighbours before demosaic, see the capture-calibration signal. Empty for none.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Defect threshold property
+	g_object_class_install_property (gobject_class, PROP_DEFECTTHRESHOLD,
+	  g_param_spec_uint("defect-threshold", "Defect Threshold", "Levels above the median of its same colour neighbours "
+			  "at which a pixel of a captured dark frame is listed as defective.", 1, 255, DEFAULT_PROP_DEFECTTHRESHOLD,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Burst frames property
+	g_object_class_install_property (gobject_class, PROP_BURSTFRAMES,
+	  g_param_spec_uint("burst-frames", "Burst Frames", "Free running only: capture this many raw frames into memory allocated "
+			  "at start, at the camera's full rate with no conversion, then convert and push them at downstream's pace followed by EOS. "
+			  "The rates are posted as lumenera-burst-captured and lumenera-burst-pushed messages. 0 for normal streaming.",
+			  0, G_MAXINT, DEFAULT_PROP_BURSTFRAMES,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Burst huge pages property
+	g_object_class_install_property (gobject_class, PROP_BURSTHUGEPAGES,
+	  g_param_spec_boolean("burst-huge-pages", "Burst Huge Pages", "Back the burst or pre-trigger memory with huge pages, from the hugetlb pool "
+			  "if it has room, otherwise transparent huge pages.", DEFAULT_PROP_BURSTHUGEPAGES,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Burst lock memory property
+	g_object_class_install_property (gobject_class, PROP_BURSTLOCKMEMORY,
+	  g_param_spec_boolean("burst-lock-memory", "Burst Lock Memory", "Lock the burst or pre-trigger memory so it is never paged out, "
+			  "subject to RLIMIT_MEMLOCK.", DEFAULT_PROP_BURSTLOCKMEMORY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Pre-trigger seconds property
+	g_object_class_install_property (gobject_class, PROP_PRETRIGGERSECONDS,
+	  g_param_spec_double("pretrigger-seconds", "Pre-trigger Seconds", "Free running only: keep the last this many seconds of raw frames "
+			  "in memory, sized for maxframerate, and push nothing until the trigger action signal or a lumenera-trigger event. "
+			  "Then the kept frames are pushed in order, stamped with the time they were captured, followed by live frames. 0 for normal streaming.",
+			  0, 3600, DEFAULT_PROP_PRETRIGGERSECONDS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Tap configuration property
+	g_object_class_install_property (gobject_class, PROP_TAPCONFIGURATION,
+	  g_param_spec_enum("tap-configuration", "Tap Configuration", "Sensor readout taps (LUCAM_PROP_TAP_CONFIGURATION), more taps read out faster.",
+			  TYPE_TAPCONFIGURATION, DEFAULT_PROP_TAPCONFIGURATION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Binning property
+	g_object_class_install_property (gobject_class, PROP_BINNING,
+	  g_param_spec_uint("binning", "Binning", "Sensor binning in each direction, 1 for none. The output is roi divided by this.",
+			  1, 8, DEFAULT_PROP_BINNING,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// ROI property
+	g_object_class_install_property (gobject_class, PROP_ROI,
+	  g_param_spec_string("roi", "ROI", "Region of the sensor read out, as \"x,y,width,height\" in sensor pixels, rounded down to "
+			  "what the camera and binning allow. Empty for the whole sensor.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Profile property
+	g_object_class_install_property (gobject_class, PROP_PROFILE,
+	  g_param_spec_string("profile", "Profile", "Profile written by lumenera-probe for this camera and host. On start its recommended "
+			  "tap-configuration, binning, roi and capture-engine are used for those of these properties the application has not set, "
+			  "and its format is offered first.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Frame huge pages property
+	g_object_class_install_property (gobject_class, PROP_FRAMEHUGEPAGES,
+	  g_param_spec_boolean("frame-huge-pages", "Frame Huge Pages", "Back the working frames and output buffers with huge pages, "
+			  "from the hugetlb pool if it has room, otherwise transparent huge pages.", DEFAULT_PROP_FRAMEHUGEPAGES,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Frame lock memory property
+	g_object_class_install_property (gobject_class, PROP_FRAMELOCKMEMORY,
+	  g_param_spec_boolean("frame-lock-memory", "Frame Lock Memory", "Lock the working frames and output buffers so they are never "
+			  "paged out, where RLIMIT_MEMLOCK allows.", DEFAULT_PROP_FRAMELOCKMEMORY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Capture CPU property
+	g_object_class_install_property (gobject_class, PROP_CAPTURECPU,
+	  g_param_spec_int("capture-cpu", "Capture CPU", "CPU to pin the threads that take and convert frames to, the SDK callback thread "
+			  "and the streaming thread. Frame memory is faulted in from there, so it is local to that CPU's NUMA node. -1 for any CPU.",
+			  -1, 1023, DEFAULT_PROP_CAPTURECPU,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Worker CPUs property
+	g_object_class_install_property (gobject_class, PROP_WORKERCPUS,
+	  g_param_spec_string("worker-cpus", "Worker CPUs", "CPUs for the frame statistics worker threads, as a list such as \"2-3\" or \"4,6\". "
+			  "Empty for any CPU.", NULL,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Realtime priority property
+	g_object_class_install_property (gobject_class, PROP_REALTIMEPRIORITY,
+	  g_param_spec_int("realtime-priority", "Realtime Priority", "SCHED_FIFO priority of the capture and worker threads, 0 to leave them "
+			  "time-shared. Needs CAP_SYS_NICE or RLIMIT_RTPRIO, otherwise the threads are given the lowest nice value allowed. "
+			  "What was applied is in stats.", 0, 99, DEFAULT_PROP_REALTIMEPRIORITY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY)));
+	// Decimate property
+	g_object_class_install_property (gobject_class, PROP_DECIMATE,
+	  g_param_spec_uint("decimate", "Decimate", "Free running only: push one camera frame in this many, the others are dropped "
+			  "as they arrive, before any processing or conversion. Not applied to burst or pre-trigger capture.",
+			  1, 1000, DEFAULT_PROP_DECIMATE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Output framerate property
+	g_object_class_install_property (gobject_class, PROP_OUTPUTFRAMERATE,
+	  gst_param_spec_fraction("output-framerate", "Output Frame Rate", "Free running only: push camera frames at about this rate, "
+			  "dropping the others as decimate does, spread evenly when it does not divide the camera's rate. 0/1 to use decimate.",
+			  0, 1, G_MAXINT, 1, 0, 1,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_PLAYING)));
+	// Stats property
+	g_object_class_install_property (gobject_class, PROP_STATS,
+	  g_param_spec_boxed("stats", "Statistics", "Capture statistics, including trigger-to-buffer latency (ns).", GST_TYPE_STRUCTURE,
+          (GParamFlags) (G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+	// Action signal to fire a software trigger, or release the pre-trigger frames when free running,
+	// returns FALSE if a trigger is already pending or the frames were already released
+	gst_lumenera_src_signals[SIGNAL_TRIGGER] =
+		g_signal_new ("trigger", G_TYPE_FROM_CLASS (klass),
+				G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+				G_STRUCT_OFFSET (GstLumeneraSrcClass, trigger),
+				NULL, NULL, NULL, G_TYPE_BOOLEAN, 0);
+	// capture-calibration ("dark", "flat" or "defects", frames, path): average frames raw frames into a calibration file,
+	// returns FALSE if no capture could be started, the result is posted as a lumenera-calibration-captured message
+	gst_lumenera_src_signals[SIGNAL_CAPTURE_CALIBRATION] =
+		g_signal_new ("capture-calibration", G_TYPE_FROM_CLASS (klass),
+				G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+				G_STRUCT_OFFSET (GstLumeneraSrcClass, capture_calibration),
+				NULL, NULL, NULL, G_TYPE_BOOLEAN, 3, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING);
 }
 
 static void
@@ -314,6 +791,9 @@ gst_lumenera_src_init (GstLumeneraSrc * src)
 	/* override default of BYTES to operate in time mode */
 	gst_base_src_set_format (GST_BASE_SRC (src), GST_FORMAT_TIME);
 
+	// The preview pads end with the main stream
+	gst_pad_add_probe (GST_BASE_SRC_PAD (src), GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, gst_lumenera_src_main_event_probe, src, NULL);
+
 	// Initialise properties
 	src->exposure = DEFAULT_PROP_EXPOSURE;
 	gst_lumenera_set_camera_exposure(src, LU_UPDATE_LOCAL);
@@ -326,6 +806,118 @@ gst_lumenera_src_init (GstLumeneraSrc * src)
 	src->hflip = DEFAULT_PROP_HORIZ_FLIP;
 	src->whitebalance = DEFAULT_PROP_WHITEBALANCE;
 	src->maxframerate = DEFAULT_PROP_MAXFRAMERATE;
+	src->triggermode = DEFAULT_PROP_TRIGGERMODE;
+	src->triggerpin = DEFAULT_PROP_TRIGGERPIN;
+	src->captureengine = DEFAULT_PROP_CAPTUREENGINE;
+	src->timeout = DEFAULT_PROP_TIMEOUT;
+	src->refresh_interval = DEFAULT_PROP_REFRESHINTERVAL;
+	src->control_lead = DEFAULT_PROP_CONTROLLEAD;
+
+	g_mutex_init (&src->frame_lock);
+	g_cond_init (&src->frame_cond);
+
+	g_mutex_init (&src->params_lock);
+	src->params[0].exposure = src->exposure;
+	src->params[0].gain = src->gain;
+	src->params[0].rgain = src->rgain;
+	src->params[0].ggain = src->ggain;
+	src->params[0].bgain = src->bgain;
+	src->params[0].generation = src->params_generation = src->params_applied = 1;
+	src->params_current = &src->params[0];
+	src->params_tag_pending = FALSE;
+
+	g_mutex_init (&src->poll_lock);
+	g_cond_init (&src->poll_cond);
+	src->poll_thread = NULL;
+	src->shadow_valid = FALSE;
+	src->params_sent_valid = FALSE;
+
+	src->lut_string = NULL;
+	src->lut_current = NULL;
+	src->lut_in_camera = FALSE;
+
+	src->tapcorrection = DEFAULT_PROP_TAPCORRECTION;
+	src->tap_frames = DEFAULT_PROP_TAPCALIBRATIONFRAMES;
+	src->tap_recalibrate = TRUE;
+	src->tap_calibrated = FALSE;
+
+	g_mutex_init (&src->cal_lock);
+	src->dark_path = NULL;
+	src->flat_path = NULL;
+	src->dark = NULL;
+	src->flat = NULL;
+	src->defects_path = NULL;
+	src->defects = NULL;
+	src->defect_threshold = DEFAULT_PROP_DEFECTTHRESHOLD;
+	src->cal_capture_path = NULL;
+	src->cal_capture_sum = NULL;
+
+	src->accumulate_frames = DEFAULT_PROP_ACCUMULATEFRAMES;
+	src->accumulate_mode = DEFAULT_PROP_ACCUMULATEMODE;
+	src->acc_reset = TRUE;
+	src->acc = NULL;
+	src->acc_size = 0;
+	src->acc_frames_out = 1;
+	src->acc_span = 1;
+
+	src->frame_statistics = DEFAULT_PROP_FRAMESTATISTICS;
+	src->statistics_subsample = DEFAULT_PROP_STATISTICSSUBSAMPLE;
+	src->statistics_threads = DEFAULT_PROP_STATISTICSTHREADS;
+	src->statistics_interval = DEFAULT_PROP_STATISTICSINTERVAL;
+	src->stats_posted = 0;
+	src->color_format = LUCAM_CF_BAYER_RGGB;
+	src->stats_pool = NULL;
+	src->stats_jobs = NULL;
+	src->stats_n_jobs = 0;
+	g_mutex_init (&src->stats_lock);
+	g_cond_init (&src->stats_cond);
+	src->stats_valid = FALSE;
+
+	src->focus_metric = DEFAULT_PROP_FOCUSMETRIC;
+	src->focus_roi_string = NULL;
+	src->focus_x = src->focus_y = src->focus_width = src->focus_height = 0;
+	src->focus_interval = DEFAULT_PROP_FOCUSINTERVAL;
+	src->focus_posted = 0;
+	src->focus_valid = FALSE;
+
+	src->burst_frames = DEFAULT_PROP_BURSTFRAMES;
+	src->burst_huge_pages = DEFAULT_PROP_BURSTHUGEPAGES;
+	src->burst_lock_memory = DEFAULT_PROP_BURSTLOCKMEMORY;
+	src->arena = NULL;
+	src->slots = NULL;
+	src->burst_capture_fps = 0;
+	src->burst_push_fps = 0;
+
+	src->pretrigger_seconds = DEFAULT_PROP_PRETRIGGERSECONDS;
+	src->tap_configuration = DEFAULT_PROP_TAPCONFIGURATION;
+	src->binning = DEFAULT_PROP_BINNING;
+	src->roi_string = NULL;
+	src->roi_width = 0;
+	src->roi_height = 0;
+	src->profile = NULL;
+	src->preferred_format = NULL;
+	src->props_set = 0;
+	src->frame_huge_pages = DEFAULT_PROP_FRAMEHUGEPAGES;
+	src->frame_lock_memory = DEFAULT_PROP_FRAMELOCKMEMORY;
+	src->work_arena = NULL;
+	src->allocator = NULL;
+	src->pool = NULL;
+	src->capture_cpu = DEFAULT_PROP_CAPTURECPU;
+	src->decimate = DEFAULT_PROP_DECIMATE;
+	src->previews = NULL;
+	src->preview_next = 0;
+	src->preview_factors = 0;
+	src->preview_ready = 0;
+	memset (src->preview_image, 0, sizeof (src->preview_image));
+	src->output_framerate_n = 0;
+	src->output_framerate_d = 1;
+	src->dec_span = 0;
+	src->worker_cpus = NULL;
+	src->realtime_priority = DEFAULT_PROP_REALTIMEPRIORITY;
+	src->frame_memory_node = -1;
+	src->ring_frames = 0;
+	src->ring_count = 0;
+	src->ring_overruns = 0;
 
 	gst_lumenera_src_reset (src);
 }
@@ -335,10 +927,88 @@ gst_lumenera_src_reset (GstLumeneraSrc * src)
 {
 	src->hCam=0;
 	src->rgbImageOwnerIsProducer = FALSE;
+	src->rgbImageFresh = FALSE;
+	src->flushing = FALSE;
+	src->playing = FALSE;
+	src->n_discarded = 0;
+	src->n_decimated = 0;
 	src->cameraPresent = FALSE;
 	src->n_frames=0;
 	src->total_timeouts = 0;
 	src->last_frame_time = 0;
+	src->fastFramesEnabled = FALSE;
+	src->trigger_pending = FALSE;
+	src->trigger_time = 0;
+	src->n_triggers = 0;
+	src->n_triggers_ignored = 0;
+	src->n_triggered_frames = 0;
+	src->trigger_latency_last = 0;
+	src->trigger_latency_min = GST_CLOCK_TIME_NONE;
+	src->trigger_latency_max = 0;
+	src->trigger_latency_total = 0;
+}
+
+//
+// <role>-policy, -priority, -cpus and -node of a thread as it was scheduled, policy "none" until it has run
+//
+static void
+gst_lumenera_src_stats_add_sched (GstStructure * s, const gchar * role, const GstLumeneraThreadSched * sched)
+{
+	gchar *policy = g_strdup_printf ("%s-policy", role);
+	gchar *priority = g_strdup_printf ("%s-priority", role);
+	gchar *cpus = g_strdup_printf ("%s-cpus", role);
+	gchar *node = g_strdup_printf ("%s-node", role);
+
+	gst_structure_set (s,
+			policy, G_TYPE_STRING, sched->set ? gst_lumenera_sched_policy_name (sched->policy) : "none",
+			priority, G_TYPE_INT, sched->priority,
+			cpus, G_TYPE_STRING, sched->cpus,
+			node, G_TYPE_INT, sched->set ? sched->node : -1,
+			NULL);
+
+	g_free (policy);
+	g_free (priority);
+	g_free (cpus);
+	g_free (node);
+}
+
+static GstStructure *
+gst_lumenera_src_create_stats (GstLumeneraSrc * src)
+{
+	GstStructure *s;
+
+	GST_OBJECT_LOCK (src);
+	s = gst_structure_new ("lumenera-stats",
+			"frames", G_TYPE_INT, src->n_frames,
+			"timeouts", G_TYPE_INT, src->total_timeouts,
+			"frames-discarded-paused", G_TYPE_UINT64, src->n_discarded,
+			"frames-decimated", G_TYPE_UINT64, src->n_decimated,
+			"triggers", G_TYPE_UINT64, src->n_triggers,
+			"triggers-ignored", G_TYPE_UINT64, src->n_triggers_ignored,
+			"triggered-frames", G_TYPE_UINT64, src->n_triggered_frames,
+			"trigger-latency-last", G_TYPE_UINT64, src->trigger_latency_last,
+			"trigger-latency-min", G_TYPE_UINT64, GST_CLOCK_TIME_IS_VALID (src->trigger_latency_min) ? src->trigger_latency_min : 0,
+			"trigger-latency-max", G_TYPE_UINT64, src->trigger_latency_max,
+			"trigger-latency-avg", G_TYPE_UINT64, src->n_triggered_frames ? src->trigger_latency_total / src->n_triggered_frames : 0,
+			"burst-captured", G_TYPE_UINT, (guint) g_atomic_int_get (&src->burst_captured),
+			"burst-pushed", G_TYPE_UINT, src->burst_pushed,
+			"burst-capture-fps", G_TYPE_DOUBLE, src->burst_capture_fps,
+			"burst-push-fps", G_TYPE_DOUBLE, src->burst_push_fps,
+			"pretrigger-frames", G_TYPE_UINT, src->ring_count,
+			"pretrigger-overruns", G_TYPE_UINT64, src->ring_overruns,
+			"frame-memory-node", G_TYPE_INT, MAX (src->frame_memory_node, -1),
+			"frame-memory-huge-pages", G_TYPE_BOOLEAN, src->work_huge_pages,
+			"frame-memory-locked", G_TYPE_BOOLEAN, src->work_locked,
+			"output-buffers", G_TYPE_INT, src->allocator ? g_atomic_int_get (&GST_LUMENERA_ALLOCATOR (src->allocator)->n_memories) : 0,
+			"output-buffers-huge-pages", G_TYPE_INT, src->allocator ? g_atomic_int_get (&GST_LUMENERA_ALLOCATOR (src->allocator)->n_huge_pages) : 0,
+			"output-buffers-locked", G_TYPE_INT, src->allocator ? g_atomic_int_get (&GST_LUMENERA_ALLOCATOR (src->allocator)->n_locked) : 0,
+			NULL);
+	gst_lumenera_src_stats_add_sched (s, "streaming", &src->streaming_sched);
+	gst_lumenera_src_stats_add_sched (s, "callback", &src->callback_sched);
+	gst_lumenera_src_stats_add_sched (s, "worker", &src->worker_sched);
+	GST_OBJECT_UNLOCK (src);
+
+	return s;
 }
 
 void
@@ -353,30 +1023,21 @@ gst_lumenera_src_set_property (GObject * object, guint property_id,
 	case PROP_CAMERAPRESENT:
 		src->cameraPresent = g_value_get_boolean (value);
 		break;
+	// Exposure and gains are applied together by the streaming thread at the next frame
 	case PROP_EXPOSURE:
-		src->exposure = g_value_get_double(value);
-		gst_lumenera_set_camera_exposure(src, LU_UPDATE_CAMERA);
+		gst_lumenera_src_publish_params(src, property_id, g_value_get_double(value));
 		break;
 	case PROP_GAIN:
-		src->gain = g_value_get_int (value);  // will be 0-100%
-		if (src->hCam) LucamSetProperty(src->hCam, LUCAM_PROP_GAIN, src->cam_min_gain + src->gain/100.0*(src->cam_max_gain-src->cam_min_gain), LUCAM_PROP_FLAG_USE);
+		gst_lumenera_src_publish_params(src, property_id, g_value_get_int (value));  // will be 0-100%
 		break;
 //	case PROP_BLACKLEVEL:
 //		src->blacklevel = g_value_get_int (value);
 //		if (src->hCam) LucamSetProperty(src->hCam, LUCAM_PROP_BLACK_LEVEL, src->blacklevel, LUCAM_PROP_FLAG_USE);
 		break;
 	case PROP_RGAIN:
-		src->rgain = g_value_get_float(value);
-		if (src->hCam) LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_RED, src->rgain, LUCAM_PROP_FLAG_USE);
-		break;
 	case PROP_GGAIN:
-		src->ggain = g_value_get_float(value);
-		if (src->hCam) LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN1, src->ggain, LUCAM_PROP_FLAG_USE);
-		if (src->hCam) LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN2, src->ggain, LUCAM_PROP_FLAG_USE);
-		break;
 	case PROP_BGAIN:
-		src->bgain = g_value_get_float(value);
-		if (src->hCam) LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_BLUE, src->bgain, LUCAM_PROP_FLAG_USE);
+		gst_lumenera_src_publish_params(src, property_id, g_value_get_float(value));
 		break;
 	case PROP_HORIZ_FLIP:
 		src->hflip = g_value_get_int (value);
@@ -393,6 +1054,135 @@ gst_lumenera_src_set_property (GObject * object, guint property_id,
 	case PROP_MAXFRAMERATE:
 		src->maxframerate = g_value_get_double(value);
 		break;
+	case PROP_TRIGGERMODE:
+		src->triggermode = g_value_get_enum (value);
+		break;
+	case PROP_TRIGGERPIN:
+		src->triggerpin = g_value_get_int (value);
+		break;
+	case PROP_CAPTUREENGINE:
+		src->captureengine = g_value_get_enum (value);
+		src->props_set |= LU_SET_CAPTUREENGINE;
+		break;
+	case PROP_TIMEOUT:
+		src->timeout = g_value_get_uint (value);
+		break;
+	case PROP_REFRESHINTERVAL:
+		g_mutex_lock (&src->poll_lock);
+		src->refresh_interval = g_value_get_uint (value);
+		g_cond_signal (&src->poll_cond);  // pick up the new interval straight away
+		g_mutex_unlock (&src->poll_lock);
+		break;
+	case PROP_CONTROLLEAD:
+		src->control_lead = g_value_get_uint (value);
+		break;
+	case PROP_LUT:
+		gst_lumenera_src_set_lut (src, g_value_get_string (value));
+		break;
+	case PROP_TAPCORRECTION:
+		src->tapcorrection = g_value_get_enum (value);
+		g_atomic_int_set (&src->tap_recalibrate, TRUE);
+		break;
+	case PROP_TAPCALIBRATIONFRAMES:
+		src->tap_frames = g_value_get_uint (value);
+		g_atomic_int_set (&src->tap_recalibrate, TRUE);
+		break;
+	case PROP_DARKFRAME:
+		gst_lumenera_src_set_calibration (src, GST_LUMENERA_CAL_DARK, g_value_get_string (value));
+		break;
+	case PROP_FLATFIELD:
+		gst_lumenera_src_set_calibration (src, GST_LUMENERA_CAL_FLAT, g_value_get_string (value));
+		break;
+	case PROP_ACCUMULATEFRAMES:
+		src->accumulate_frames = g_value_get_uint (value);
+		g_atomic_int_set (&src->acc_reset, TRUE);
+		break;
+	case PROP_ACCUMULATEMODE:
+		src->accumulate_mode = g_value_get_enum (value);
+		g_atomic_int_set (&src->acc_reset, TRUE);
+		break;
+	case PROP_FRAMESTATISTICS:
+		src->frame_statistics = g_value_get_boolean (value);
+		break;
+	case PROP_STATISTICSSUBSAMPLE:
+		src->statistics_subsample = g_value_get_uint (value);
+		break;
+	case PROP_STATISTICSTHREADS:
+		src->statistics_threads = g_value_get_uint (value);
+		break;
+	case PROP_STATISTICSINTERVAL:
+		src->statistics_interval = g_value_get_uint (value);
+		break;
+	case PROP_FOCUSMETRIC:
+		src->focus_metric = g_value_get_enum (value);
+		break;
+	case PROP_FOCUSROI:
+		gst_lumenera_src_set_focus_roi (src, g_value_get_string (value));
+		break;
+	case PROP_FOCUSINTERVAL:
+		src->focus_interval = g_value_get_uint (value);
+		break;
+	case PROP_DEFECTMAP:
+		gst_lumenera_src_set_calibration (src, GST_LUMENERA_CAL_DEFECTS, g_value_get_string (value));
+		break;
+	case PROP_DEFECTTHRESHOLD:
+		src->defect_threshold = g_value_get_uint (value);
+		break;
+	case PROP_BURSTFRAMES:
+		src->burst_frames = g_value_get_uint (value);
+		break;
+	case PROP_BURSTHUGEPAGES:
+		src->burst_huge_pages = g_value_get_boolean (value);
+		break;
+	case PROP_BURSTLOCKMEMORY:
+		src->burst_lock_memory = g_value_get_boolean (value);
+		break;
+	case PROP_PRETRIGGERSECONDS:
+		src->pretrigger_seconds = g_value_get_double (value);
+		break;
+	case PROP_TAPCONFIGURATION:
+		src->tap_configuration = g_value_get_enum (value);
+		src->props_set |= LU_SET_TAPCONFIGURATION;
+		break;
+	case PROP_BINNING:
+		src->binning = g_value_get_uint (value);
+		src->props_set |= LU_SET_BINNING;
+		break;
+	case PROP_ROI:
+		gst_lumenera_src_set_roi (src, g_value_get_string (value));
+		src->props_set |= LU_SET_ROI;
+		break;
+	case PROP_PROFILE:
+		g_free (src->profile);
+		src->profile = g_value_dup_string (value);
+		break;
+	case PROP_FRAMEHUGEPAGES:
+		src->frame_huge_pages = g_value_get_boolean (value);
+		break;
+	case PROP_FRAMELOCKMEMORY:
+		src->frame_lock_memory = g_value_get_boolean (value);
+		break;
+	case PROP_CAPTURECPU:
+		src->capture_cpu = g_value_get_int (value);
+		break;
+	case PROP_WORKERCPUS:
+		g_free (src->worker_cpus);
+		src->worker_cpus = NULL;
+		if (!gst_lumenera_cpus_valid (g_value_get_string (value)))
+			GST_WARNING_OBJECT (src, "Invalid worker-cpus \"%s\", expected a list such as 2-3 or 4,6", g_value_get_string (value));
+		else if (g_value_get_string (value) && *g_value_get_string (value))
+			src->worker_cpus = g_value_dup_string (value);
+		break;
+	case PROP_REALTIMEPRIORITY:
+		src->realtime_priority = g_value_get_int (value);
+		break;
+	case PROP_DECIMATE:
+		src->decimate = g_value_get_uint (value);
+		break;
+	case PROP_OUTPUTFRAMERATE:
+		src->output_framerate_n = gst_value_get_fraction_numerator (value);
+		src->output_framerate_d = gst_value_get_fraction_denominator (value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 		break;
@@ -404,40 +1194,46 @@ gst_lumenera_src_get_property (GObject * object, guint property_id,
 		GValue * value, GParamSpec * pspec)
 {
 	GstLumeneraSrc *src;
-	LONG flags;
+	GstLumeneraParams cur;
 
 	g_return_if_fail (GST_IS_LU_SRC (object));
 	src = GST_LU_SRC (object);
 
+	// Exposure and gains come from the shadow copy while the camera is open, no USB traffic here
+	GST_OBJECT_LOCK (src);
+	if (src->shadow_valid)
+		cur = src->shadow;
+	else {
+		cur.exposure = src->exposure;
+		cur.gain = src->gain;
+		cur.rgain = src->rgain;
+		cur.ggain = src->ggain;
+		cur.bgain = src->bgain;
+	}
+	GST_OBJECT_UNLOCK (src);
+
 	switch (property_id) {
 	case PROP_CAMERAPRESENT:
 		g_value_set_boolean (value, src->cameraPresent);
 		break;
 	case PROP_EXPOSURE:
-		if (src->hCam) LucamGetProperty(src->hCam, LUCAM_PROP_EXPOSURE, &(src->exposure), &flags);
-		g_value_set_double (value, src->exposure);
+		g_value_set_double (value, cur.exposure);
 		break;
 	case PROP_GAIN:
-		if (src->hCam) LucamGetProperty(src->hCam, LUCAM_PROP_GAIN, &(src->gain), &flags);
-		src->gain = (src->gain - src->cam_min_gain) * 100.0/(src->cam_max_gain-src->cam_min_gain);
-		g_value_set_int (value, src->gain);
+		g_value_set_int (value, cur.gain);
 		break;
 //	case PROP_BLACKLEVEL:
 //		if (src->hCam) LucamGetProperty(src->hCam, LUCAM_PROP_BLACK_LEVEL, &(src->blacklevel), &flags);
 //		g_value_set_int (value, src->blacklevel);
 //		break;
 	case PROP_RGAIN:
-		if (src->hCam) LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_RED, &(src->rgain), &flags);
-		g_value_set_float (value, src->rgain);
+		g_value_set_float (value, cur.rgain);
 		break;
 	case PROP_GGAIN:
-		if (src->hCam) LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN1, &(src->ggain), &flags);
-//		if (src->hCam) LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN1, &(src->ggain), &flags);  // Use green1 - we always set the same for 1 and 2
-		g_value_set_float (value, src->ggain);
+		g_value_set_float (value, cur.ggain);  // green1, we always set the same for 1 and 2
 		break;
 	case PROP_BGAIN:
-		if (src->hCam) LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_BLUE, &(src->bgain), &flags);
-		g_value_set_float (value, src->bgain);
+		g_value_set_float (value, cur.bgain);
 		break;
 	case PROP_HORIZ_FLIP:
 		g_value_set_int (value, src->hflip);
@@ -451,6 +1247,130 @@ gst_lumenera_src_get_property (GObject * object, guint property_id,
 	case PROP_MAXFRAMERATE:
 		g_value_set_double (value, src->maxframerate);
 		break;
+	case PROP_TRIGGERMODE:
+		g_value_set_enum (value, src->triggermode);
+		break;
+	case PROP_TRIGGERPIN:
+		g_value_set_int (value, src->triggerpin);
+		break;
+	case PROP_CAPTUREENGINE:
+		g_value_set_enum (value, src->captureengine);
+		break;
+	case PROP_TIMEOUT:
+		g_value_set_uint (value, src->timeout);
+		break;
+	case PROP_REFRESHINTERVAL:
+		g_value_set_uint (value, src->refresh_interval);
+		break;
+	case PROP_CONTROLLEAD:
+		g_value_set_uint (value, src->control_lead);
+		break;
+	case PROP_LUT:
+		g_mutex_lock (&src->params_lock);
+		g_value_set_string (value, src->lut_string);
+		g_mutex_unlock (&src->params_lock);
+		break;
+	case PROP_TAPCORRECTION:
+		g_value_set_enum (value, src->tapcorrection);
+		break;
+	case PROP_TAPCALIBRATIONFRAMES:
+		g_value_set_uint (value, src->tap_frames);
+		break;
+	case PROP_DARKFRAME:
+		g_mutex_lock (&src->cal_lock);
+		g_value_set_string (value, src->dark_path);
+		g_mutex_unlock (&src->cal_lock);
+		break;
+	case PROP_FLATFIELD:
+		g_mutex_lock (&src->cal_lock);
+		g_value_set_string (value, src->flat_path);
+		g_mutex_unlock (&src->cal_lock);
+		break;
+	case PROP_ACCUMULATEFRAMES:
+		g_value_set_uint (value, src->accumulate_frames);
+		break;
+	case PROP_ACCUMULATEMODE:
+		g_value_set_enum (value, src->accumulate_mode);
+		break;
+	case PROP_FRAMESTATISTICS:
+		g_value_set_boolean (value, src->frame_statistics);
+		break;
+	case PROP_STATISTICSSUBSAMPLE:
+		g_value_set_uint (value, src->statistics_subsample);
+		break;
+	case PROP_STATISTICSTHREADS:
+		g_value_set_uint (value, src->statistics_threads);
+		break;
+	case PROP_STATISTICSINTERVAL:
+		g_value_set_uint (value, src->statistics_interval);
+		break;
+	case PROP_FOCUSMETRIC:
+		g_value_set_enum (value, src->focus_metric);
+		break;
+	case PROP_FOCUSROI:
+		GST_OBJECT_LOCK (src);
+		g_value_set_string (value, src->focus_roi_string);
+		GST_OBJECT_UNLOCK (src);
+		break;
+	case PROP_FOCUSINTERVAL:
+		g_value_set_uint (value, src->focus_interval);
+		break;
+	case PROP_DEFECTMAP:
+		g_mutex_lock (&src->cal_lock);
+		g_value_set_string (value, src->defects_path);
+		g_mutex_unlock (&src->cal_lock);
+		break;
+	case PROP_DEFECTTHRESHOLD:
+		g_value_set_uint (value, src->defect_threshold);
+		break;
+	case PROP_BURSTFRAMES:
+		g_value_set_uint (value, src->burst_frames);
+		break;
+	case PROP_BURSTHUGEPAGES:
+		g_value_set_boolean (value, src->burst_huge_pages);
+		break;
+	case PROP_BURSTLOCKMEMORY:
+		g_value_set_boolean (value, src->burst_lock_memory);
+		break;
+	case PROP_PRETRIGGERSECONDS:
+		g_value_set_double (value, src->pretrigger_seconds);
+		break;
+	case PROP_TAPCONFIGURATION:
+		g_value_set_enum (value, src->tap_configuration);
+		break;
+	case PROP_BINNING:
+		g_value_set_uint (value, src->binning);
+		break;
+	case PROP_ROI:
+		g_value_set_string (value, src->roi_string);
+		break;
+	case PROP_PROFILE:
+		g_value_set_string (value, src->profile);
+		break;
+	case PROP_FRAMEHUGEPAGES:
+		g_value_set_boolean (value, src->frame_huge_pages);
+		break;
+	case PROP_FRAMELOCKMEMORY:
+		g_value_set_boolean (value, src->frame_lock_memory);
+		break;
+	case PROP_CAPTURECPU:
+		g_value_set_int (value, src->capture_cpu);
+		break;
+	case PROP_WORKERCPUS:
+		g_value_set_string (value, src->worker_cpus);
+		break;
+	case PROP_REALTIMEPRIORITY:
+		g_value_set_int (value, src->realtime_priority);
+		break;
+	case PROP_DECIMATE:
+		g_value_set_uint (value, src->decimate);
+		break;
+	case PROP_OUTPUTFRAMERATE:
+		gst_value_set_fraction (value, src->output_framerate_n, src->output_framerate_d);
+		break;
+	case PROP_STATS:
+		g_value_take_boxed (value, gst_lumenera_src_create_stats (src));
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
 		break;
@@ -468,6 +1388,10 @@ gst_lumenera_src_dispose (GObject * object)
 	GST_DEBUG_OBJECT (src, "dispose");
 
 	// clean up as possible.  may be called multiple times
+	GST_OBJECT_LOCK (src);
+	g_list_free_full (src->previews, gst_object_unref);
+	src->previews = NULL;
+	GST_OBJECT_UNLOCK (src);
 
 	G_OBJECT_CLASS (gst_lumenera_src_parent_class)->dispose (object);
 }
@@ -483,9 +1407,261 @@ gst_lumenera_src_finalize (GObject * object)
 	GST_DEBUG_OBJECT (src, "finalize");
 
 	/* clean up object here */
+	g_mutex_clear (&src->frame_lock);
+	g_cond_clear (&src->frame_cond);
+	g_mutex_clear (&src->params_lock);
+	g_mutex_clear (&src->poll_lock);
+	g_cond_clear (&src->poll_cond);
+	g_free (src->lut_string);
+
+	g_mutex_clear (&src->cal_lock);
+	g_free (src->dark_path);
+	g_free (src->flat_path);
+	if (src->dark)
+		gst_lumenera_cal_frame_unref (src->dark);
+	if (src->flat)
+		gst_lumenera_cal_frame_unref (src->flat);
+	g_free (src->defects_path);
+	if (src->defects)
+		gst_lumenera_cal_frame_unref (src->defects);
+	g_free (src->cal_capture_path);
+	g_free (src->cal_capture_sum);
+	g_free (src->acc);
+
+	gst_lumenera_src_free_statistics (src);
+	g_mutex_clear (&src->stats_lock);
+	g_cond_clear (&src->stats_cond);
+	g_free (src->focus_roi_string);
+	g_free (src->roi_string);
+	g_free (src->profile);
+	g_free (src->preferred_format);
+	g_free (src->worker_cpus);
+
 	G_OBJECT_CLASS (gst_lumenera_src_parent_class)->finalize (object);
 }
 
+//
+// Read exposure and gains from the camera into the shadow copy used by get_property
+//
+static void
+gst_lumenera_src_refresh_shadow (GstLumeneraSrc * src)
+{
+	GstLumeneraParams cam, *p;
+	FLOAT temperature = 0;
+	gboolean temperature_valid;
+	LONG flags;
+
+	memset (&cam, 0, sizeof(cam));
+	LucamGetProperty(src->hCam, LUCAM_PROP_EXPOSURE, &(cam.exposure), &flags);
+	LucamGetProperty(src->hCam, LUCAM_PROP_GAIN, &(cam.gain), &flags);
+	cam.gain = (cam.gain - src->cam_min_gain) * 100.0/(src->cam_max_gain-src->cam_min_gain);
+	LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_RED, &(cam.rgain), &flags);
+	LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN1, &(cam.ggain), &flags);  // Use green1 - we always set the same for 1 and 2
+	LucamGetProperty(src->hCam, LUCAM_PROP_GAIN_BLUE, &(cam.bgain), &flags);
+	temperature_valid = LucamGetProperty(src->hCam, LUCAM_PROP_TEMPERATURE, &temperature, &flags);
+
+	// Settings published but not yet applied, while not playing say, read back as published and not as
+	// the camera's old values
+	g_mutex_lock (&src->params_lock);
+	p = src->params_current;
+	if (p->generation != g_atomic_int_get (&src->params_applied)){
+		cam.exposure = p->exposure;
+		cam.gain = p->gain;
+		cam.rgain = p->rgain;
+		cam.ggain = p->ggain;
+		cam.bgain = p->bgain;
+	}
+	g_mutex_unlock (&src->params_lock);
+
+	GST_OBJECT_LOCK (src);
+	src->shadow = cam;
+	src->shadow_valid = TRUE;
+	src->temperature = temperature;
+	src->temperature_valid = temperature_valid;
+	GST_OBJECT_UNLOCK (src);
+}
+
+//
+// Keeps the shadow copy (and the sensor temperature) fresh while the camera is open, every refresh_interval ms
+// and whenever the streaming thread has applied new settings.
+//
+static gpointer
+gst_lumenera_src_poll_thread (gpointer data)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (data);
+	gint64 end_time;
+	gboolean timed_out;
+
+	g_mutex_lock (&src->poll_lock);
+	while (!src->poll_stop) {
+		if (!src->poll_now){
+			timed_out = FALSE;
+			if (src->refresh_interval > 0){
+				end_time = g_get_monotonic_time () + src->refresh_interval * (G_USEC_PER_SEC / 1000);
+				timed_out = !g_cond_wait_until (&src->poll_cond, &src->poll_lock, end_time);
+			}
+			else
+				g_cond_wait (&src->poll_cond, &src->poll_lock);
+			// A new interval also wakes us, only refresh on time out or request
+			if (src->poll_stop || (!src->poll_now && !timed_out))
+				continue;
+		}
+		src->poll_now = FALSE;
+		g_mutex_unlock (&src->poll_lock);
+
+		gst_lumenera_src_refresh_shadow (src);
+
+		g_mutex_lock (&src->poll_lock);
+	}
+	g_mutex_unlock (&src->poll_lock);
+
+	return NULL;
+}
+
+//
+// Parse and store a sensor region "x,y,width,height", NULL or empty for the whole sensor
+//
+static void
+gst_lumenera_src_set_roi (GstLumeneraSrc * src, const gchar * str)
+{
+	gint x = 0, y = 0, width = 0, height = 0;
+
+	if (str && *str == '\0')
+		str = NULL;
+
+	if (str && (sscanf (str, "%d,%d,%d,%d", &x, &y, &width, &height) != 4 || x < 0 || y < 0 || width <= 0 || height <= 0)){
+		GST_WARNING_OBJECT (src, "Invalid roi \"%s\", expected x,y,width,height", str);
+		return;
+	}
+
+	g_free (src->roi_string);
+	src->roi_string = g_strdup (str);
+	src->roi_x = x;
+	src->roi_y = y;
+	src->roi_width = width;
+	src->roi_height = height;
+}
+
+//
+// Take the recommended configuration from a lumenera-probe profile, if it was made on a sensor of this size
+//
+static void
+gst_lumenera_src_load_profile (GstLumeneraSrc * src)
+{
+	GKeyFile *kf = g_key_file_new ();
+	GError *error = NULL;
+	gchar *str;
+	GEnumValue *ev;
+
+	if (!g_key_file_load_from_file (kf, src->profile, G_KEY_FILE_NONE, &error)
+			|| !g_key_file_has_group (kf, "recommended")) {
+		GST_ELEMENT_WARNING (src, RESOURCE, READ, ("Could not use profile %s", src->profile),
+				("%s", error ? error->message : "no recommended configuration"));
+		goto done;
+	}
+
+	if (g_key_file_get_integer (kf, "probe", "sensor-width", NULL) != (gint) src->sensor_width
+			|| g_key_file_get_integer (kf, "probe", "sensor-height", NULL) != (gint) src->sensor_height) {
+		GST_ELEMENT_WARNING (src, RESOURCE, SETTINGS, ("Profile %s is for a different camera, ignored", src->profile), (NULL));
+		goto done;
+	}
+
+	// What the application set wins, the rest is notified so get_property callers know where it came from
+	str = g_key_file_get_string (kf, "recommended", "tap-configuration", NULL);
+	if (!(src->props_set & LU_SET_TAPCONFIGURATION) && str
+			&& (ev = g_enum_get_value_by_nick (g_type_class_peek (TYPE_TAPCONFIGURATION), str))
+			&& (gint) src->tap_configuration != ev->value){
+		src->tap_configuration = ev->value;
+		g_object_notify (G_OBJECT (src), "tap-configuration");
+	}
+	g_free (str);
+
+	str = g_key_file_get_string (kf, "recommended", "capture-engine", NULL);
+	if (!(src->props_set & LU_SET_CAPTUREENGINE) && str
+			&& (ev = g_enum_get_value_by_nick (g_type_class_peek (TYPE_CAPTUREENGINE), str))
+			&& (gint) src->captureengine != ev->value){
+		src->captureengine = ev->value;
+		g_object_notify (G_OBJECT (src), "capture-engine");
+	}
+	g_free (str);
+
+	if (!(src->props_set & LU_SET_BINNING) && g_key_file_has_key (kf, "recommended", "binning", NULL)){
+		guint binning = CLAMP (g_key_file_get_integer (kf, "recommended", "binning", NULL), 1, 8);
+
+		if (src->binning != binning){
+			src->binning = binning;
+			g_object_notify (G_OBJECT (src), "binning");
+		}
+	}
+
+	str = g_key_file_get_string (kf, "recommended", "roi", NULL);
+	if (!(src->props_set & LU_SET_ROI) && g_strcmp0 (str && *str ? str : NULL, src->roi_string)){
+		gst_lumenera_src_set_roi (src, str);
+		g_object_notify (G_OBJECT (src), "roi");
+	}
+	g_free (str);
+
+	g_free (src->preferred_format);
+	src->preferred_format = g_key_file_get_string (kf, "recommended", "format", NULL);
+
+	GST_INFO_OBJECT (src, "Profile %s: tap-configuration %d binning %u roi %s capture-engine %d format %s", src->profile,
+			src->tap_configuration, src->binning, src->roi_string, src->captureengine, src->preferred_format);
+
+done:
+	g_clear_error (&error);
+	g_key_file_free (kf);
+}
+
+//
+// Read out roi with binning. Offsets and sizes are rounded down to the camera's units times the binning,
+// so the Bayer phase and the binned cells line up. The whole sensor if roi is empty or does not fit.
+//
+static void
+gst_lumenera_src_set_geometry (GstLumeneraSrc * src)
+{
+	LUCAM_FRAME_FORMAT format;
+	float framerate, unit_width = 0, unit_height = 0;
+	LONG flags;
+	ULONG ux, uy, x = 0, y = 0, width = src->sensor_width, height = src->sensor_height;
+
+	if (!LucamGetFormat (src->hCam, &format, &framerate))
+		return;
+
+	LucamGetProperty (src->hCam, LUCAM_PROP_UNIT_WIDTH, &unit_width, &flags);
+	LucamGetProperty (src->hCam, LUCAM_PROP_UNIT_HEIGHT, &unit_height, &flags);
+	ux = MAX ((ULONG) unit_width, 2) * src->binning;
+	uy = MAX ((ULONG) unit_height, 2) * src->binning;
+
+	if (src->roi_width) {
+		x = src->roi_x / ux * ux;
+		y = src->roi_y / uy * uy;
+		width = MIN ((ULONG) src->roi_x + src->roi_width, src->sensor_width) - MIN (x, src->sensor_width);
+		height = MIN ((ULONG) src->roi_y + src->roi_height, src->sensor_height) - MIN (y, src->sensor_height);
+		if (x >= src->sensor_width || y >= src->sensor_height || width < ux || height < uy) {
+			GST_ELEMENT_WARNING (src, RESOURCE, SETTINGS, ("roi %s is outside the %lux%lu sensor, using the whole sensor",
+					src->roi_string, (gulong) src->sensor_width, (gulong) src->sensor_height), (NULL));
+			x = y = 0;
+			width = src->sensor_width;
+			height = src->sensor_height;
+		}
+	}
+
+	format.xOffset = x;
+	format.yOffset = y;
+	format.width = width / ux * ux;
+	format.height = height / uy * uy;
+	format.binningX = src->binning;
+	format.binningY = src->binning;
+	format.flagsX = src->binning > 1 ? LUCAM_FRAME_FORMAT_FLAGS_BINNING : 0;
+	format.flagsY = format.flagsX;
+
+	GST_DEBUG_OBJECT (src, "LucamSetFormat x %lu y %lu w %lu h %lu binning %u", (gulong) format.xOffset, (gulong) format.yOffset,
+			(gulong) format.width, (gulong) format.height, src->binning);
+	if (!LucamSetFormat (src->hCam, &format, framerate))
+		GST_ELEMENT_WARNING (src, RESOURCE, SETTINGS, ("Camera refused roi %s binning %u", src->roi_string ? src->roi_string : "(whole sensor)",
+				src->binning), ("LucamSetFormat failed with: %lu (see lucamerr.h)", (gulong) LucamGetLastError()));
+}
+
 static gboolean
 gst_lumenera_src_start (GstBaseSrc * bsrc)
 {
@@ -499,6 +1675,17 @@ gst_lumenera_src_start (GstBaseSrc * bsrc)
 
 	GST_DEBUG_OBJECT (src, "start");
 
+	// Threads are scheduled again when they next take a frame
+	GST_OBJECT_LOCK (src);
+	src->streaming_thread = NULL;
+	src->callback_thread = NULL;
+	memset (&src->streaming_sched, 0, sizeof (GstLumeneraThreadSched));
+	memset (&src->callback_sched, 0, sizeof (GstLumeneraThreadSched));
+	memset (&src->worker_sched, 0, sizeof (GstLumeneraThreadSched));
+	src->sched_warned = FALSE;
+	src->frame_memory_node = -1;
+	GST_OBJECT_UNLOCK (src);
+
 	// Turn on automatic timestamping, if so we do not need to do it manually, BUT there is some evidence that automatic timestamping is laggy
 //	gst_base_src_set_do_timestamp(bsrc, TRUE);
 
@@ -523,18 +1710,44 @@ gst_lumenera_src_start (GstBaseSrc * bsrc)
 	// use is_ExitCamera to end the usage
 	src->cameraPresent = TRUE;
 
-	// Choose the number of taps, do this before anything else
-	GST_DEBUG_OBJECT (src, "LucamSetProperty TAP_CONFIGURATION_DUAL");
-	LucamSetProperty(src->hCam, LUCAM_PROP_TAP_CONFIGURATION, TAP_CONFIGURATION_DUAL, LUCAM_PROP_FLAG_USE);
+	// The camera opens reading out the whole sensor
+	{
+		float max_width = 0, max_height = 0;
+
+		LucamGetProperty(src->hCam, LUCAM_PROP_MAX_WIDTH, &max_width, &flags);
+		LucamGetProperty(src->hCam, LUCAM_PROP_MAX_HEIGHT, &max_height, &flags);
+		if (max_width <= 0 || max_height <= 0){
+			LUEXECANDCHECK(LucamGetFormat(src->hCam, &(src->frameFormat), &(src->framerate)));
+			max_width = src->frameFormat.xOffset + src->frameFormat.width;
+			max_height = src->frameFormat.yOffset + src->frameFormat.height;
+		}
+		src->sensor_width = max_width;
+		src->sensor_height = max_height;
+	}
 
-	// Can now get the possible frame rates and choose one
+	if (src->profile)
+		gst_lumenera_src_load_profile (src);
+
+	// Choose the number of taps, do this before anything else
+	{
+		static const ULONG taps[] = { TAP_CONFIGURATION_SINGLE, TAP_CONFIGURATION_DUAL, TAP_CONFIGURATION_QUAD };
+
+		GST_DEBUG_OBJECT (src, "LucamSetProperty TAP_CONFIGURATION %lu", (gulong) taps[src->tap_configuration]);
+		if (!LucamSetProperty(src->hCam, LUCAM_PROP_TAP_CONFIGURATION, taps[src->tap_configuration], LUCAM_PROP_FLAG_USE))
+			GST_WARNING_OBJECT (src, "Camera refused tap-configuration %d: %d (see lucamerr.h)", src->tap_configuration, LucamGetLastError());
+	}
+
+	// Region and binning change the frame rates on offer, so before they are read
+	gst_lumenera_src_set_geometry (src);
+
+	// Can now get the possible frame rates and choose one
 	entry_count = LucamEnumAvailableFrameRates(src->hCam, 0, NULL);  // Call to get entry_count
 	framerates = (float *)malloc(entry_count * sizeof(float));
 	LucamEnumAvailableFrameRates(src->hCam, entry_count, framerates);   // Call to get framerates
 	for (i=0; i<entry_count; i++){
 		GST_DEBUG_OBJECT (src, "Possible framerate: %f", framerates[i]);
 	}
-	// Choose the last frame rate, which will be the highest one, for DUAL tap we expect 26.785578 fps
+	// Choose the last frame rate, which will be the highest one, for DUAL tap on the full sensor we expect 26.785578 fps
 	src->maxframerate = framerates[entry_count-1];
 
 	// Get and report the range of exposure values
@@ -560,18 +1773,6 @@ gst_lumenera_src_start (GstBaseSrc * bsrc)
 		GST_DEBUG_OBJECT (src, "Possible bgains: %f to %f, default %f (%d)", min, max, default_val, flags);
 	}
 
-	// Try to set subsample or binning
-//	LUEXECANDCHECK(LucamGetFormat(src->hCam, &(src->frameFormat), &(src->framerate)));
-//	src->frameFormat.binningX = 2;
-//	src->frameFormat.binningY = 2;
-//	src->frameFormat.flagsX = LUCAM_FRAME_FORMAT_FLAGS_BINNING;
-//	src->frameFormat.flagsY = LUCAM_FRAME_FORMAT_FLAGS_BINNING;
-//	src->frameFormat.subSampleX = 2;
-//	src->frameFormat.subSampleY = 2;
-//	src->frameFormat.flagsX = 0;
-//	src->frameFormat.flagsY = 0;
-//	LUEXECANDCHECK(LucamSetFormat(src->hCam, &(src->frameFormat), src->framerate));
-
 	// Get information about the camera sensor and image
 	GST_DEBUG_OBJECT (src, "LucamGetVideoImageFormat");
 	LUEXECANDCHECK(LucamGetVideoImageFormat (src->hCam, &(src->imageFormat)));
@@ -606,6 +1807,15 @@ gst_lumenera_src_start (GstBaseSrc * bsrc)
 		break;
 	}
 
+	// The Bayer pattern, so frame statistics know which site is which colour
+	{
+		float color_format;
+
+		if (LucamGetProperty(src->hCam, LUCAM_PROP_COLOR_FORMAT, &color_format, &flags))
+			src->color_format = ((ULONG) color_format) & ~LUCAM_PROP_FLAG_LITTLE_ENDIAN;
+		GST_DEBUG_OBJECT (src, "Colour format: %d", src->color_format);
+	}
+
 	// Check the pixel format
 	src->nBitsPerPixel = 24;   // some sensible default
 	switch(src->imageFormat.PixelFormat){
@@ -655,15 +1865,30 @@ gst_lumenera_src_start (GstBaseSrc * bsrc)
 	src->nImageSize = src->nWidth * src->nHeight * src->nBytesPerPixel;
 	GST_DEBUG_OBJECT (src, "Image is %d x %d, pitch %d, bpp %d, Bpp %d", src->nWidth, src->nHeight, src->nPitch, src->nBitsPerPixel, src->nBytesPerPixel);
 
-	gst_lumenera_set_camera_exposure(src, LU_UPDATE_CAMERA);
-	LucamSetProperty(src->hCam, LUCAM_PROP_GAIN, src->gain, LUCAM_PROP_FLAG_USE);
-
-	LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_RED, src->rgain, LUCAM_PROP_FLAG_USE);
-	LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN1, src->ggain, LUCAM_PROP_FLAG_USE);
-	LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN2, src->ggain, LUCAM_PROP_FLAG_USE);
-	LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_BLUE, src->bgain, LUCAM_PROP_FLAG_USE);
+	// Exposure and gains as last published by set_property
+	gst_lumenera_src_apply_params(src, TRUE);
+	src->params_tag_pending = FALSE;
 	GST_DEBUG_OBJECT (src, "Set Gains R %f G %f B %f", src->rgain, src->ggain, src->bgain);
 
+#if defined(_WIN32)
+	{
+		ULONGLONG freq = 0;
+
+		// Have the camera embed its timestamp and frame counter for the frame meta
+		src->timestamp_freq = 0;
+		if (LucamEnableTimestamp(src->hCam, TRUE) && LucamGetTimestampFrequency(src->hCam, &freq))
+			src->timestamp_freq = freq;
+	}
+#endif
+
+	gst_lumenera_src_push_lut (src);
+
+	// Read back what the camera took and keep it fresh in the background
+	gst_lumenera_src_refresh_shadow (src);
+	src->poll_stop = FALSE;
+	src->poll_now = FALSE;
+	src->poll_thread = g_thread_new ("lumenerasrc-poll", gst_lumenera_src_poll_thread, src);
+
 	//	gst_lumenera_set_camera_binning(src); // Binning/subsample mode?
 //	is_SetRopEffect(src->hCam, IS_SET_ROP_MIRROR_LEFTRIGHT, src->hflip, 0);
 //	is_SetRopEffect(src->hCam, IS_SET_ROP_MIRROR_UPDOWN, src->vflip, 0);
@@ -698,25 +1923,144 @@ gst_lumenera_src_start (GstBaseSrc * bsrc)
 	return FALSE;
 }
 
+//
+// Undo what set_caps started, leaving the camera open
+//
+static void
+gst_lumenera_src_stop_capture (GstLumeneraSrc * src)
+{
+	if (src->acq_started && !src->fastFramesEnabled){
+		if (src->captureengine == GST_ENGINE_CALLBACK)
+			LUEXECANDCHECK(LucamRemoveStreamingCallback(src->hCam, src->callbackID));
+		GST_DEBUG_OBJECT (src, "LucamStreamVideoControl STOP_STREAMING");
+		LUEXECANDCHECK(LucamStreamVideoControl(src->hCam, STOP_STREAMING, NULL));
+	}
+
+	gst_lumenera_src_free_capture (src);
+	src->acq_started = FALSE;
+}
+
+//
+// Disable fast frames and free the frame memory, whatever set_caps got to before it succeeded or failed
+//
+static void
+gst_lumenera_src_free_capture (GstLumeneraSrc * src)
+{
+	if (src->fastFramesEnabled){
+		GST_DEBUG_OBJECT (src, "LucamDisableFastFrames");
+		LUEXECANDCHECK(LucamDisableFastFrames(src->hCam));
+		g_mutex_lock (&src->frame_lock);
+		src->fastFramesEnabled = FALSE;
+		g_mutex_unlock (&src->frame_lock);
+	}
+
+	// Buffers still downstream free their memory when they come back to the inactive pool
+	if (src->pool){
+		gst_buffer_pool_set_active (src->pool, FALSE);
+		gst_object_unref (src->pool);
+		src->pool = NULL;
+	}
+	GST_OBJECT_LOCK (src);
+	if (src->allocator){
+		gst_object_unref (src->allocator);
+		src->allocator = NULL;
+	}
+	GST_OBJECT_UNLOCK (src);
+	if (src->work_arena){
+		gst_lumenera_arena_free (src->work_arena);
+		src->work_arena = NULL;
+	}
+	src->rgbImage = NULL;
+	src->rawImage = NULL;
+
+	// The previews are negotiated again for the new frame size
+	{
+		GList *l;
+		gint i;
+
+		g_atomic_int_set (&src->preview_factors, 0);
+		src->preview_ready = 0;
+		for (i = 0; i < GST_LUMENERA_PREVIEW_FACTORS; i++){
+			g_free (src->preview_image[i]);
+			src->preview_image[i] = NULL;
+		}
+		GST_OBJECT_LOCK (src);
+		for (l = src->previews; l; l = l->next){
+			GstLumeneraPreview *preview = g_object_get_qdata (G_OBJECT (l->data), preview_quark);
+
+			preview->factor = 0;
+			preview->raw_width = preview->raw_height = 0;  // so push_previews negotiates again
+		}
+		GST_OBJECT_UNLOCK (src);
+	}
+	if (src->arena){
+		gst_lumenera_arena_free (src->arena);
+		src->arena = NULL;
+	}
+	g_free (src->slots);
+	src->slots = NULL;
+	src->ring_frames = 0;
+	src->ring_count = 0;
+}
+
 static gboolean
 gst_lumenera_src_stop (GstBaseSrc * bsrc)
 {
 	// Start will open the device but not start it, set_caps starts it, stop should stop and close it (as v4l2src)
 
 	GstLumeneraSrc *src = GST_LU_SRC (bsrc);
+	GList *l;
 
 	GST_DEBUG_OBJECT (src, "stop");
-	LUEXECANDCHECK(LucamRemoveStreamingCallback(src->hCam, src->callbackID));
-	GST_DEBUG_OBJECT (src, "LucamStreamVideoControl STOP_STREAMING");
-	LUEXECANDCHECK(LucamStreamVideoControl(src->hCam, STOP_STREAMING, NULL));
+	if (src->poll_thread){
+		g_mutex_lock (&src->poll_lock);
+		src->poll_stop = TRUE;
+		g_cond_signal (&src->poll_cond);
+		g_mutex_unlock (&src->poll_lock);
+		g_thread_join (src->poll_thread);
+		src->poll_thread = NULL;
+	}
+	GST_OBJECT_LOCK (src);
+	src->shadow_valid = FALSE;
+	// A restarted stream pushes stream-start and segment on the previews again
+	for (l = src->previews; l; l = l->next)
+		((GstLumeneraPreview *) g_object_get_qdata (G_OBJECT (l->data), preview_quark))->started = FALSE;
+	GST_OBJECT_UNLOCK (src);
+	src->params_sent_valid = FALSE;  // the next camera opened is sent everything
+
+	gst_lumenera_src_stop_capture (src);
+	gst_lumenera_src_free_statistics (src);
 	GST_DEBUG_OBJECT (src, "LucamCameraClose");
 	LUEXECANDCHECK(LucamCameraClose(src->hCam));
 
 	gst_lumenera_src_reset (src);
+	// Camera is closed, just pick up any settings published but not yet applied
+	gst_lumenera_src_apply_params (src, FALSE);
+	src->params_tag_pending = FALSE;
 
 	return TRUE;
 }
 
+//
+// Caps name of the camera's Bayer pattern, NULL for mono cameras
+//
+static const gchar *
+gst_lumenera_src_bayer_pattern (GstLumeneraSrc * src)
+{
+	switch (src->color_format){
+	case LUCAM_CF_BAYER_RGGB:
+		return "rggb";
+	case LUCAM_CF_BAYER_GRBG:
+		return "grbg";
+	case LUCAM_CF_BAYER_GBRG:
+		return "gbrg";
+	case LUCAM_CF_BAYER_BGGR:
+		return "bggr";
+	default:
+		return NULL;
+	}
+}
+
 static GstCaps *
 gst_lumenera_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
 {
@@ -744,6 +2088,44 @@ gst_lumenera_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
 
     caps = gst_video_info_to_caps (&vinfo);
 
+    // Raw Bayer after RGB, so RGB stays the default, packed only where pixel groups fit the rows
+    if (gst_lumenera_src_bayer_pattern (src)) {
+      static const gchar *suffixes[] = { "", "10p", "12p" };
+      guint i;
+
+      for (i = 0; i < G_N_ELEMENTS (suffixes); i++) {
+        gchar *format;
+
+        if ((i == 1 && src->nWidth % 4) || (i == 2 && src->nWidth % 2))
+          continue;
+        format = g_strconcat (gst_lumenera_src_bayer_pattern (src), suffixes[i], NULL);
+        gst_caps_append (caps, gst_caps_new_simple ("video/x-bayer",
+            "format", G_TYPE_STRING, format,
+            "width", G_TYPE_INT, src->nWidth,
+            "height", G_TYPE_INT, src->nHeight,
+            "framerate", GST_TYPE_FRACTION, 0, 1, NULL));
+        g_free (format);
+      }
+    }
+
+    // The profile's format first, so negotiation picks it when downstream accepts several
+    if (src->preferred_format) {
+      guint i;
+
+      for (i = 0; i < gst_caps_get_size (caps); i++) {
+        const gchar *format = gst_structure_get_string (gst_caps_get_structure (caps, i), "format");
+
+        if (i > 0 && !g_strcmp0 (format, src->preferred_format)) {
+          GstCaps *first = gst_caps_new_empty ();
+
+          gst_caps_append_structure (first, gst_caps_steal_structure (caps, i));
+          gst_caps_append (first, caps);
+          caps = first;
+          break;
+        }
+      }
+    }
+
     // We can supply our max frame rate, but not sure how to do it or what effect it will have
     // 1st attempt to set max-framerate in the caps
 //    GstStructure *structure = gst_caps_get_structure (caps, 0);
@@ -766,130 +2148,2508 @@ gst_lumenera_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
 }
 
 //
-// Called when an image is received from the camera image stream
+// Note which frame arrived and when, from the metadata the camera embeds in the image where the SDK supports it
 //
-VOID imageCallback(VOID *pContext, BYTE *pData, ULONG dataLength)
+static void
+gst_lumenera_src_stamp_frame (GstLumeneraSrc * src, BYTE * raw)
 {
-	GstLumeneraSrc *src = (GstLumeneraSrc *)pContext;
+#if defined(_WIN32)
+	ULONGLONG ticks, count;
+
+	if (src->timestamp_freq
+			&& LucamGetMetadata(src->hCam, raw, &(src->imageFormat), LUCAM_METADATA_TIMESTAMP, &ticks)
+			&& LucamGetMetadata(src->hCam, raw, &(src->imageFormat), LUCAM_METADATA_FRAME_COUNTER, &count)){
+		src->frame_timestamp = gst_util_uint64_scale (ticks, GST_SECOND, src->timestamp_freq);
+		src->frame_counter = count;
+		src->frame_hw_timestamp = TRUE;
+		return;
+	}
+#endif
+	// The Linux SDK has no metadata API, use the host arrival time and our own frame count
+	src->frame_timestamp = g_get_monotonic_time () * GST_USECOND;
+	src->frame_counter = src->n_frames;
+	src->frame_hw_timestamp = FALSE;
+}
 
-	// Consumer of this object still needs the rgb image?
-	// Drop this frame then
-	if (!src->rgbImageOwnerIsProducer) {
-	return;
+//
+// Give the calling thread the affinity and priority asked for. sched keeps what it got for the stats,
+// the first refusal is also posted as a warning.
+//
+static void
+gst_lumenera_src_schedule (GstLumeneraSrc * src, GstLumeneraThreadSched * sched, const gchar * cpus, const gchar * role)
+{
+	GstLumeneraThreadSched applied;
+	gboolean ok = gst_lumenera_thread_schedule (cpus, src->realtime_priority, &applied);
+
+	GST_OBJECT_LOCK (src);
+	*sched = applied;
+	GST_OBJECT_UNLOCK (src);
+
+	GST_INFO_OBJECT (src, "%s thread: %s priority %d on CPUs %s, node %d", role, gst_lumenera_sched_policy_name (applied.policy),
+			applied.priority, applied.cpus, applied.node);
+	if (!ok && !src->sched_warned){
+		src->sched_warned = TRUE;
+		GST_ELEMENT_WARNING (src, RESOURCE, SETTINGS, ("Could not give the %s thread the CPU affinity or priority asked for", role),
+				("Running %s priority %d on CPUs %s, SCHED_FIFO needs CAP_SYS_NICE or RLIMIT_RTPRIO",
+						gst_lumenera_sched_policy_name (applied.policy), applied.priority, applied.cpus));
 	}
+}
 
-	//GST_DEBUG_OBJECT(src, "imageCallback called.");
+//
+// Called on the streaming thread as the task leaves it, the thread goes back to the task pool and may run
+// another element's task next: only the SDK callback thread and the statistics workers keep their scheduling
+//
+static void
+gst_lumenera_src_streaming_leave (GstTask * task, GThread * thread, gpointer user_data)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (user_data);
 
-	LucamConvertFrameToRgb24Ex(src->hCam, src->rgbImage, pData, &(src->imageFormat), &(src->conversionParams));
-	//memset(src->rgbImage, 100, src->nHeight*src->nWidth*src->nBytesPerPixel);  // TEST line to see if LucamConvertFrameToRgb24Ex was taking a lot of time
+	if (src->streaming_thread != thread)
+		return;
+	gst_lumenera_thread_restore (&src->streaming_saved);
+	src->streaming_thread = NULL;  // scheduled again if it comes back
+}
 
-	// Transfer ownership to consumer
-	src->rgbImageOwnerIsProducer = FALSE;
+//
+// Schedule a thread that takes and converts frames, the first time it does so. A thread that is not ours to
+// keep has what it had saved in saved first, for gst_lumenera_src_streaming_leave to give back.
+//
+static void
+gst_lumenera_src_schedule_capture (GstLumeneraSrc * src, GThread ** thread, GstLumeneraThreadSched * sched,
+		GstLumeneraThreadSaved * saved, const gchar * role)
+{
+	gchar cpu[16];
+
+	if (*thread == g_thread_self ())
+		return;
+	*thread = g_thread_self ();
+
+	if (saved && (src->capture_cpu >= 0 || src->realtime_priority > 0))
+		gst_lumenera_thread_save (saved);
+
+	g_snprintf (cpu, sizeof (cpu), "%d", src->capture_cpu);
+	gst_lumenera_src_schedule (src, sched, src->capture_cpu >= 0 ? cpu : NULL, role);
 }
 
+//
+// The arena of frames raw frames and their stamps, for a burst or the pre-trigger ring
+//
 static gboolean
-gst_lumenera_src_set_caps (GstBaseSrc * bsrc, GstCaps * caps)
+gst_lumenera_src_arena_alloc (GstLumeneraSrc * src, guint frames)
 {
-	// Start will open the device but not start it, set_caps starts it, stop should stop and close it (as v4l2src)
-
-	GstLumeneraSrc *src = GST_LU_SRC (bsrc);
-	GstVideoInfo vinfo;
-	//GstStructure *s = gst_caps_get_structure (caps, 0);
+	GError *err = NULL;
+
+	src->slot_size = (src->imageFormat.ImageSize + 63) & ~((gsize) 63);  // slots on cache lines
+	src->arena = gst_lumenera_arena_new (src->slot_size * frames, src->burst_huge_pages, src->burst_lock_memory, &err);
+	if (!src->arena){
+		GST_ELEMENT_ERROR (src, RESOURCE, NO_SPACE_LEFT, ("Could not allocate memory for %u raw frames.", frames),
+				("%s", err->message));
+		g_error_free (err);
+		return FALSE;
+	}
+	if (src->burst_huge_pages && !src->arena->huge_pages)
+		GST_INFO_OBJECT (src, "No room in the hugetlb pool, the frames use transparent huge pages where the kernel allows");
+	if (src->burst_lock_memory && !src->arena->locked)
+		GST_WARNING_OBJECT (src, "Could not lock the frame memory (%" G_GSIZE_FORMAT " bytes), check RLIMIT_MEMLOCK", src->arena->size);
 
-	GST_DEBUG_OBJECT (src, "The caps being set are %" GST_PTR_FORMAT, caps);
+	src->slots = g_new0 (GstLumeneraSlot, frames);
 
-	gst_video_info_from_caps (&vinfo, caps);
+	return TRUE;
+}
 
-	if (GST_VIDEO_INFO_FORMAT (&vinfo) != GST_VIDEO_FORMAT_UNKNOWN) {
-		g_assert (src->hCam != 0);
-		//  src->vrm_stride = get_pitch (src->device);  // wait for image to arrive for this
-		src->gst_stride = GST_VIDEO_INFO_COMP_STRIDE (&vinfo, 0);
-		src->nHeight = vinfo.height;
-	} else {
-		goto unsupported_caps;
+//
+// rgbImage, rawImage and the output buffer pool, all faulted in now so the first frames never wait on the kernel
+//
+static gboolean
+gst_lumenera_src_frames_alloc (GstLumeneraSrc * src, GstCaps * caps)
+{
+	gsize rgb_size = GST_ROUND_UP_64 (src->nPitch * src->nHeight);
+	GError *err = NULL;
+
+	src->work_arena = gst_lumenera_arena_new (rgb_size + src->imageFormat.ImageSize, src->frame_huge_pages, src->frame_lock_memory, &err);
+	if (!src->work_arena){
+		GST_ELEMENT_ERROR (src, RESOURCE, NO_SPACE_LEFT, ("Could not allocate memory for the frames."), ("%s", err->message));
+		g_error_free (err);
+		return FALSE;
+	}
+	src->rgbImage = src->work_arena->data;
+	src->rawImage = src->work_arena->data + rgb_size;
+	if (src->frame_lock_memory && !src->work_arena->locked)
+		GST_INFO_OBJECT (src, "Could not lock the frame memory (%" G_GSIZE_FORMAT " bytes), check RLIMIT_MEMLOCK", src->work_arena->size);
+
+	GST_OBJECT_LOCK (src);
+	src->allocator = gst_lumenera_allocator_new (src->frame_huge_pages, src->frame_lock_memory);
+	src->work_huge_pages = src->work_arena->huge_pages;
+	src->work_locked = src->work_arena->locked;
+	GST_OBJECT_UNLOCK (src);
+
+	src->pool = gst_lumenera_allocator_pool_new (src->allocator, caps, src->gst_stride * src->nHeight, LU_OUTPUT_BUFFERS);
+	if (!src->pool || !gst_buffer_pool_set_active (src->pool, TRUE)){
+		GST_ELEMENT_ERROR (src, RESOURCE, NO_SPACE_LEFT, ("Could not allocate %d output buffers.", LU_OUTPUT_BUFFERS), (NULL));
+		return FALSE;
 	}
 
-	// TODO What should this be? Does not make any difference, does not help with mpeg2 mux container
-//	gst_base_src_set_blocksize(bsrc, src->gst_stride * src->nHeight);
-//	GST_DEBUG_OBJECT (src, "Buffer block size is %d bytes", gst_base_src_get_blocksize(bsrc));
+	return TRUE;
+}
+
+//
+// Burst capture: the arena of burst_frames raw frames, empty
+//
+static gboolean
+gst_lumenera_src_burst_alloc (GstLumeneraSrc * src)
+{
+	if (!gst_lumenera_src_arena_alloc (src, src->burst_frames))
+		return FALSE;
 
-	src->rgbImage = (unsigned char *)malloc(src->nWidth * src->nHeight * (src->nBytesPerPixel) * sizeof(unsigned char));
+	g_atomic_int_set (&src->burst_captured, 0);
+	src->burst_pushed = 0;
+	GST_OBJECT_LOCK (src);
+	src->burst_capture_fps = 0;
+	src->burst_push_fps = 0;
+	GST_OBJECT_UNLOCK (src);
 
-	// start freerun/continuous capture
-    src->callbackID = LucamAddStreamingCallback(src->hCam, imageCallback,  src);
-	GST_DEBUG_OBJECT (src, "LucamStreamVideoControl START_STREAMING");
-    LUEXECANDCHECK(LucamStreamVideoControl(src->hCam, START_STREAMING, NULL));
+	return TRUE;
+}
 
-	src->acq_started = TRUE;
+static inline BYTE *
+gst_lumenera_src_slot_data (GstLumeneraSrc * src, guint i)
+{
+	return src->arena->data + i * src->slot_size;
+}
+
+//
+// Slot i holds a frame just stamped, publish it and report the capture rate once the burst is complete
+//
+static void
+gst_lumenera_src_burst_store (GstLumeneraSrc * src, guint i)
+{
+	GstLumeneraSlot *slot = &src->slots[i];
+	gdouble fps = 0;
+
+	slot->arrival = g_get_monotonic_time ();
+	slot->timestamp = src->frame_timestamp;
+	slot->counter = src->frame_hw_timestamp ? src->frame_counter : src->n_frames + i;
+	slot->hw_timestamp = src->frame_hw_timestamp;
+	g_atomic_int_set (&src->burst_captured, i + 1);
+
+	if (i + 1 < src->burst_frames)
+		return;
+
+	if (i > 0 && slot->arrival > src->slots[0].arrival)
+		fps = (gdouble) i * G_USEC_PER_SEC / (slot->arrival - src->slots[0].arrival);
+	GST_OBJECT_LOCK (src);
+	src->burst_capture_fps = fps;
+	GST_OBJECT_UNLOCK (src);
+	GST_INFO_OBJECT (src, "Captured a burst of %u frames at %.1f fps", src->burst_frames, fps);
+	gst_element_post_message (GST_ELEMENT (src), gst_message_new_element (GST_OBJECT (src),
+			gst_structure_new ("lumenera-burst-captured",
+					"frames", G_TYPE_UINT, src->burst_frames,
+					"fps", G_TYPE_DOUBLE, fps,
+					"duration", G_TYPE_UINT64, (guint64) (slot->arrival - src->slots[0].arrival) * GST_USECOND,
+					NULL)));
+
+	g_mutex_lock (&src->frame_lock);
+	g_cond_signal (&src->frame_cond);
+	g_mutex_unlock (&src->frame_lock);
+}
+
+//
+// Pre-trigger ring: enough slots for pretrigger_seconds at maxframerate, empty and waiting for a trigger
+//
+static gboolean
+gst_lumenera_src_ring_alloc (GstLumeneraSrc * src)
+{
+	guint frames = (guint) (src->pretrigger_seconds * src->maxframerate) + 2;  // rounded up, plus the one being converted
+
+	if (!gst_lumenera_src_arena_alloc (src, frames))
+		return FALSE;
+
+	g_mutex_lock (&src->frame_lock);
+	src->ring_frames = frames;
+	src->ring_tail = 0;
+	src->ring_count = 0;
+	src->ring_released = FALSE;
+	src->ring_seq = 0;
+	src->ring_overruns = 0;
+	g_mutex_unlock (&src->frame_lock);
+	GST_DEBUG_OBJECT (src, "Pre-trigger ring of %u frames", frames);
 
 	return TRUE;
+}
 
-	unsupported_caps:
-	GST_ERROR_OBJECT (src, "Unsupported caps: %" GST_PTR_FORMAT, caps);
-	return FALSE;
+//
+// Slot for the next raw frame. Until the trigger the oldest frame makes way when the ring is full,
+// after it live frames must not overtake the ones still to be pushed so the new frame is dropped: -1.
+//
+static gint
+gst_lumenera_src_ring_claim (GstLumeneraSrc * src)
+{
+	gint i = -1;
+
+	g_mutex_lock (&src->frame_lock);
+	if (src->ring_count == src->ring_frames && !src->ring_released){
+		src->ring_tail = (src->ring_tail + 1) % src->ring_frames;
+		src->ring_count--;
+	}
+	if (src->ring_count < src->ring_frames)
+		i = (src->ring_tail + src->ring_count) % src->ring_frames;
+	else
+		src->ring_overruns++;
+	g_mutex_unlock (&src->frame_lock);
+
+	return i;
 }
 
-//  This can override the push class create fn, it is the same as fill above but it forces the creation of a buffer here to copy into.
-#ifdef OVERRIDE_CREATE
-static GstFlowReturn
-gst_lumenera_src_create (GstPushSrc * psrc, GstBuffer ** buf)
+//
+// Slot i holds a frame just stamped, add it to the ring
+//
+static void
+gst_lumenera_src_ring_commit (GstLumeneraSrc * src, gint i)
 {
-	GstLumeneraSrc *src = GST_LU_SRC (psrc);
-	GstMapInfo minfo;
+	GstLumeneraSlot *slot = &src->slots[i];
+
+	slot->arrival = g_get_monotonic_time ();
+	slot->timestamp = src->frame_timestamp;
+	slot->counter = src->frame_hw_timestamp ? src->frame_counter : src->ring_seq;
+	slot->hw_timestamp = src->frame_hw_timestamp;
+
+	g_mutex_lock (&src->frame_lock);
+	src->ring_seq++;
+	src->ring_count++;
+	if (src->ring_released)
+		g_cond_signal (&src->frame_cond);
+	g_mutex_unlock (&src->frame_lock);
+}
 
-	// lock next (raw) image for read access, convert it to the desired
-	// format and unlock it again, so that grabbing can go on
+//
+// Fill rows y0 to y1 of dst, nPitch bytes per row, with the negotiated output made from a raw frame
+//
+static void
+gst_lumenera_src_render_rows (GstLumeneraSrc * src, guint8 * dst, BYTE * raw, gint y0, gint y1)
+{
+	gint width = src->imageFormat.Width;
+	gsize n = (gsize) width * (y1 - y0);
+	gint i;
+
+	switch (src->output){
+	case GST_OUTPUT_BAYER:
+		if (src->nPitch == width)
+			memcpy (dst + y0 * width, raw + y0 * width, n);
+		else
+			for (i = y0; i < y1; i++)
+				memcpy (dst + i * src->nPitch, raw + i * width, width);
+		break;
+	// 16 bit frames are most significant bit aligned, the packer's shift does what LucamDataLsbAlign
+	// (Windows only) would followed by dropping the bits beyond the packed depth, in the same pass
+	case GST_OUTPUT_BAYER_PACKED10:
+		gst_lumenera_proc_pack10 (dst + y0 * src->nPitch, (const guint16 *) raw + (gsize) y0 * width, n, 16 - 10);
+		break;
+	case GST_OUTPUT_BAYER_PACKED12:
+		gst_lumenera_proc_pack12 (dst + y0 * src->nPitch, (const guint16 *) raw + (gsize) y0 * width, n, 16 - 12);
+		break;
+	case GST_OUTPUT_RGB:
+	default:
+		// The SDK only converts whole frames
+		LucamConvertFrameToRgb24Ex(src->hCam, dst, raw, &(src->imageFormat), &(src->conversionParams));
+		break;
+	}
+}
 
-	// Wait for the next image to be ready
-	//INT nRet = is_WaitEvent(src->hCam, IS_SET_EVENT_FRAME_RECEIVED, 5000);
+static void
+gst_lumenera_src_render_previews (GstLumeneraSrc * src, BYTE * raw, guint factors, gint y0, gint y1)
+{
+	gint red, blue, i;
 
-	// Release ownership to the producer to accept new image
-	src->rgbImageOwnerIsProducer = TRUE;
-	// Wait for the next image to be ready
-//	GST_DEBUG_OBJECT(src, "Wait for image.");
-	while (src->rgbImageOwnerIsProducer){
-		usleep(500);
+	// Sites (y & 1) * 2 + (x & 1) of red and blue
+	switch (src->color_format){
+	case LUCAM_CF_BAYER_GRBG:
+		red = 1; blue = 2;
+		break;
+	case LUCAM_CF_BAYER_GBRG:
+		red = 2; blue = 1;
+		break;
+	case LUCAM_CF_BAYER_BGGR:
+		red = 3; blue = 0;
+		break;
+	case LUCAM_CF_MONO:
+		red = blue = 0;
+		break;
+	case LUCAM_CF_BAYER_RGGB:
+	default:
+		red = 0; blue = 3;
+		break;
 	}
 
-//	if(G_LIKELY(nRet == IS_SUCCESS))
-	{
-		//  successfully returned an image
-		// ----------------------------------------------------------
+	for (i = 0; i < GST_LUMENERA_PREVIEW_FACTORS; i++){
+		gint factor = 2 << i;
 
-		guint i;
+		if (factors & (1 << i))
+			gst_lumenera_proc_preview (src->preview_image[i], GST_ROUND_UP_4 (src->imageFormat.Width / factor * 3), raw,
+					src->imageFormat.PixelFormat == LUCAM_PF_16, src->imageFormat.Width, y0, y1, factor, red, blue);
+	}
+}
 
-//		LucamGpioWrite(src->hCam, 0);
+//
+// Convert raw into dst in the output format, and bin it into the previews some pad wants. The Bayer outputs
+// are done in bands of rows, each binned while it is still in cache, the SDK's RGB conversion only does
+// whole frames so the previews follow it.
+//
+static void
+gst_lumenera_src_render (GstLumeneraSrc * src, guint8 * dst, BYTE * raw)
+{
+	guint factors = (guint) g_atomic_int_get (&src->preview_factors);
+	gint height = src->imageFormat.Height;
+	gint y;
+
+	if (!factors || src->output == GST_OUTPUT_RGB){
+		gst_lumenera_src_render_rows (src, dst, raw, 0, height);
+		if (factors)
+			gst_lumenera_src_render_previews (src, raw, factors, 0, height);
+	}
+	else {
+		for (y = 0; y < height; y += LU_PREVIEW_BAND){
+			gint y1 = MIN (y + LU_PREVIEW_BAND, height);
 
-		// Copy image to buffer in the right way
+			gst_lumenera_src_render_rows (src, dst, raw, y, y1);
+			gst_lumenera_src_render_previews (src, raw, factors, y, y1);
+		}
+	}
+	src->preview_ready = factors;
+}
+
+//
+// Forward the end of the main stream to the preview pads
+//
+static GstPadProbeReturn
+gst_lumenera_src_main_event_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (user_data);
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+	GList *pads, *l;
 
-		// Create a new buffer for the image
-		*buf = gst_buffer_new_and_alloc (src->nHeight * src->gst_stride);
+	if (GST_EVENT_TYPE (event) != GST_EVENT_EOS)
+		return GST_PAD_PROBE_OK;
 
-		gst_buffer_map (*buf, &minfo, GST_MAP_WRITE);
+	GST_OBJECT_LOCK (src);
+	pads = g_list_copy_deep (src->previews, (GCopyFunc) gst_object_ref, NULL);
+	GST_OBJECT_UNLOCK (src);
+	for (l = pads; l; l = l->next)
+		gst_pad_push_event (GST_PAD (l->data), gst_event_new_eos ());
+	g_list_free_full (pads, gst_object_unref);
+
+	return GST_PAD_PROBE_OK;
+}
+
+//
+// Latency is the main pad's, the rest is the default
+//
+static gboolean
+gst_lumenera_src_preview_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+	if (GST_QUERY_TYPE (query) == GST_QUERY_LATENCY)
+		return gst_pad_query (GST_BASE_SRC_PAD (parent), query);
+
+	return gst_pad_query_default (pad, parent, query);
+}
+
+static GstPad *
+gst_lumenera_src_request_new_pad (GstElement * element, GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (element);
+	GstPad *pad;
+	gchar *pad_name;
+
+	GST_OBJECT_LOCK (src);
+	pad_name = name ? g_strdup (name) : g_strdup_printf ("preview_%u", src->preview_next);
+	src->preview_next++;
+	GST_OBJECT_UNLOCK (src);
+
+	pad = gst_pad_new_from_template (templ, pad_name);
+	g_free (pad_name);
+	gst_pad_set_query_function (pad, gst_lumenera_src_preview_query);
+	g_object_set_qdata_full (G_OBJECT (pad), preview_quark, g_new0 (GstLumeneraPreview, 1), g_free);
+
+	GST_OBJECT_LOCK (src);
+	src->previews = g_list_append (src->previews, gst_object_ref (pad));
+	GST_OBJECT_UNLOCK (src);
+
+	// Activated here when already PAUSED or PLAYING, otherwise with the element
+	if (!gst_element_add_pad (element, pad)){
+		gst_lumenera_src_release_pad (element, pad);
+		return NULL;
+	}
+	GST_DEBUG_OBJECT (src, "Added %s", GST_PAD_NAME (pad));
+
+	return pad;
+}
+
+static void
+gst_lumenera_src_release_pad (GstElement * element, GstPad * pad)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (element);
+	GList *l;
+
+	GST_OBJECT_LOCK (src);
+	l = g_list_find (src->previews, pad);
+	if (l)
+		src->previews = g_list_delete_link (src->previews, l);
+	GST_OBJECT_UNLOCK (src);
+	if (!l)
+		return;
+
+	// Binned only for the pads left, from the next frame create pushes
+	GST_DEBUG_OBJECT (src, "Releasing %s", GST_PAD_NAME (pad));
+	gst_pad_set_active (pad, FALSE);
+	if (GST_OBJECT_PARENT (pad) == GST_OBJECT (element))
+		gst_element_remove_pad (element, pad);
+	gst_object_unref (pad);
+}
+
+//
+// Offer downstream of a preview pad the binned sizes, a quarter first, and take what it picks
+//
+static void
+gst_lumenera_src_preview_negotiate (GstLumeneraSrc * src, GstPad * pad, GstLumeneraPreview * preview)
+{
+	static const gint order[] = { 4, 2, 8 };
+	gint width = src->imageFormat.Width, height = src->imageFormat.Height;
+	GstCaps *offer = gst_caps_new_empty ();
+	GstCaps *caps;
+	guint i;
+	gint fixed;
 
-		// From the grabber source we get 1 progressive frame
-		// We expect src->nPitch = src->gst_stride but use separate vars for safety
-		//GST_DEBUG_OBJECT(src, "Copy image. %d %d", src->gst_stride, src->nPitch);
-		for (i = 0; i < src->nHeight; i++) {
-			memcpy (minfo.data + i * src->gst_stride,
-					src->rgbImage + i * src->nPitch, src->nPitch);
+	preview->factor = 0;
+	preview->raw_width = width;
+	preview->raw_height = height;
+
+	if (!preview->started){
+		gchar *stream_id = gst_pad_create_stream_id (pad, GST_ELEMENT (src), GST_PAD_NAME (pad));
+
+		gst_pad_push_event (pad, gst_event_new_stream_start (stream_id));
+		g_free (stream_id);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (order); i++)
+		if (width / order[i] > 0 && height / order[i] > 0)
+			gst_caps_append_structure (offer, gst_structure_new ("video/x-raw",
+					"format", G_TYPE_STRING, "RGB",
+					"width", G_TYPE_INT, width / order[i],
+					"height", G_TYPE_INT, height / order[i],
+					"framerate", GST_TYPE_FRACTION, 0, 1,
+					NULL));
+	caps = gst_pad_peer_query_caps (pad, offer);
+	gst_caps_unref (offer);
+	if (gst_caps_is_empty (caps)){
+		GST_WARNING_OBJECT (src, "Downstream of %s takes none of the preview sizes %dx%d, %dx%d or %dx%d", GST_PAD_NAME (pad),
+				width / 4, height / 4, width / 2, height / 2, width / 8, height / 8);
+		gst_caps_unref (caps);
+		return;
+	}
+	caps = gst_caps_fixate (caps);
+	gst_structure_get_int (gst_caps_get_structure (caps, 0), "width", &fixed);
+	preview->factor = width / fixed;
+	gst_pad_push_event (pad, gst_event_new_caps (caps));
+	gst_caps_unref (caps);
+
+	// The main pad's segment, so both streams have the same running time
+	if (!preview->started){
+		GstEvent *segment = gst_pad_get_sticky_event (GST_BASE_SRC_PAD (src), GST_EVENT_SEGMENT, 0);
+
+		if (!segment){
+			GstSegment seg;
+
+			gst_segment_init (&seg, GST_FORMAT_TIME);
+			segment = gst_event_new_segment (&seg);
 		}
+		gst_pad_push_event (pad, segment);
+		preview->started = TRUE;
+	}
 
-		gst_buffer_unmap (*buf, &minfo);
+	GST_DEBUG_OBJECT (src, "%s is binned %u times", GST_PAD_NAME (pad), preview->factor);
+}
+
+//
+// Push the previews binned with buf's frame, with its timestamps and meta, and note which factors the pads want
+// for the next frames. Allocated here, so the converting thread never sees a factor without its image.
+//
+static void
+gst_lumenera_src_push_previews (GstLumeneraSrc * src, GstBuffer * buf)
+{
+	GList *pads, *l;
+	guint factors = 0;
+
+	GST_OBJECT_LOCK (src);
+	pads = g_list_copy_deep (src->previews, (GCopyFunc) gst_object_ref, NULL);
+	GST_OBJECT_UNLOCK (src);
+
+	// do-timestamp stamps buf after create returns, too late for the previews. Stamp it now with the running
+	// time basesrc would have used, which it then keeps.
+	if (pads && gst_base_src_get_do_timestamp (GST_BASE_SRC (src)) && !GST_BUFFER_PTS_IS_VALID (buf)){
+		GstClock *clock = gst_element_get_clock (GST_ELEMENT (src));
+
+		if (clock){
+			GstClockTime running_time = gst_clock_get_time (clock) - gst_element_get_base_time (GST_ELEMENT (src));
 
-		// If we do not use gst_base_src_set_do_timestamp() we need to add timestamps manually
-		src->last_frame_time += src->duration;   // Get the timestamp for this frame
-		if(!gst_base_src_get_do_timestamp(GST_BASE_SRC(psrc))){
-			GST_BUFFER_PTS(*buf) = src->last_frame_time;  // convert ms to ns
-			GST_BUFFER_DTS(*buf) = src->last_frame_time;  // convert ms to ns
+			GST_BUFFER_PTS(buf) = running_time;
+			GST_BUFFER_DTS(buf) = running_time;
+			gst_object_unref (clock);
 		}
-		GST_BUFFER_DURATION(*buf) = src->duration;
-//		GST_DEBUG_OBJECT(src, "pts, dts: %" GST_TIME_FORMAT ", duration: %d ms", GST_TIME_ARGS (src->last_frame_time), GST_TIME_AS_MSECONDS(src->duration));
+	}
+
+	for (l = pads; l; l = l->next){
+		GstPad *pad = GST_PAD (l->data);
+		GstLumeneraPreview *preview = g_object_get_qdata (G_OBJECT (pad), preview_quark);
+		gint height, i;
+		gsize size;
+		GstBuffer *pbuf;
+		GstFlowReturn ret;
+
+		if (gst_pad_check_reconfigure (pad) || preview->raw_width != src->imageFormat.Width
+				|| preview->raw_height != src->imageFormat.Height)
+			gst_lumenera_src_preview_negotiate (src, pad, preview);
+		if (!preview->factor)
+			continue;
+
+		i = g_bit_nth_lsf (preview->factor, -1) - 1;
+		height = src->imageFormat.Height / preview->factor;
+		size = (gsize) GST_ROUND_UP_4 (src->imageFormat.Width / preview->factor * 3) * height;  // RGB rows are 4 byte aligned
+		if (!src->preview_image[i])
+			src->preview_image[i] = g_malloc0 (size);
+		factors |= 1 << i;
+		if (!(src->preview_ready & (1 << i)))
+			continue;  // wanted from the next frame
+
+		pbuf = gst_buffer_new_allocate (NULL, size, NULL);
+		gst_buffer_fill (pbuf, 0, src->preview_image[i], size);
+		gst_buffer_copy_into (pbuf, buf, GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META, 0, -1);
+		ret = gst_pad_push (pad, pbuf);
+		if (ret != GST_FLOW_OK && ret != GST_FLOW_NOT_LINKED && ret != GST_FLOW_FLUSHING)
+			GST_DEBUG_OBJECT (src, "Pushing on %s: %s", GST_PAD_NAME (pad), gst_flow_get_name (ret));
+	}
+	g_atomic_int_set (&src->preview_factors, factors);
+
+	g_list_free_full (pads, gst_object_unref);
+}
+
+//
+// Called for each camera frame as it arrives, TRUE if it is to be dropped by decimate or output-framerate.
+// The first frame is always kept. output-framerate keeps a frame whenever a whole output frame is owed,
+// at the camera's current rate, so 5 fps from 27 fps keeps one in 5 or 6.
+//
+static gboolean
+gst_lumenera_src_decimate (GstLumeneraSrc * src)
+{
+	gint n = src->output_framerate_n, d = src->output_framerate_d;
+	gboolean skip;
+
+	if (n > 0 && d > 0){
+		gdouble rate = MAX (src->framerate, 1.0);
+
+		src->dec_phase = MIN (src->dec_phase + (gdouble) n / d, 2 * rate);
+		skip = (src->dec_phase < rate);
+		if (!skip)
+			src->dec_phase -= rate;
+	}
+	else {
+		skip = (src->dec_count != 0);
+		src->dec_count = (src->dec_count + 1) % MAX (src->decimate, 1);
+	}
+
+	if (skip){
+		src->dec_pending++;
+		src->n_decimated++;
+	}
+	return skip;
+}
+
+//
+// A frame gst_lumenera_src_decimate kept was dropped after all: it joins the span of the next frame,
+// which is kept in its place
+//
+static inline void
+gst_lumenera_src_decimate_requeue (GstLumeneraSrc * src)
+{
+	src->dec_pending++;
+	if (src->output_framerate_n > 0 && src->output_framerate_d > 0)
+		src->dec_phase += MAX (src->framerate, 1.0);
+	else
+		src->dec_count = 0;
+}
+
+//
+// The frames skipped before the frame being converted, which it stands in for
+//
+static inline void
+gst_lumenera_src_decimate_take_span (GstLumeneraSrc * src)
+{
+	src->dec_span = src->dec_pending;
+	src->dec_pending = 0;
+}
+
+//
+// Called when an image is received from the camera image stream
+//
+VOID imageCallback(VOID *pContext, BYTE *pData, ULONG dataLength)
+{
+	GstLumeneraSrc *src = (GstLumeneraSrc *)pContext;
+
+	guint generation;
+	gint64 t0;
+
+	gst_lumenera_src_schedule_capture (src, &src->callback_thread, &src->callback_sched, NULL, "callback");
+
+	// Paused, keep the stream warm but do not spend time converting
+	if (!src->playing) {
+		src->n_discarded++;
+		return;
+	}
+
+	// Pre-trigger, just keep the raw frame in the ring for create
+	if (src->ring_frames) {
+		gint i = gst_lumenera_src_ring_claim (src);
+
+		if (i >= 0) {
+			memcpy (gst_lumenera_src_slot_data (src, i), pData, src->imageFormat.ImageSize);
+			gst_lumenera_src_stamp_frame (src, pData);
+			gst_lumenera_src_ring_commit (src, i);
+		}
+		return;
+	}
+
+	// Burst, just keep the raw frame until the arena is full
+	if (src->arena) {
+		guint i = g_atomic_int_get (&src->burst_captured);
+
+		if (i < src->burst_frames) {
+			memcpy (gst_lumenera_src_slot_data (src, i), pData, src->imageFormat.ImageSize);
+			gst_lumenera_src_stamp_frame (src, pData);
+			gst_lumenera_src_burst_store (src, i);
+		}
+		return;
+	}
+
+	// Not wanted at the output rate, drop it before it costs anything
+	if (gst_lumenera_src_decimate (src))
+		return;
+
+	// Consumer of this object still needs the rgb image?
+	// Drop this frame then, the next one covers its time
+	if (!src->rgbImageOwnerIsProducer) {
+		gst_lumenera_src_decimate_requeue (src);
+		return;
+	}
+
+	//GST_DEBUG_OBJECT(src, "imageCallback called.");
+
+	generation = src->stream_generation;
+	gst_lumenera_src_stamp_frame (src, pData);
+	t0 = g_get_monotonic_time ();
+	pData = gst_lumenera_src_process_raw (src, pData);
+	if (!pData)
+		return;  // accumulating, nothing to hand over yet
+	gst_lumenera_src_decimate_take_span (src);
+	gst_lumenera_src_render (src, src->rgbImage, pData);
+	src->conversion_time = (g_get_monotonic_time () - t0) * GST_USECOND;
+	//memset(src->rgbImage, 100, src->nHeight*src->nWidth*src->nBytesPerPixel);  // TEST line to see if LucamConvertFrameToRgb24Ex was taking a lot of time
+
+	// Transfer ownership to consumer, unless we were paused while converting
+	g_mutex_lock (&src->frame_lock);
+	if (generation == src->stream_generation) {
+		src->rgbImageOwnerIsProducer = FALSE;
+		src->rgbImageFresh = TRUE;
+		g_cond_signal (&src->frame_cond);
+	}
+	g_mutex_unlock (&src->frame_lock);
+}
+
+//
+// Count a frame timeout and tell the application, called without the frame lock held
+//
+static void
+gst_lumenera_src_frame_timeout (GstLumeneraSrc * src)
+{
+	src->total_timeouts++;
+	GST_ELEMENT_WARNING (src, RESOURCE, READ, ("No frame received from the camera for %u ms.", src->timeout),
+			("%d timeouts so far", src->total_timeouts));
+}
+
+//
+// Callback capture engine: hand rgbImage to the producer and wait until imageCallback has filled it.
+// The wait is woken by unlock.
+//
+static GstFlowReturn
+gst_lumenera_src_wait_frame (GstLumeneraSrc * src)
+{
+	gint64 end_time;
+	gboolean flushing;
+
+	g_mutex_lock (&src->frame_lock);
+	// Release ownership to the producer to accept new image, unless it was armed on resume and already has one
+	if (!src->rgbImageFresh)
+		src->rgbImageOwnerIsProducer = TRUE;
+	end_time = g_get_monotonic_time () + src->timeout * (G_USEC_PER_SEC / 1000);
+	while (src->rgbImageOwnerIsProducer && !src->flushing){
+		if (!g_cond_wait_until (&src->frame_cond, &src->frame_lock, end_time)){
+			g_mutex_unlock (&src->frame_lock);
+			gst_lumenera_src_frame_timeout (src);
+			g_mutex_lock (&src->frame_lock);
+			end_time = g_get_monotonic_time () + src->timeout * (G_USEC_PER_SEC / 1000);
+		}
+	}
+	flushing = src->flushing;
+	if (!flushing)
+		src->rgbImageFresh = FALSE;  // ours until the next call re-arms the producer
+	g_mutex_unlock (&src->frame_lock);
+
+	return flushing ? GST_FLOW_FLUSHING : GST_FLOW_OK;
+}
+
+//
+// Pull capture engine: take the next streamed raw frame into raw on the streaming thread.
+// Conversion is left to the caller so it can go straight into the output buffer.
+//
+static GstFlowReturn
+gst_lumenera_src_take_video (GstLumeneraSrc * src, BYTE * raw)
+{
+	ULONG length;
+	guint waited = 0;
+
+	for (;;) {
+		if (src->flushing)
+			return GST_FLOW_FLUSHING;
+
+		length = src->imageFormat.ImageSize;
+		if (LucamTakeVideoEx(src->hCam, raw, &length, MIN(src->timeout, LU_TAKE_VIDEO_SLICE_MS))){
+			gst_lumenera_src_stamp_frame (src, raw);
+			break;
+		}
+
+		waited += MIN(src->timeout, LU_TAKE_VIDEO_SLICE_MS);
+		if (waited >= src->timeout){
+			GST_DEBUG_OBJECT (src, "LucamTakeVideoEx failed with: %d (see lucamerr.h)", LucamGetLastError());
+			gst_lumenera_src_frame_timeout (src);
+			waited = 0;
+		}
+	}
+
+	return GST_FLOW_OK;
+}
+
+//
+// Burst capture: the next frame to convert, once the whole burst is in the arena. The callback engine
+// fills it meanwhile, the pull engine fills it here. EOS after the last frame has been pushed.
+//
+static GstFlowReturn
+gst_lumenera_src_burst_next (GstLumeneraSrc * src, BYTE ** frame)
+{
+	GstLumeneraSlot *slot;
+
+	do {
+		guint captured = g_atomic_int_get (&src->burst_captured);
+
+		if (src->burst_pushed >= src->burst_frames){
+			gdouble fps = 0;
+			gint64 elapsed = g_get_monotonic_time () - src->burst_push_start;
+
+			if (src->burst_pushed == src->burst_frames){
+				if (elapsed > 0)
+					fps = (gdouble) src->burst_frames * G_USEC_PER_SEC / elapsed;
+				GST_OBJECT_LOCK (src);
+				src->burst_push_fps = fps;
+				GST_OBJECT_UNLOCK (src);
+				GST_INFO_OBJECT (src, "Pushed a burst of %u frames at %.1f fps", src->burst_frames, fps);
+				gst_element_post_message (GST_ELEMENT (src), gst_message_new_element (GST_OBJECT (src),
+						gst_structure_new ("lumenera-burst-pushed",
+								"frames", G_TYPE_UINT, src->burst_frames,
+								"fps", G_TYPE_DOUBLE, fps,
+								NULL)));
+				src->burst_pushed++;  // report once
+			}
+			return GST_FLOW_EOS;
+		}
+
+		if (src->captureengine == GST_ENGINE_PULL){
+			for (; captured < src->burst_frames; captured++){
+				GstFlowReturn ret = gst_lumenera_src_take_video (src, gst_lumenera_src_slot_data (src, captured));
+				if (ret != GST_FLOW_OK)
+					return ret;
+				gst_lumenera_src_burst_store (src, captured);
+			}
+		}
+		else if (captured < src->burst_frames){
+			gboolean flushing;
+
+			g_mutex_lock (&src->frame_lock);
+			while (g_atomic_int_get (&src->burst_captured) < src->burst_frames && !src->flushing){
+				gint64 end_time = g_get_monotonic_time () + src->timeout * (G_USEC_PER_SEC / 1000);
+
+				if (!g_cond_wait_until (&src->frame_cond, &src->frame_lock, end_time)
+						&& g_atomic_int_get (&src->burst_captured) == captured){
+					g_mutex_unlock (&src->frame_lock);
+					gst_lumenera_src_frame_timeout (src);
+					g_mutex_lock (&src->frame_lock);
+				}
+				captured = g_atomic_int_get (&src->burst_captured);
+			}
+			flushing = src->flushing;
+			g_mutex_unlock (&src->frame_lock);
+			if (flushing)
+				return GST_FLOW_FLUSHING;
+		}
+
+		if (src->burst_pushed == 0)
+			src->burst_push_start = g_get_monotonic_time ();
+		slot = &src->slots[src->burst_pushed];
+		src->frame_timestamp = slot->timestamp;
+		src->frame_counter = slot->counter;
+		src->frame_hw_timestamp = slot->hw_timestamp;
+		src->burst_offset = (slot->arrival - src->slots[0].arrival) * GST_USECOND;
+		*frame = gst_lumenera_src_process_raw (src, gst_lumenera_src_slot_data (src, src->burst_pushed++));
+	} while (!*frame);  // accumulating
+
+	return GST_FLOW_OK;
+}
+
+//
+// The frame taken by gst_lumenera_src_ring_next has been converted, free its slot
+//
+static void
+gst_lumenera_src_ring_done (GstLumeneraSrc * src)
+{
+	g_mutex_lock (&src->frame_lock);
+	src->ring_tail = (src->ring_tail + 1) % src->ring_frames;
+	src->ring_count--;
+	g_mutex_unlock (&src->frame_lock);
+}
+
+//
+// Pre-trigger ring: the oldest frame, converted, once a trigger has released the ring. The pull engine
+// keeps filling the ring here until then. The slot stays held until gst_lumenera_src_ring_done.
+//
+static GstFlowReturn
+gst_lumenera_src_ring_next (GstLumeneraSrc * src, BYTE ** frame)
+{
+	for (;;) {
+		GstLumeneraSlot *slot;
+		gboolean ready;
+		guint i;
+
+		g_mutex_lock (&src->frame_lock);
+		// Waiting for the trigger is normal, however long it takes
+		if (src->captureengine == GST_ENGINE_CALLBACK)
+			while (!(src->ring_released && src->ring_count) && !src->flushing)
+				g_cond_wait (&src->frame_cond, &src->frame_lock);
+		if (src->flushing){
+			g_mutex_unlock (&src->frame_lock);
+			return GST_FLOW_FLUSHING;
+		}
+		ready = (src->ring_released && src->ring_count);
+		i = src->ring_tail;
+		g_mutex_unlock (&src->frame_lock);
+
+		if (!ready){
+			gint j = gst_lumenera_src_ring_claim (src);  // never full here
+			GstFlowReturn ret = gst_lumenera_src_take_video (src, gst_lumenera_src_slot_data (src, j));
+			if (ret != GST_FLOW_OK)
+				return ret;
+			gst_lumenera_src_ring_commit (src, j);
+			continue;
+		}
+
+		slot = &src->slots[i];
+		src->frame_timestamp = slot->timestamp;
+		src->frame_counter = slot->counter;
+		src->frame_hw_timestamp = slot->hw_timestamp;
+		src->ring_arrival = slot->arrival;
+		*frame = gst_lumenera_src_process_raw (src, gst_lumenera_src_slot_data (src, i));
+		if (*frame)
+			return GST_FLOW_OK;
+		gst_lumenera_src_ring_done (src);  // accumulating
+	}
+}
+
+//
+// Release the pre-trigger ring, from a trigger in free-run mode. Frames older than pretrigger_seconds
+// are dropped, the ring is sized for maxframerate and may hold more at lower rates.
+//
+static gboolean
+gst_lumenera_src_ring_release (GstLumeneraSrc * src)
+{
+	gint64 oldest = g_get_monotonic_time () - (gint64) (src->pretrigger_seconds * G_USEC_PER_SEC);
+	gboolean released = FALSE;
+	guint frames = 0;
+
+	g_mutex_lock (&src->frame_lock);
+	if (src->ring_frames && !src->ring_released){
+		while (src->ring_count && src->slots[src->ring_tail].arrival < oldest){
+			src->ring_tail = (src->ring_tail + 1) % src->ring_frames;
+			src->ring_count--;
+		}
+		src->ring_released = released = TRUE;
+		frames = src->ring_count;
+		g_cond_signal (&src->frame_cond);
+	}
+	g_mutex_unlock (&src->frame_lock);
+
+	GST_OBJECT_LOCK (src);
+	if (released)
+		src->n_triggers++;
+	else
+		src->n_triggers_ignored++;
+	GST_OBJECT_UNLOCK (src);
+
+	if (released){
+		GST_INFO_OBJECT (src, "Pre-trigger ring released with %u frames", frames);
+		gst_element_post_message (GST_ELEMENT (src), gst_message_new_element (GST_OBJECT (src),
+				gst_structure_new ("lumenera-pretrigger-released",
+						"frames", G_TYPE_UINT, frames,
+						NULL)));
+	}
+	else
+		GST_WARNING_OBJECT (src, "Trigger ignored, the pre-trigger frames have already been released");
+
+	return released;
+}
+
+//
+// Put the camera into fast frame (snapshot) mode for triggered capture.
+// The snapshot uses the current exposure and gains.
+//
+static gboolean
+gst_lumenera_src_enable_fast_frames (GstLumeneraSrc * src)
+{
+	LUCAM_SNAPSHOT *snapshot = &(src->snapshot);
+
+	memset(snapshot, 0, sizeof(LUCAM_SNAPSHOT));
+	snapshot->exposure = src->exposure;
+	snapshot->gain = src->cam_min_gain + src->gain/100.0*(src->cam_max_gain-src->cam_min_gain);
+	snapshot->gainRed = src->rgain;
+	snapshot->gainBlue = src->bgain;
+	snapshot->gainGrn1 = src->ggain;
+	snapshot->gainGrn2 = src->ggain;
+	snapshot->useStrobe = FALSE;
+	snapshot->strobeDelay = 0;
+	snapshot->useHwTrigger = (src->triggermode == GST_TRIGGER_HARDWARE);
+	// A hardware trigger is waited for in slices, so a cancel missed by unlock only holds it up for one slice
+	snapshot->timeout = (src->triggermode == GST_TRIGGER_HARDWARE) ? MIN(src->timeout, LU_TAKE_VIDEO_SLICE_MS) : src->timeout;
+	snapshot->format = src->frameFormat;
+	snapshot->shutterType = 0;
+	snapshot->exposureDelay = 0;
+	snapshot->bufferlastframe = FALSE;
+
+	if (src->triggermode == GST_TRIGGER_HARDWARE){
+		GST_DEBUG_OBJECT (src, "LucamSetProperty TRIGGER_PIN %d", src->triggerpin);
+		LUEXECANDCHECK(LucamSetProperty(src->hCam, LUCAM_PROP_TRIGGER_PIN, src->triggerpin, 0));
+	}
+
+	GST_DEBUG_OBJECT (src, "LucamEnableFastFrames, hardware trigger %d", snapshot->useHwTrigger);
+	if (!LucamEnableFastFrames(src->hCam, snapshot)){
+		GST_ERROR_OBJECT(src, "LucamEnableFastFrames failed with: %d (see lucamerr.h)", LucamGetLastError());
+		return FALSE;
+	}
+	// unlock picks the SDK call to cancel from this, under the same lock
+	g_mutex_lock (&src->frame_lock);
+	src->fastFramesEnabled = TRUE;
+	g_mutex_unlock (&src->frame_lock);
+
+	// Snapshots may have a different layout to the video stream
+	LUEXECANDCHECK(LucamGetStillImageFormat (src->hCam, &(src->imageFormat)));
+	GST_DEBUG_OBJECT (src, "still imageFormat: w %d h%d ImageSize %d", src->imageFormat.Width, src->imageFormat.Height, src->imageFormat.ImageSize);
+
+	return TRUE;
+}
+
+//
+// Called on the streaming thread in triggered mode, blocks until a triggered frame
+// has been received into rawImage and converted into rgbImage.
+//
+static GstFlowReturn
+gst_lumenera_src_take_fast_frame (GstLumeneraSrc * src)
+{
+	BOOL ok;
+	gint64 t0;
+	guint waited = 0;
+
+	for (;;) {
+		if (src->triggermode == GST_TRIGGER_SOFTWARE) {
+			// The frame was requested by LucamTriggerFastFrame when the trigger fired, collect it
+			g_mutex_lock (&src->frame_lock);
+			while (!src->trigger_pending && !src->flushing)
+				g_cond_wait (&src->frame_cond, &src->frame_lock);
+			g_mutex_unlock (&src->frame_lock);
+			if (src->flushing)
+				return GST_FLOW_FLUSHING;
+
+			ok = LucamTakeFastFrameNoTrigger(src->hCam, src->rawImage);
+
+			g_mutex_lock (&src->frame_lock);
+			src->trigger_pending = FALSE;
+			g_mutex_unlock (&src->frame_lock);
+		}
+		else {
+			// Blocks until the hardware trigger arrives, a slice of the snapshot timeout expires or unlock
+			// cancels it. We do not know when the pin changed, so latency is measured from frame arrival.
+			if (src->flushing)
+				return GST_FLOW_FLUSHING;
+			ok = LucamTakeFastFrame(src->hCam, src->rawImage);
+			src->trigger_time = g_get_monotonic_time ();
+			if (ok) {
+				GST_OBJECT_LOCK (src);
+				src->n_triggers++;
+				GST_OBJECT_UNLOCK (src);
+			}
+			else {
+				waited += src->snapshot.timeout;
+				if (waited < src->timeout)
+					continue;
+				waited = 0;
+			}
+		}
+
+		if (ok){
+			gst_lumenera_src_stamp_frame (src, src->rawImage);
+			t0 = g_get_monotonic_time ();
+			if (gst_lumenera_src_process_raw (src, src->rawImage))
+				break;
+			continue;  // accumulating, take the next triggered frame
+		}
+
+		// Waiting a long time for a trigger is normal, so no warning here
+		GST_DEBUG_OBJECT (src, "No triggered frame received: %d (see lucamerr.h)", LucamGetLastError());
+		src->total_timeouts++;
+	}
+
+	gst_lumenera_src_render (src, src->rgbImage, src->rawImage);
+	src->conversion_time = (g_get_monotonic_time () - t0) * GST_USECOND;
+
+	return GST_FLOW_OK;
+}
+
+//
+// Fire a software trigger, from the trigger action signal or a lumenera-trigger upstream event
+//
+static gboolean
+gst_lumenera_src_trigger (GstLumeneraSrc * src)
+{
+	gboolean fired = FALSE;
+
+	if (src->triggermode == GST_TRIGGER_FREE_RUN && src->ring_frames)
+		return gst_lumenera_src_ring_release (src);
+
+	g_mutex_lock (&src->frame_lock);
+	if (src->triggermode != GST_TRIGGER_SOFTWARE || !src->fastFramesEnabled) {
+		g_mutex_unlock (&src->frame_lock);
+		GST_WARNING_OBJECT (src, "Software trigger ignored, trigger-mode is not software or capture has not started");
+		return FALSE;
+	}
+
+	if (!src->trigger_pending) {
+		src->trigger_time = g_get_monotonic_time ();
+		fired = LucamTriggerFastFrame(src->hCam);
+		if (fired) {
+			src->trigger_pending = TRUE;
+			g_cond_signal (&src->frame_cond);
+		}
+		else
+			GST_ERROR_OBJECT(src, "LucamTriggerFastFrame failed with: %d (see lucamerr.h)", LucamGetLastError());
+	}
+	g_mutex_unlock (&src->frame_lock);
+
+	GST_OBJECT_LOCK (src);
+	if (fired)
+		src->n_triggers++;
+	else
+		src->n_triggers_ignored++;
+	GST_OBJECT_UNLOCK (src);
+
+	return fired;
+}
+
+//
+// Wake up the streaming thread, wherever it is waiting, so state changes and flushes never hang in create
+//
+static gboolean
+gst_lumenera_src_unlock (GstBaseSrc * bsrc)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (bsrc);
+	gboolean fast_frames;
+
+	GST_DEBUG_OBJECT (src, "unlock");
+
+	g_mutex_lock (&src->frame_lock);
+	src->flushing = TRUE;
+	fast_frames = src->fastFramesEnabled;
+	g_cond_broadcast (&src->frame_cond);
+	g_mutex_unlock (&src->frame_lock);
+
+	// Blocking SDK calls on the streaming thread
+	if (src->hCam){
+		if (fast_frames)
+			LucamCancelTakeFastFrame(src->hCam);
+		else if (src->captureengine == GST_ENGINE_PULL)
+			LucamCancelTakeVideo(src->hCam);
+	}
+
+	return TRUE;
+}
+
+static gboolean
+gst_lumenera_src_unlock_stop (GstBaseSrc * bsrc)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (bsrc);
+
+	GST_DEBUG_OBJECT (src, "unlock_stop");
+
+	g_mutex_lock (&src->frame_lock);
+	src->flushing = FALSE;
+	g_mutex_unlock (&src->frame_lock);
+
+	return TRUE;
+}
+
+//
+// Called from set_property on the application thread. The published slot is copied into
+// the spare one, updated and then published, so the streaming thread always sees a
+// complete set of settings. Writers are serialised by params_lock, the reader never locks.
+//
+static void
+gst_lumenera_src_publish_params (GstLumeneraSrc * src, guint property_id, gfloat value)
+{
+	GstLumeneraParams *cur, *next;
+
+	g_mutex_lock (&src->params_lock);
+	cur = src->params_current;
+	next = (cur == &src->params[0]) ? &src->params[1] : &src->params[0];
+
+	// The streaming thread may still be copying the spare slot, mark it invalid while we write
+	g_atomic_int_set (&next->generation, 0);
+	next->exposure = cur->exposure;
+	next->gain = cur->gain;
+	next->rgain = cur->rgain;
+	next->ggain = cur->ggain;
+	next->bgain = cur->bgain;
+
+	switch (property_id) {
+	case PROP_EXPOSURE:
+		next->exposure = value;
+		break;
+	case PROP_GAIN:
+		next->gain = value;
+		break;
+	case PROP_RGAIN:
+		next->rgain = value;
+		break;
+	case PROP_GGAIN:
+		next->ggain = value;
+		break;
+	case PROP_BGAIN:
+		next->bgain = value;
+		break;
+	default:
+		break;
+	}
+
+	g_atomic_int_set (&next->generation, ++src->params_generation);
+	g_atomic_pointer_set (&src->params_current, next);
+	g_mutex_unlock (&src->params_lock);
+
+	// Read back as set until the poll after they are applied has what the camera took
+	GST_OBJECT_LOCK (src);
+	if (src->shadow_valid){
+		switch (property_id) {
+		case PROP_EXPOSURE:
+			src->shadow.exposure = value;
+			break;
+		case PROP_GAIN:
+			src->shadow.gain = value;
+			break;
+		case PROP_RGAIN:
+			src->shadow.rgain = value;
+			break;
+		case PROP_GGAIN:
+			src->shadow.ggain = value;
+			break;
+		case PROP_BGAIN:
+			src->shadow.bgain = value;
+			break;
+		default:
+			break;
+		}
+	}
+	GST_OBJECT_UNLOCK (src);
+
+	// Nothing is streaming without a camera, keep the local copies up to date for get_property
+	if (!src->hCam)
+		gst_lumenera_src_apply_params (src, FALSE);
+}
+
+//
+// Called on the streaming thread at a frame boundary (and from start/stop when nothing is streaming).
+// Takes a consistent snapshot of the published settings and, if they changed, sends the ones that
+// differ from the last snapshot sent (all of them if force) to the camera before the next frame is
+// taken. Returns TRUE if settings were applied.
+//
+static gboolean
+gst_lumenera_src_apply_params (GstLumeneraSrc * src, gboolean force)
+{
+	GstLumeneraParams *p, snap, *sent = &src->params_sent;
+	gint generation;
+
+	// Lock free read, retry if a writer reused the slot while we copied it
+	do {
+		p = g_atomic_pointer_get (&src->params_current);
+		generation = g_atomic_int_get (&p->generation);
+		snap.exposure = p->exposure;
+		snap.gain = p->gain;
+		snap.rgain = p->rgain;
+		snap.ggain = p->ggain;
+		snap.bgain = p->bgain;
+	} while (generation == 0 || g_atomic_int_get (&p->generation) != generation
+			|| g_atomic_pointer_get (&src->params_current) != p);
+
+	if (!force && generation == src->params_applied)
+		return FALSE;
+
+	src->exposure = snap.exposure;
+	src->gain = snap.gain;
+	src->rgain = snap.rgain;
+	src->ggain = snap.ggain;
+	src->bgain = snap.bgain;
+	g_atomic_int_set (&src->params_applied, generation);
+
+	if (!src->hCam)
+		return FALSE;
+
+	GST_DEBUG_OBJECT (src, "Apply settings generation %d: exposure %.2f gain %.0f%% R %f G %f B %f",
+			generation, src->exposure, src->gain, src->rgain, src->ggain, src->bgain);
+
+	force = force || !src->params_sent_valid;
+	if (!force && snap.exposure == sent->exposure && snap.gain == sent->gain && snap.rgain == sent->rgain
+			&& snap.ggain == sent->ggain && snap.bgain == sent->bgain){
+		// Changed and changed back before this frame, the camera already has these
+		return FALSE;
+	}
+
+	if (src->fastFramesEnabled){
+		// The snapshot is fixed when fast frames are enabled, re-enable with the new settings
+		LUEXECANDCHECK(LucamDisableFastFrames(src->hCam));
+		g_mutex_lock (&src->frame_lock);
+		src->fastFramesEnabled = FALSE;
+		g_mutex_unlock (&src->frame_lock);
+		if (!gst_lumenera_src_enable_fast_frames (src))
+			return FALSE;
+	}
+	else {
+		// Only what changed, a controller ramping one gain would otherwise cost six control transfers a frame
+		if (force || snap.exposure != sent->exposure)
+			gst_lumenera_set_camera_exposure(src, LU_UPDATE_CAMERA);
+		if (force || snap.gain != sent->gain)
+			LucamSetProperty(src->hCam, LUCAM_PROP_GAIN, src->cam_min_gain + src->gain/100.0*(src->cam_max_gain-src->cam_min_gain), LUCAM_PROP_FLAG_USE);
+		if (force || snap.rgain != sent->rgain)
+			LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_RED, src->rgain, LUCAM_PROP_FLAG_USE);
+		if (force || snap.ggain != sent->ggain){
+			LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN1, src->ggain, LUCAM_PROP_FLAG_USE);
+			LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_GREEN2, src->ggain, LUCAM_PROP_FLAG_USE);
+		}
+		if (force || snap.bgain != sent->bgain)
+			LucamSetProperty(src->hCam, LUCAM_PROP_GAIN_BLUE, src->bgain, LUCAM_PROP_FLAG_USE);
+	}
+	*sent = snap;
+	src->params_sent_valid = TRUE;
+
+	// Have the poll thread read back what the camera actually took
+	g_mutex_lock (&src->poll_lock);
+	src->poll_now = TRUE;
+	g_cond_signal (&src->poll_cond);
+	g_mutex_unlock (&src->poll_lock);
+
+	src->params_tag_pending = TRUE;
+	return TRUE;
+}
+
+//
+// Parse and publish a new lookup table, the spare table is filled and then published like the parameter block
+//
+static void
+gst_lumenera_src_set_lut (GstLumeneraSrc * src, const gchar * str)
+{
+	guint8 *next;
+
+	if (str && *str == '\0')
+		str = NULL;
+
+	g_mutex_lock (&src->params_lock);
+	next = (src->lut_current == src->lut_tables[0]) ? src->lut_tables[1] : src->lut_tables[0];
+	if (str && !gst_lumenera_proc_lut_parse (str, next)){
+		g_mutex_unlock (&src->params_lock);
+		GST_WARNING_OBJECT (src, "Invalid lut \"%s\", expected a gamma value or 256 entries 0-255", str);
+		return;
+	}
+	g_free (src->lut_string);
+	src->lut_string = g_strdup (str);
+	g_atomic_pointer_set (&src->lut_current, str ? next : NULL);
+	g_mutex_unlock (&src->params_lock);
+
+	gst_lumenera_src_push_lut (src);
+}
+
+//
+// Load the published table into the camera where the SDK supports it, the raw frames then need no lookup here
+//
+static void
+gst_lumenera_src_push_lut (GstLumeneraSrc * src)
+{
+#if defined(_WIN32)
+	guint8 *lut = g_atomic_pointer_get (&src->lut_current);
+
+	if (!src->hCam)
+		return;
+	if (LucamSetup8bitsLUT(src->hCam, lut, lut ? 256 : 0))
+		src->lut_in_camera = (lut != NULL);
+	else {
+		GST_DEBUG_OBJECT (src, "LucamSetup8bitsLUT failed with: %d, applying the lut to raw frames", LucamGetLastError());
+		src->lut_in_camera = FALSE;
+	}
+#endif
+}
+
+//
+// Load a dark frame, flat field or defect map for the dark-frame, flat-field and defect-map properties,
+// NULL or empty removes it.
+// A file that cannot be loaded leaves the current one in use.
+//
+static void
+gst_lumenera_src_set_calibration (GstLumeneraSrc * src, GstLumeneraCalKind kind, const gchar * path)
+{
+	GstLumeneraCalFrame *cal = NULL, *old;
+	GError *err = NULL;
+
+	if (path && *path){
+		cal = gst_lumenera_cal_frame_load (path, kind, &err);
+		if (!cal){
+			GST_ELEMENT_WARNING (src, RESOURCE, OPEN_READ, ("Could not load calibration file"), ("%s", err->message));
+			g_error_free (err);
+			return;
+		}
+		if (src->hCam && (cal->width != src->imageFormat.Width || cal->height != src->imageFormat.Height))
+			GST_ELEMENT_WARNING (src, RESOURCE, SETTINGS, ("Calibration file does not match the frame size"),
+					("%s is %d x %d, frames are %d x %d, it will not be applied", path, cal->width, cal->height,
+							src->imageFormat.Width, src->imageFormat.Height));
+	}
+	else
+		path = NULL;
+
+	g_mutex_lock (&src->cal_lock);
+	switch (kind){
+	case GST_LUMENERA_CAL_FLAT:
+		old = src->flat;
+		src->flat = cal;
+		g_free (src->flat_path);
+		src->flat_path = g_strdup (path);
+		break;
+	case GST_LUMENERA_CAL_DEFECTS:
+		old = src->defects;
+		src->defects = cal;
+		g_free (src->defects_path);
+		src->defects_path = g_strdup (path);
+		break;
+	case GST_LUMENERA_CAL_DARK:
+	default:
+		old = src->dark;
+		src->dark = cal;
+		g_free (src->dark_path);
+		src->dark_path = g_strdup (path);
+		break;
+	}
+	g_mutex_unlock (&src->cal_lock);
+
+	// Unmapped once the frame using it is done
+	if (old)
+		gst_lumenera_cal_frame_unref (old);
+}
+
+//
+// Action signal, start averaging frames raw frames into a dark frame, flat field or defect map file. A flat
+// field has the loaded dark frame subtracted, a defect map lists the hot pixels of the averaged (dark) frames.
+// Returns FALSE if not streaming or a capture is already running.
+//
+static gboolean
+gst_lumenera_src_capture_calibration (GstLumeneraSrc * src, const gchar * kind, guint frames, const gchar * path)
+{
+	GstLumeneraCalKind cal_kind;
+	gboolean started = FALSE;
+
+	if (!g_strcmp0 (kind, "dark"))
+		cal_kind = GST_LUMENERA_CAL_DARK;
+	else if (!g_strcmp0 (kind, "flat"))
+		cal_kind = GST_LUMENERA_CAL_FLAT;
+	else if (!g_strcmp0 (kind, "defects"))
+		cal_kind = GST_LUMENERA_CAL_DEFECTS;
+	else {
+		GST_WARNING_OBJECT (src, "Unknown calibration kind \"%s\", expected dark, flat or defects", kind);
+		return FALSE;
+	}
+	if (frames == 0 || !path || !*path)
+		return FALSE;
+
+	g_mutex_lock (&src->cal_lock);
+	if (src->acq_started && src->imageFormat.PixelFormat == LUCAM_PF_8 && !src->cal_capture_sum){
+		src->cal_capture_kind = cal_kind;
+		src->cal_capture_frames = frames;
+		src->cal_capture_seen = 0;
+		src->cal_capture_width = src->imageFormat.Width;
+		src->cal_capture_height = src->imageFormat.Height;
+		src->cal_capture_path = g_strdup (path);
+		src->cal_capture_sum = g_new0 (guint32, (gsize) src->cal_capture_width * src->cal_capture_height);
+		started = TRUE;
+	}
+	g_mutex_unlock (&src->cal_lock);
+
+	if (started)
+		GST_INFO_OBJECT (src, "Capturing %s calibration from %u frames to %s", kind, frames, path);
+	else
+		GST_WARNING_OBJECT (src, "Cannot capture calibration, not streaming 8 bit raw frames or a capture is running");
+
+	return started;
+}
+
+//
+// Write a finished calibration capture and post lumenera-calibration-captured, on its own thread
+//
+static gpointer
+gst_lumenera_src_calibration_write (gpointer data)
+{
+	GstLumeneraCalJob *job = data;
+	GstLumeneraSrc *src = GST_LU_SRC (job->element);
+	GError *err = NULL;
+	guint n_defects = 0;
+	gboolean ok;
+
+	// The hot pixel search of a defect map covers the whole frame, here rather than on the frame thread too
+	if (job->kind == GST_LUMENERA_CAL_DEFECTS)
+		ok = gst_lumenera_cal_defects_write (job->path, job->sum, job->frames, job->threshold, job->width, job->height, &n_defects, &err);
+	else
+		ok = gst_lumenera_cal_frame_write (job->path, job->kind, job->sum, job->frames, job->dark ? job->dark->dark : NULL,
+				job->width, job->height, &err);
+	if (ok)
+		GST_INFO_OBJECT (src, "Wrote calibration file %s", job->path);
+	else
+		GST_ELEMENT_WARNING (src, RESOURCE, WRITE, ("Could not write calibration file"), ("%s", err->message));
+
+	gst_element_post_message (GST_ELEMENT (src), gst_message_new_element (GST_OBJECT (src),
+			gst_structure_new ("lumenera-calibration-captured",
+					"kind", G_TYPE_STRING, gst_lumenera_cal_kind_name (job->kind),
+					"location", G_TYPE_STRING, job->path,
+					"frames", G_TYPE_UINT, job->frames,
+					"success", G_TYPE_BOOLEAN, ok,
+					"defects", G_TYPE_UINT, n_defects,
+					NULL)));
+
+	if (err)
+		g_error_free (err);
+	if (job->dark)
+		gst_lumenera_cal_frame_unref (job->dark);
+	g_free (job->path);
+	g_free (job->sum);
+	gst_object_unref (job->element);
+	g_free (job);
+
+	return NULL;
+}
+
+//
+// Add a raw frame to a running calibration capture. When enough frames are summed the file is written
+// by a thread of its own, so the thread that receives raw frames only ever does the sum.
+//
+static void
+gst_lumenera_src_calibration_add_frame (GstLumeneraSrc * src, const BYTE * raw, GstLumeneraCalFrame * dark)
+{
+	GstLumeneraCalJob *job;
+
+	g_mutex_lock (&src->cal_lock);
+	if (!src->cal_capture_sum || src->cal_capture_width != src->imageFormat.Width || src->cal_capture_height != src->imageFormat.Height){
+		g_mutex_unlock (&src->cal_lock);
+		return;
+	}
+	gst_lumenera_proc_accumulate (src->cal_capture_sum, raw, (gsize) src->cal_capture_width * src->cal_capture_height);
+	if (++src->cal_capture_seen < src->cal_capture_frames){
+		g_mutex_unlock (&src->cal_lock);
+		return;
+	}
+	job = g_new0 (GstLumeneraCalJob, 1);
+	job->element = gst_object_ref (src);
+	job->kind = src->cal_capture_kind;
+	job->sum = src->cal_capture_sum;
+	job->path = src->cal_capture_path;
+	job->frames = src->cal_capture_seen;
+	job->width = src->cal_capture_width;
+	job->height = src->cal_capture_height;
+	job->dark = (job->kind == GST_LUMENERA_CAL_FLAT && dark) ? gst_lumenera_cal_frame_ref (dark) : NULL;
+	job->threshold = src->defect_threshold;
+	src->cal_capture_sum = NULL;
+	src->cal_capture_path = NULL;
+	g_mutex_unlock (&src->cal_lock);
+
+	g_thread_unref (g_thread_new ("lumenerasrc-calibration", gst_lumenera_src_calibration_write, job));
+}
+
+//
+// Native tap correction. Statistics either side of the seam are gathered from the first tap_frames
+// frames (which pass uncorrected), then the correction is solved once and used for every frame.
+// Runs on whichever thread receives the raw frames, set_property only asks for a recalibration.
+//
+static GstLumeneraTapCorrection *
+gst_lumenera_src_tap_calibration (GstLumeneraSrc * src, const BYTE * raw)
+{
+	GstLumeneraTapCorrection *tap = &(src->tap);
+
+	if (g_atomic_int_get (&src->tap_recalibrate)){
+		g_atomic_int_set (&src->tap_recalibrate, FALSE);
+		memset (&(src->tap_stats), 0, sizeof(GstLumeneraTapStats));
+		src->tap_frames_seen = 0;
+		src->tap_calibrated = FALSE;
+	}
+
+	if (src->tap_calibrated)
+		return tap;
+
+	gst_lumenera_proc_tap_accumulate (&(src->tap_stats), raw, src->imageFormat.Width, src->imageFormat.Height);
+	if (++src->tap_frames_seen < src->tap_frames)
+		return NULL;
+
+	gst_lumenera_proc_tap_solve (&(src->tap_stats), tap);
+	src->tap_calibrated = TRUE;
+	GST_INFO_OBJECT (src, "Tap correction from %u frames, gains %.4f %.4f %.4f %.4f offsets %.2f %.2f %.2f %.2f", src->tap_frames_seen,
+			tap->gain[0][0]/4096.0, tap->gain[0][1]/4096.0, tap->gain[1][0]/4096.0, tap->gain[1][1]/4096.0,
+			tap->offset[0][0]/16.0, tap->offset[0][1]/16.0, tap->offset[1][0]/16.0, tap->offset[1][1]/16.0);
+
+	gst_element_post_message (GST_ELEMENT (src), gst_message_new_element (GST_OBJECT (src),
+			gst_structure_new ("lumenera-tap-calibration",
+					"frames", G_TYPE_UINT, src->tap_frames_seen,
+					"gain-00", G_TYPE_DOUBLE, tap->gain[0][0]/4096.0,
+					"gain-01", G_TYPE_DOUBLE, tap->gain[0][1]/4096.0,
+					"gain-10", G_TYPE_DOUBLE, tap->gain[1][0]/4096.0,
+					"gain-11", G_TYPE_DOUBLE, tap->gain[1][1]/4096.0,
+					"offset-00", G_TYPE_DOUBLE, tap->offset[0][0]/16.0,
+					"offset-01", G_TYPE_DOUBLE, tap->offset[0][1]/16.0,
+					"offset-10", G_TYPE_DOUBLE, tap->offset[1][0]/16.0,
+					"offset-11", G_TYPE_DOUBLE, tap->offset[1][1]/16.0,
+					NULL)));
+
+	return tap;
+}
+
+//
+// Frame statistics worker, one band of rows
+//
+static void
+gst_lumenera_src_statistics_job (gpointer data, gpointer user_data)
+{
+	static GPrivate scheduled_for = G_PRIVATE_INIT (NULL);  // the element this pool thread was scheduled for
+	GstLumeneraStatsJob *job = (GstLumeneraStatsJob *) data;
+	GstLumeneraSrc *src = (GstLumeneraSrc *) user_data;
+
+	if (g_private_get (&scheduled_for) != src){
+		g_private_set (&scheduled_for, src);
+		gst_lumenera_src_schedule (src, &src->worker_sched, src->worker_cpus, "worker");
+	}
+
+	gst_lumenera_proc_histogram (job->hist, job->raw, job->width, job->y0, job->y1, job->step);
+
+	g_mutex_lock (&src->stats_lock);
+	if (--src->stats_pending == 0)
+		g_cond_signal (&src->stats_cond);
+	g_mutex_unlock (&src->stats_lock);
+}
+
+static void
+gst_lumenera_src_free_statistics (GstLumeneraSrc * src)
+{
+	if (src->stats_pool){
+		g_thread_pool_free (src->stats_pool, FALSE, TRUE);
+		src->stats_pool = NULL;
+	}
+	g_free (src->stats_jobs);
+	src->stats_jobs = NULL;
+	src->stats_n_jobs = 0;
+}
+
+//
+// Histogram, mean and saturated count of each colour of the raw frame into src->stats. The frame is split
+// into bands of rows shared between the pool and this thread, which waits for the rest before merging.
+//
+static void
+gst_lumenera_src_frame_statistics (GstLumeneraSrc * src, const BYTE * raw)
+{
+	GstLumeneraFrameStats *stats = &(src->stats);
+	gint width = src->imageFormat.Width, height = src->imageFormat.Height;
+	gint step = src->statistics_subsample;
+	guint n_jobs = src->statistics_threads ? src->statistics_threads : g_get_num_processors ();
+	gint cells, per_job, c, i, site;
+	gint channel[4];
+	guint j;
+	gint64 now;
+
+	src->stats_valid = FALSE;
+	if (!src->frame_statistics)
+		return;
+
+	// Which colour each Bayer site is, (y & 1) * 2 + (x & 1)
+	switch (src->color_format){
+	case LUCAM_CF_BAYER_GRBG:
+		channel[0] = GST_LUMENERA_CHANNEL_GREEN; channel[1] = GST_LUMENERA_CHANNEL_RED;
+		channel[2] = GST_LUMENERA_CHANNEL_BLUE; channel[3] = GST_LUMENERA_CHANNEL_GREEN;
+		break;
+	case LUCAM_CF_BAYER_GBRG:
+		channel[0] = GST_LUMENERA_CHANNEL_GREEN; channel[1] = GST_LUMENERA_CHANNEL_BLUE;
+		channel[2] = GST_LUMENERA_CHANNEL_RED; channel[3] = GST_LUMENERA_CHANNEL_GREEN;
+		break;
+	case LUCAM_CF_BAYER_BGGR:
+		channel[0] = GST_LUMENERA_CHANNEL_BLUE; channel[1] = GST_LUMENERA_CHANNEL_GREEN;
+		channel[2] = GST_LUMENERA_CHANNEL_GREEN; channel[3] = GST_LUMENERA_CHANNEL_RED;
+		break;
+	case LUCAM_CF_MONO:
+		channel[0] = channel[1] = channel[2] = channel[3] = GST_LUMENERA_CHANNEL_GREEN;
+		break;
+	case LUCAM_CF_BAYER_RGGB:
+	default:
+		channel[0] = GST_LUMENERA_CHANNEL_RED; channel[1] = GST_LUMENERA_CHANNEL_GREEN;
+		channel[2] = GST_LUMENERA_CHANNEL_GREEN; channel[3] = GST_LUMENERA_CHANNEL_BLUE;
+		break;
+	}
+
+	// Bands of whole cells, no more jobs than there are cell rows
+	cells = (height / 2 + step - 1) / step;
+	n_jobs = CLAMP (n_jobs, 1, MAX (cells, 1));
+	per_job = (cells + n_jobs - 1) / n_jobs;
+
+	if (n_jobs != src->stats_n_jobs){
+		gst_lumenera_src_free_statistics (src);
+		src->stats_jobs = g_new (GstLumeneraStatsJob, n_jobs);
+		src->stats_n_jobs = n_jobs;
+		if (n_jobs > 1)
+			src->stats_pool = g_thread_pool_new (gst_lumenera_src_statistics_job, src, n_jobs - 1, TRUE, NULL);
+	}
+
+	src->stats_pending = n_jobs - 1;
+	for (j = 0; j < n_jobs; j++){
+		GstLumeneraStatsJob *job = &(src->stats_jobs[j]);
+
+		job->raw = raw;
+		job->width = width;
+		job->step = step;
+		job->y0 = MIN (j * per_job * 2 * step, height);
+		job->y1 = MIN ((j + 1) * per_job * 2 * step, height);
+		memset (job->hist, 0, sizeof (job->hist));
+		if (j > 0)
+			g_thread_pool_push (src->stats_pool, job, NULL);
+	}
+	gst_lumenera_proc_histogram (src->stats_jobs[0].hist, raw, width, src->stats_jobs[0].y0, src->stats_jobs[0].y1, step);
+
+	g_mutex_lock (&src->stats_lock);
+	while (src->stats_pending > 0)
+		g_cond_wait (&src->stats_cond, &src->stats_lock);
+	g_mutex_unlock (&src->stats_lock);
+
+	memset (stats, 0, sizeof (GstLumeneraFrameStats));
+	stats->subsample = step;
+	for (j = 0; j < n_jobs; j++)
+		for (site = 0; site < 4; site++)
+			for (i = 0; i < GST_LUMENERA_STATS_BINS; i++)
+				stats->histogram[channel[site]][i] += src->stats_jobs[j].hist[site][i];
+
+	for (c = 0; c < GST_LUMENERA_STATS_CHANNELS; c++){
+		guint64 sum = 0;
+
+		for (i = 0; i < GST_LUMENERA_STATS_BINS; i++){
+			stats->pixels[c] += stats->histogram[c][i];
+			sum += (guint64) i * stats->histogram[c][i];
+		}
+		stats->saturated[c] = stats->histogram[c][GST_LUMENERA_STATS_BINS - 1];
+		stats->mean[c] = stats->pixels[c] ? (gdouble) sum / stats->pixels[c] : 0.0;
+	}
+	src->stats_valid = TRUE;
+
+	// The meta goes with every buffer, the bus only gets a message every statistics_interval ms
+	now = g_get_monotonic_time ();
+	if (src->stats_posted && now - src->stats_posted < (gint64) src->statistics_interval * (G_USEC_PER_SEC / 1000))
+		return;
+	src->stats_posted = now;
+
+	gst_element_post_message (GST_ELEMENT (src), gst_message_new_element (GST_OBJECT (src),
+			gst_structure_new ("lumenera-frame-statistics",
+					"frame-number", G_TYPE_UINT64, src->frame_counter,
+					"timestamp", G_TYPE_UINT64, src->frame_timestamp,
+					"subsample", G_TYPE_UINT, stats->subsample,
+					"red-mean", G_TYPE_DOUBLE, stats->mean[GST_LUMENERA_CHANNEL_RED],
+					"green-mean", G_TYPE_DOUBLE, stats->mean[GST_LUMENERA_CHANNEL_GREEN],
+					"blue-mean", G_TYPE_DOUBLE, stats->mean[GST_LUMENERA_CHANNEL_BLUE],
+					"red-saturated", G_TYPE_UINT64, stats->saturated[GST_LUMENERA_CHANNEL_RED],
+					"green-saturated", G_TYPE_UINT64, stats->saturated[GST_LUMENERA_CHANNEL_GREEN],
+					"blue-saturated", G_TYPE_UINT64, stats->saturated[GST_LUMENERA_CHANNEL_BLUE],
+					"red-pixels", G_TYPE_UINT64, stats->pixels[GST_LUMENERA_CHANNEL_RED],
+					"green-pixels", G_TYPE_UINT64, stats->pixels[GST_LUMENERA_CHANNEL_GREEN],
+					"blue-pixels", G_TYPE_UINT64, stats->pixels[GST_LUMENERA_CHANNEL_BLUE],
+					NULL)));
+}
+
+//
+// Parse and publish a focus region "x,y,width,height", NULL or empty for the whole frame
+//
+static void
+gst_lumenera_src_set_focus_roi (GstLumeneraSrc * src, const gchar * str)
+{
+	gint x = 0, y = 0, width = 0, height = 0;
+
+	if (str && *str == '\0')
+		str = NULL;
+
+	if (str && (sscanf (str, "%d,%d,%d,%d", &x, &y, &width, &height) != 4 || x < 0 || y < 0 || width <= 0 || height <= 0)){
+		GST_WARNING_OBJECT (src, "Invalid focus-roi \"%s\", expected x,y,width,height", str);
+		return;
+	}
+
+	GST_OBJECT_LOCK (src);
+	g_free (src->focus_roi_string);
+	src->focus_roi_string = g_strdup (str);
+	src->focus_x = x;
+	src->focus_y = y;
+	src->focus_width = width;
+	src->focus_height = height;
+	GST_OBJECT_UNLOCK (src);
+}
+
+//
+// Focus score of the green channel of the raw frame in focus-roi, clipped to the frame
+//
+static void
+gst_lumenera_src_focus (GstLumeneraSrc * src, const BYTE * raw)
+{
+	gint width = src->imageFormat.Width, height = src->imageFormat.Height;
+	gint x, y, w, h;
+	gboolean green_first;
+	FocusMetricType metric = src->focus_metric;
+	gint64 now;
+
+	src->focus_valid = FALSE;
+	if (metric == GST_FOCUS_METRIC_NONE)
+		return;
+
+	GST_OBJECT_LOCK (src);
+	x = src->focus_x;
+	y = src->focus_y;
+	w = src->focus_width;
+	h = src->focus_height;
+	GST_OBJECT_UNLOCK (src);
+	if (w == 0){
+		x = y = 0;
+		w = width;
+		h = height;
+	}
+	// Whole cells inside the frame, so the Bayer phase is kept
+	x = MIN (x & ~1, width);
+	y = MIN (y & ~1, height);
+	w = MIN (w, width - x);
+	h = MIN (h, height - y);
+
+	green_first = (src->color_format == LUCAM_CF_BAYER_GRBG || src->color_format == LUCAM_CF_BAYER_GBRG);
+	if (metric == GST_FOCUS_METRIC_TENENGRAD)
+		src->focus_score = gst_lumenera_proc_focus_tenengrad (raw, width, x, y, w, h, green_first);
+	else
+		src->focus_score = gst_lumenera_proc_focus_laplacian (raw, width, x, y, w, h, green_first);
+	if (src->focus_score < 0){
+		GST_DEBUG_OBJECT (src, "Focus region %d,%d %dx%d too small", x, y, w, h);
+		return;
+	}
+	src->focus_valid = TRUE;
+
+	// Like the frame statistics, the bus only gets a message every focus_interval ms
+	now = g_get_monotonic_time ();
+	if (src->focus_posted && now - src->focus_posted < (gint64) src->focus_interval * (G_USEC_PER_SEC / 1000))
+		return;
+	src->focus_posted = now;
+
+	gst_element_post_message (GST_ELEMENT (src), gst_message_new_element (GST_OBJECT (src),
+			gst_structure_new ("lumenera-focus",
+					"frame-number", G_TYPE_UINT64, src->frame_counter,
+					"timestamp", G_TYPE_UINT64, src->frame_timestamp,
+					"metric", TYPE_FOCUSMETRIC, metric,
+					"score", G_TYPE_DOUBLE, src->focus_score,
+					"x", G_TYPE_INT, x,
+					"y", G_TYPE_INT, y,
+					"width", G_TYPE_INT, w,
+					"height", G_TYPE_INT, h,
+					NULL)));
+}
+
+//
+// Temporal accumulation of processed raw frames into src->acc, set up again whenever the settings or
+// frame size change. Average and sum give one frame per accumulate-frames frames, the running average
+// one per frame. Returns rawImage holding the result, or NULL while a block is incomplete.
+//
+static BYTE *
+gst_lumenera_src_accumulate (GstLumeneraSrc * src, const BYTE * raw)
+{
+	gsize n = src->imageFormat.ImageSize;
+	// 16 bit sums while they cannot overflow, half the memory traffic of 32 bit ones
+	gboolean narrow;
+
+	if (g_atomic_int_get (&src->acc_reset) || src->acc_size != n){
+		g_atomic_int_set (&src->acc_reset, FALSE);
+		src->acc_mode = src->accumulate_mode;
+		src->acc_length = src->accumulate_frames;
+		src->acc_seen = 0;
+		src->acc_size = n;
+		g_free (src->acc);
+		if (src->acc_mode == GST_ACCUMULATE_RUNNING_AVERAGE)
+			src->acc = g_new (gfloat, n);
+		else if (src->acc_length <= 257)
+			src->acc = g_new0 (guint16, n);
+		else
+			src->acc = g_new0 (guint32, n);
+		GST_DEBUG_OBJECT (src, "Accumulating %u frames", src->acc_length);
+	}
+	narrow = (src->acc_length <= 257);
+
+	if (src->acc_mode == GST_ACCUMULATE_RUNNING_AVERAGE){
+		// A plain average until the window is full, so the first frames are not dark
+		if (src->acc_seen < src->acc_length)
+			src->acc_seen++;
+		gst_lumenera_proc_running_average (src->rawImage, src->acc, raw, n, 1.0f / src->acc_seen);
+		src->acc_frames_out = src->acc_seen;
+		src->acc_span = 1;
+		return src->rawImage;
+	}
+
+	if (narrow)
+		gst_lumenera_proc_accumulate16 (src->acc, raw, n);
+	else
+		gst_lumenera_proc_accumulate (src->acc, raw, n);
+	if (++src->acc_seen < src->acc_length)
+		return NULL;
+
+	if (narrow)
+		gst_lumenera_proc_accumulate_finish16 (src->rawImage, src->acc, n,
+				src->acc_mode == GST_ACCUMULATE_SUM ? 1.0f : 1.0f / src->acc_seen);
+	else
+		gst_lumenera_proc_accumulate_finish (src->rawImage, src->acc, n,
+				src->acc_mode == GST_ACCUMULATE_SUM ? 1.0f : 1.0f / src->acc_seen);
+	src->acc_frames_out = src->acc_seen;
+	src->acc_span = src->acc_seen;
+	src->acc_seen = 0;
+
+	return src->rawImage;
+}
+
+//
+// In-plugin processing of a raw frame before it is converted. In the callback engine raw is the SDK's
+// buffer so the result goes to rawImage, our own buffers are processed in place. Tap correction and
+// the lookup table are done in one pass, row by row, the lookup table after accumulation when frames
+// are accumulated. Returns the frame to convert, or NULL while accumulating.
+//
+static BYTE *
+gst_lumenera_src_process_raw (GstLumeneraSrc * src, BYTE * raw)
+{
+	guint8 *lut = g_atomic_pointer_get (&src->lut_current);
+	GstLumeneraTapCorrection *tap = NULL;
+	GstLumeneraCalFrame *dark = NULL, *flat = NULL, *defects = NULL;
+	gboolean capturing, accumulate;
+
+	src->acc_frames_out = 1;
+	src->acc_span = 1;
+
+	if (src->imageFormat.PixelFormat != LUCAM_PF_8)
+		return raw;
+
+	if (src->lut_in_camera)
+		lut = NULL;
+
+	accumulate = (src->accumulate_frames > 1);
+	if (!accumulate && src->acc){
+		g_free (src->acc);
+		src->acc = NULL;
+		src->acc_size = 0;
+	}
+
+	// Hold the calibration frames for this frame, set_property may replace them meanwhile
+	g_mutex_lock (&src->cal_lock);
+	if (src->dark && src->dark->width == src->imageFormat.Width && src->dark->height == src->imageFormat.Height)
+		dark = gst_lumenera_cal_frame_ref (src->dark);
+	if (src->flat && src->flat->width == src->imageFormat.Width && src->flat->height == src->imageFormat.Height)
+		flat = gst_lumenera_cal_frame_ref (src->flat);
+	if (src->defects && src->defects->n_defects && src->defects->width == src->imageFormat.Width && src->defects->height == src->imageFormat.Height)
+		defects = gst_lumenera_cal_frame_ref (src->defects);
+	capturing = (src->cal_capture_sum != NULL);
+	g_mutex_unlock (&src->cal_lock);
+
+	// Calibration frames are built from the uncorrected data
+	if (capturing)
+		gst_lumenera_src_calibration_add_frame (src, raw, dark);
+
+	// Both corrections model a left and a right tap, there is no seam to correct in the other layouts
+	switch (src->tap_configuration == GST_TAP_CONFIGURATION_DUAL ? src->tapcorrection : GST_TAP_CORRECTION_OFF){
+	case GST_TAP_CORRECTION_SDK:
+		// Corrects in place, leave the SDK's own buffer alone
+		if (raw != src->rawImage){
+			memcpy (src->rawImage, raw, src->imageFormat.ImageSize);
+			raw = src->rawImage;
+		}
+		LUEXECANDCHECK(LucamPerformDualTapCorrection(src->hCam, raw, &(src->imageFormat)));
+		break;
+	case GST_TAP_CORRECTION_NATIVE:
+		tap = gst_lumenera_src_tap_calibration (src, raw);
+		break;
+	case GST_TAP_CORRECTION_OFF:
+	default:
+		break;
+	}
+
+	if (dark || flat || tap || (lut && !accumulate)){
+		gst_lumenera_proc_raw (src->rawImage, raw, src->imageFormat.Width, src->imageFormat.Height,
+				dark ? dark->dark : NULL, flat ? flat->flat : NULL, tap, accumulate ? NULL : lut);
+		raw = src->rawImage;
+	}
+
+	// After the lookup table too, which being monotonic keeps the median the same
+	if (defects){
+		if (raw != src->rawImage){
+			memcpy (src->rawImage, raw, src->imageFormat.ImageSize);
+			raw = src->rawImage;
+		}
+		gst_lumenera_proc_defects_correct (raw, src->imageFormat.Width, src->imageFormat.Height, defects->defects, defects->n_defects);
+		gst_lumenera_cal_frame_unref (defects);
+	}
+
+	if (dark)
+		gst_lumenera_cal_frame_unref (dark);
+	if (flat)
+		gst_lumenera_cal_frame_unref (flat);
+
+	if (accumulate){
+		raw = gst_lumenera_src_accumulate (src, raw);
+		// The table is not linear, so it goes on the accumulated frame
+		if (raw && lut)
+			gst_lumenera_proc_lut_apply (raw, raw, src->imageFormat.ImageSize, lut);
+	}
+
+	if (raw){
+		gst_lumenera_src_frame_statistics (src, raw);
+		gst_lumenera_src_focus (src, raw);
+	}
+
+	return raw;
+}
+
+//
+// Sync controlled properties (exposure, gains) on the streaming thread before the next frame.
+// Values are taken for the running time control_lead frames after the next frame, they are
+// published and then applied at this frame boundary, so they reach the camera ahead of the
+// frame they are meant for. Triggered frames have no schedule, the current running time is used.
+//
+static void
+gst_lumenera_src_sync_controlled (GstLumeneraSrc * src)
+{
+	GstClockTime next;
+	GstClock *clock;
+
+	if (src->triggermode == GST_TRIGGER_FREE_RUN)
+		next = src->last_frame_time + src->duration;
+	else if ((clock = gst_element_get_clock (GST_ELEMENT (src)))){
+		next = gst_clock_get_time (clock) - gst_element_get_base_time (GST_ELEMENT (src));
+		gst_object_unref (clock);
+	}
+	else
+		return;
+
+	gst_object_sync_values (GST_OBJECT (src), next + src->control_lead * src->duration);
+}
+
+//
+// Describe the capture of this buffer for downstream analysis, see gstlumenerameta.h
+//
+static void
+gst_lumenera_src_add_frame_meta (GstLumeneraSrc * src, GstBuffer * buf)
+{
+	GstLumeneraFrameMeta *meta = gst_buffer_add_lumenera_frame_meta (buf);
+
+	meta->frame_number = src->frame_counter;
+	meta->timestamp = src->frame_timestamp;
+	meta->hw_timestamp = src->frame_hw_timestamp;
+	meta->exposure = src->exposure;
+	meta->gain = src->gain;
+	meta->rgain = src->rgain;
+	meta->ggain = src->ggain;
+	meta->bgain = src->bgain;
+	meta->settings_generation = src->params_applied;
+	meta->conversion_time = src->conversion_time;
+	meta->accumulated_frames = src->acc_frames_out;
+
+	meta->focus_score = src->focus_score;
+	meta->focus_valid = src->focus_valid;
+
+	if (src->stats_valid)
+		gst_buffer_add_lumenera_stats_meta (buf, &(src->stats));
+
+	GST_OBJECT_LOCK (src);
+	meta->temperature = src->temperature;
+	meta->temperature_valid = src->temperature_valid;
+	GST_OBJECT_UNLOCK (src);
+}
+
+//
+// Tell downstream which buffer is the first one taken with newly applied settings, a serialized
+// custom event just ahead of it. The very first buffer of a stream carries the initial settings
+// anyway and no event may precede its segment, so nothing is sent for it.
+//
+static void
+gst_lumenera_src_tag_params (GstLumeneraSrc * src, GstBuffer * buf)
+{
+	GstPad *pad = GST_BASE_SRC_PAD (src);
+	GstEvent *segment;
+
+	src->params_tag_pending = FALSE;
+
+	segment = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+	if (!segment)
+		return;
+	gst_event_unref (segment);
+
+	gst_pad_push_event (pad, gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM,
+			gst_structure_new ("lumenera-settings-applied",
+					"generation", G_TYPE_INT, src->params_applied,
+					"pts", G_TYPE_UINT64, GST_BUFFER_PTS (buf),
+					"exposure", G_TYPE_DOUBLE, (gdouble)src->exposure,
+					"gain", G_TYPE_INT, (gint)src->gain,
+					"rgain", G_TYPE_FLOAT, src->rgain,
+					"ggain", G_TYPE_FLOAT, src->ggain,
+					"bgain", G_TYPE_FLOAT, src->bgain,
+					NULL)));
+}
+
+//
+// The camera keeps streaming while PAUSED (it is only stopped in stop), frames are then discarded
+// in imageCallback before conversion. On PLAYING the producer is armed straight away so the first
+// frame after resume is converted without waiting for create to be scheduled.
+//
+static GstStateChangeReturn
+gst_lumenera_src_change_state (GstElement * element, GstStateChange transition)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (element);
+	GstStateChangeReturn ret;
+
+	switch (transition) {
+	case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+		GST_DEBUG_OBJECT (src, "resume delivering frames");
+		g_mutex_lock (&src->frame_lock);
+		src->rgbImageFresh = FALSE;
+		src->rgbImageOwnerIsProducer = TRUE;
+		src->playing = TRUE;
+		g_mutex_unlock (&src->frame_lock);
+		break;
+	case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+		GST_DEBUG_OBJECT (src, "pause delivering frames, camera keeps streaming");
+		g_mutex_lock (&src->frame_lock);
+		src->playing = FALSE;
+		src->stream_generation++;
+		src->rgbImageFresh = FALSE;
+		src->rgbImageOwnerIsProducer = FALSE;
+		g_mutex_unlock (&src->frame_lock);
+		break;
+	default:
+		break;
+	}
+
+	ret = GST_ELEMENT_CLASS (gst_lumenera_src_parent_class)->change_state (element, transition);
+
+	// The streaming task was created by activating the pad, have it give its thread back as it found it
+	if (transition == GST_STATE_CHANGE_READY_TO_PAUSED && ret != GST_STATE_CHANGE_FAILURE){
+		GstPad *pad = GST_BASE_SRC_PAD (src);
+		GstTask *task;
+
+		GST_OBJECT_LOCK (pad);
+		task = GST_PAD_TASK (pad) ? gst_object_ref (GST_PAD_TASK (pad)) : NULL;
+		GST_OBJECT_UNLOCK (pad);
+		if (task){
+			gst_task_set_leave_callback (task, gst_lumenera_src_streaming_leave, src, NULL);
+			gst_object_unref (task);
+		}
+	}
+
+	return ret;
+}
+
+static gboolean
+gst_lumenera_src_event (GstBaseSrc * bsrc, GstEvent * event)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (bsrc);
+
+	if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM) {
+		const GstStructure *s = gst_event_get_structure (event);
+
+		if (s && gst_structure_has_name (s, "lumenera-trigger")) {
+			GST_DEBUG_OBJECT (src, "Software trigger event received");
+			return gst_lumenera_src_trigger (src);
+		}
+	}
+
+	return GST_BASE_SRC_CLASS (gst_lumenera_src_parent_class)->event (bsrc, event);
+}
+
+//
+// Output mode and layout of video/x-bayer caps, which must be the camera's pattern and full frame
+//
+static gboolean
+gst_lumenera_src_parse_bayer_caps (GstLumeneraSrc * src, const GstStructure * s,
+		OutputFormatType * output, gint * stride, gint * height)
+{
+	const gchar *pattern = gst_lumenera_src_bayer_pattern (src);
+	const gchar *format = gst_structure_get_string (s, "format");
+	gint width, bits;
+
+	if (!pattern || !format || strncmp (format, pattern, 4) != 0
+			|| !gst_structure_get_int (s, "width", &width) || !gst_structure_get_int (s, "height", height)
+			|| width != src->nWidth)
+		return FALSE;
+
+	if (strlen (format) == 4){
+		*output = GST_OUTPUT_BAYER;
+		*stride = GST_ROUND_UP_4 (width);
+		return TRUE;
+	}
+
+	bits = gst_lumenera_bayer_packed_bits (format);
+	if (bits == 10 && width % 4 == 0)
+		*output = GST_OUTPUT_BAYER_PACKED10;
+	else if (bits == 12 && width % 2 == 0)
+		*output = GST_OUTPUT_BAYER_PACKED12;
+	else
+		return FALSE;
+	*stride = width * bits / 8;
+
+	return TRUE;
+}
+
+//
+// Switch the camera between 8 and 16 bit raw frames, with the stream stopped
+//
+static gboolean
+gst_lumenera_src_set_pixel_format (GstLumeneraSrc * src, ULONG pixel_format)
+{
+	if (src->frameFormat.pixelFormat == pixel_format && src->imageFormat.PixelFormat == pixel_format)
+		return TRUE;
+
+	GST_DEBUG_OBJECT (src, "LucamSetFormat pixel format %d", pixel_format);
+	src->frameFormat.pixelFormat = pixel_format;
+	if (!LucamSetFormat(src->hCam, &(src->frameFormat), src->framerate)
+			|| !LucamGetVideoImageFormat(src->hCam, &(src->imageFormat))){
+		GST_ERROR_OBJECT(src, "Could not set pixel format %d: %d (see lucamerr.h)", pixel_format, LucamGetLastError());
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+gst_lumenera_src_set_caps (GstBaseSrc * bsrc, GstCaps * caps)
+{
+	// Start will open the device but not start it, set_caps starts it, stop should stop and close it (as v4l2src)
+
+	GstLumeneraSrc *src = GST_LU_SRC (bsrc);
+	GstVideoInfo vinfo;
+	GstStructure *s = gst_caps_get_structure (caps, 0);
+	OutputFormatType output;
+	gint stride, height;
+
+	GST_DEBUG_OBJECT (src, "The caps being set are %" GST_PTR_FORMAT, caps);
+
+	if (gst_structure_has_name (s, "video/x-bayer")) {
+		if (!gst_lumenera_src_parse_bayer_caps (src, s, &output, &stride, &height))
+			goto unsupported_caps;
+	}
+	else {
+		gst_video_info_from_caps (&vinfo, caps);
+		if (GST_VIDEO_INFO_FORMAT (&vinfo) == GST_VIDEO_FORMAT_UNKNOWN)
+			goto unsupported_caps;
+		output = GST_OUTPUT_RGB;
+		stride = GST_VIDEO_INFO_COMP_STRIDE (&vinfo, 0);
+		height = vinfo.height;
+	}
+
+	// Renegotiation to the same layout, keep the stream running
+	if (src->acq_started && src->output == output && src->gst_stride == stride && src->nHeight == height) {
+		GST_DEBUG_OBJECT (src, "Already streaming with these caps");
+		return TRUE;
+	}
+	gst_lumenera_src_stop_capture (src);
+
+	g_assert (src->hCam != 0);
+	//  src->vrm_stride = get_pitch (src->device);  // wait for image to arrive for this
+	src->gst_stride = stride;
+	src->nHeight = height;
+	src->output = output;
+
+	// Packed output is made from 16 bit frames, everything else from 8 bit
+	if (!gst_lumenera_src_set_pixel_format (src,
+			(output == GST_OUTPUT_BAYER_PACKED10 || output == GST_OUTPUT_BAYER_PACKED12) ? LUCAM_PF_16 : LUCAM_PF_8))
+		goto unsupported_caps;
+
+	switch (output){
+	case GST_OUTPUT_BAYER:
+		src->nPitch = GST_ROUND_UP_4 (src->imageFormat.Width);
+		break;
+	case GST_OUTPUT_BAYER_PACKED10:
+		src->nPitch = src->imageFormat.Width / 4 * 5;
+		break;
+	case GST_OUTPUT_BAYER_PACKED12:
+		src->nPitch = src->imageFormat.Width / 2 * 3;
+		break;
+	case GST_OUTPUT_RGB:
+	default:
+		src->nPitch = src->imageFormat.Width * 3;
+		break;
+	}
+
+	// Seam statistics and accumulated frames depend on the frame layout
+	g_atomic_int_set (&src->tap_recalibrate, TRUE);
+	g_atomic_int_set (&src->acc_reset, TRUE);
+
+	// Decimation starts with the first frame kept
+	src->dec_count = 0;
+	src->dec_phase = MAX (src->framerate, 1.0);
+	src->dec_pending = 0;
+	src->dec_span = 0;
+
+	// Negotiation runs on the streaming thread, schedule it before the frame memory is allocated so the
+	// pages are faulted in, and the arena locked, from the capture CPU's NUMA node
+	gst_lumenera_src_schedule_capture (src, &src->streaming_thread, &src->streaming_sched, &src->streaming_saved, "streaming");
+
+	// TODO What should this be? Does not make any difference, does not help with mpeg2 mux container
+//	gst_base_src_set_blocksize(bsrc, src->gst_stride * src->nHeight);
+//	GST_DEBUG_OBJECT (src, "Buffer block size is %d bytes", gst_base_src_get_blocksize(bsrc));
+
+	if (src->triggermode == GST_TRIGGER_FREE_RUN){
+		// start freerun/continuous capture
+		// the raw frame is reused for every LucamTakeVideoEx, or holds the processed frame in the callback engine
+		if (!gst_lumenera_src_frames_alloc (src, caps))
+			goto fail;
+		if (src->burst_frames){
+			if (!gst_lumenera_src_burst_alloc (src))
+				goto fail;
+		}
+		else if (src->pretrigger_seconds > 0 && !gst_lumenera_src_ring_alloc (src))
+			goto fail;
+		if (src->captureengine == GST_ENGINE_CALLBACK)
+		    src->callbackID = LucamAddStreamingCallback(src->hCam, imageCallback,  src);
+		GST_DEBUG_OBJECT (src, "LucamStreamVideoControl START_STREAMING");
+		if (!LucamStreamVideoControl(src->hCam, START_STREAMING, NULL)){
+			GST_ELEMENT_ERROR (src, RESOURCE, FAILED, ("Could not start streaming."),
+					("LucamStreamVideoControl START_STREAMING failed with: %d (see lucamerr.h)", LucamGetLastError()));
+			if (src->captureengine == GST_ENGINE_CALLBACK)
+				LUEXECANDCHECK(LucamRemoveStreamingCallback(src->hCam, src->callbackID));
+			goto fail;
+		}
+	}
+	else {
+		// one frame per trigger
+		if (!gst_lumenera_src_enable_fast_frames(src))
+			goto fail;
+		// sized for the snapshot layout
+		if (!gst_lumenera_src_frames_alloc (src, caps))
+			goto fail;
+	}
+
+	src->acq_started = TRUE;
+	src->frame_memory_node = -2;
+
+	return TRUE;
+
+	unsupported_caps:
+	GST_ERROR_OBJECT (src, "Unsupported caps: %" GST_PTR_FORMAT, caps);
+	return FALSE;
+
+	fail:
+	// Free what was allocated before the failure, the next negotiation would otherwise overwrite it
+	gst_lumenera_src_free_capture (src);
+	return FALSE;
+}
+
+//  This can override the push class create fn, it is the same as fill above but it forces the creation of a buffer here to copy into.
+#ifdef OVERRIDE_CREATE
+static GstFlowReturn
+gst_lumenera_src_create (GstPushSrc * psrc, GstBuffer ** buf)
+{
+	GstLumeneraSrc *src = GST_LU_SRC (psrc);
+	GstMapInfo minfo;
+	gint64 t0 = 0;
+	BYTE *frame = src->rawImage;  // raw frame to convert when pulled
+	gboolean pulled = (src->triggermode == GST_TRIGGER_FREE_RUN && (src->captureengine == GST_ENGINE_PULL || src->arena));
+
+	// lock next (raw) image for read access, convert it to the desired
+	// format and unlock it again, so that grabbing can go on
+
+	// Wait for the next image to be ready
+	//INT nRet = is_WaitEvent(src->hCam, IS_SET_EVENT_FRAME_RECEIVED, 5000);
+
+	gst_lumenera_src_schedule_capture (src, &src->streaming_thread, &src->streaming_sched, &src->streaming_saved, "streaming");
+
+	// Frame boundary, apply any settings changed since the last frame
+	gst_lumenera_src_sync_controlled (src);
+	if (gst_lumenera_src_apply_params (src, FALSE) && !pulled && src->triggermode == GST_TRIGGER_FREE_RUN){
+		// A frame already converted by the callback was taken with the old settings
+		g_mutex_lock (&src->frame_lock);
+		src->rgbImageFresh = FALSE;
+		g_mutex_unlock (&src->frame_lock);
+	}
+
+	if (src->ring_frames){
+		GstFlowReturn ret = gst_lumenera_src_ring_next (src, &frame);
+		if (ret != GST_FLOW_OK)
+			return ret;
+		t0 = g_get_monotonic_time ();
+	}
+	else if (src->arena){
+		GstFlowReturn ret = gst_lumenera_src_burst_next (src, &frame);
+		if (ret != GST_FLOW_OK)
+			return ret;
+		t0 = g_get_monotonic_time ();
+	}
+	else if (pulled){
+		// Take frames until one is ready to convert, more than one while accumulating
+		do {
+			GstFlowReturn ret = gst_lumenera_src_take_video (src, src->rawImage);
+			if (ret != GST_FLOW_OK)
+				return ret;
+			t0 = g_get_monotonic_time ();
+		} while (gst_lumenera_src_decimate (src) || !gst_lumenera_src_process_raw (src, src->rawImage));
+		gst_lumenera_src_decimate_take_span (src);
+	}
+	else if (src->triggermode == GST_TRIGGER_FREE_RUN){
+		// Wait for the next image to be ready
+	//	GST_DEBUG_OBJECT(src, "Wait for image.");
+		GstFlowReturn ret = gst_lumenera_src_wait_frame (src);
+		if (ret != GST_FLOW_OK)
+			return ret;
+	}
+	else {
+		GstFlowReturn ret = gst_lumenera_src_take_fast_frame (src);
+		if (ret != GST_FLOW_OK)
+			return ret;
+	}
+
+//	if(G_LIKELY(nRet == IS_SUCCESS))
+	{
+		//  successfully returned an image
+		// ----------------------------------------------------------
+
+		guint i;
+
+//		LucamGpioWrite(src->hCam, 0);
+
+		// Copy image to buffer in the right way
+
+		// Take a buffer for the image from the pool, its memory is already faulted in
+		{
+			GstFlowReturn ret = gst_buffer_pool_acquire_buffer (src->pool, buf, NULL);
+			if (ret != GST_FLOW_OK)
+				return ret;
+		}
+
+		gst_buffer_map (*buf, &minfo, GST_MAP_WRITE);
+
+		if (pulled && src->gst_stride == src->nPitch){
+			// Pulled raw frame, convert straight into the buffer, no copy
+			gst_lumenera_src_render (src, minfo.data, frame);
+			src->conversion_time = (g_get_monotonic_time () - t0) * GST_USECOND;
+		}
+		else {
+			if (pulled){
+				gst_lumenera_src_render (src, src->rgbImage, frame);
+				src->conversion_time = (g_get_monotonic_time () - t0) * GST_USECOND;
+			}
+
+			// From the grabber source we get 1 progressive frame
+			// We expect src->nPitch = src->gst_stride but use separate vars for safety
+			//GST_DEBUG_OBJECT(src, "Copy image. %d %d", src->gst_stride, src->nPitch);
+			for (i = 0; i < src->nHeight; i++) {
+				memcpy (minfo.data + i * src->gst_stride,
+						src->rgbImage + i * src->nPitch, src->nPitch);
+			}
+		}
+
+		gst_buffer_unmap (*buf, &minfo);
+		if (src->ring_frames)
+			gst_lumenera_src_ring_done (src);
+
+		// Where the frames are received, now that the pages have been touched
+		if (src->frame_memory_node == -2){
+			gint node = gst_lumenera_memory_node (pulled ? frame : src->rgbImage);
+
+			GST_OBJECT_LOCK (src);
+			src->frame_memory_node = node;
+			GST_OBJECT_UNLOCK (src);
+			GST_INFO_OBJECT (src, "Frame memory is on NUMA node %d", node);
+		}
+
+		if (src->triggermode == GST_TRIGGER_FREE_RUN){
+			// If we do not use gst_base_src_set_do_timestamp() we need to add timestamps manually
+			// An accumulated frame spans all the frames it was made from, burst frames keep their capture spacing
+			if (src->ring_frames){
+				// Pre-trigger frames are pushed late, stamp them with the running time they arrived at
+				GstClock *clock = gst_element_get_clock (GST_ELEMENT (src));
+
+				if (clock){
+					GstClockTime running_time = gst_clock_get_time (clock) - gst_element_get_base_time (GST_ELEMENT (src));
+					GstClockTime age = (g_get_monotonic_time () - src->ring_arrival) * GST_USECOND;
+
+					src->last_frame_time = running_time > age ? running_time - age : 0;
+					gst_object_unref (clock);
+				}
+			}
+			else if (src->arena)
+				src->last_frame_time = src->burst_offset;
+			else
+				src->last_frame_time += src->duration * (src->acc_span + src->dec_span);   // Get the timestamp for this frame
+			if(!gst_base_src_get_do_timestamp(GST_BASE_SRC(psrc))){
+				GST_BUFFER_PTS(*buf) = src->last_frame_time;  // convert ms to ns
+				GST_BUFFER_DTS(*buf) = src->last_frame_time;  // convert ms to ns
+			}
+			GST_BUFFER_DURATION(*buf) = src->duration * (src->acc_span + src->dec_span);
+		}
+		else {
+			// Time from the trigger (or triggered frame arrival for hardware triggers) to a complete buffer
+			GstClockTime latency = (g_get_monotonic_time () - src->trigger_time) * GST_USECOND;
+			GstClock *clock;
+
+			// Triggered frames are irregular, stamp them with the running time of the trigger
+			if(!gst_base_src_get_do_timestamp(GST_BASE_SRC(psrc)) && (clock = gst_element_get_clock (GST_ELEMENT (src)))){
+				GstClockTime running_time = gst_clock_get_time (clock) - gst_element_get_base_time (GST_ELEMENT (src));
+
+				src->last_frame_time = running_time > latency ? running_time - latency : 0;
+				GST_BUFFER_PTS(*buf) = src->last_frame_time;
+				GST_BUFFER_DTS(*buf) = src->last_frame_time;
+				gst_object_unref (clock);
+			}
+
+			GST_OBJECT_LOCK (src);
+			src->n_triggered_frames++;
+			src->trigger_latency_last = latency;
+			src->trigger_latency_total += latency;
+			src->trigger_latency_max = MAX(src->trigger_latency_max, latency);
+			if (!GST_CLOCK_TIME_IS_VALID (src->trigger_latency_min) || latency < src->trigger_latency_min)
+				src->trigger_latency_min = latency;
+			GST_OBJECT_UNLOCK (src);
+		}
+//		GST_DEBUG_OBJECT(src, "pts, dts: %" GST_TIME_FORMAT ", duration: %d ms", GST_TIME_ARGS (src->last_frame_time), GST_TIME_AS_MSECONDS(src->duration));
+
+		gst_lumenera_src_add_frame_meta (src, *buf);
+		if (src->params_tag_pending)
+			gst_lumenera_src_tag_params (src, *buf);
 
 		// count frames, and send EOS when required frame number is reached
 		GST_BUFFER_OFFSET(*buf) = src->n_frames;  // from videotestsrc
 		src->n_frames++;
 		GST_BUFFER_OFFSET_END(*buf) = src->n_frames;  // from videotestsrc
+		gst_lumenera_src_push_previews (src, *buf);
 		if (psrc->parent.num_buffers>0)  // If we were asked for a specific number of buffers, stop when complete
 			if (G_UNLIKELY(src->n_frames >= psrc->parent.num_buffers))
 				return GST_FLOW_EOS;
@@ -24,6 +24,10 @@
 
 #include <gst/base/gstpushsrc.h>
 
+#include "gstlumeneraproc.h"
+#include "gstlumeneraallocator.h"
+#include "gstlumenerametaprivate.h"
+
 G_BEGIN_DECLS
 
 #define GST_TYPE_LU_SRC   (gst_lumenera_src_get_type())
@@ -42,6 +46,113 @@ typedef enum
 	GST_WB_AUTO
 } WhiteBalanceType;
 
+typedef enum
+{
+	GST_TRIGGER_FREE_RUN,
+	GST_TRIGGER_HARDWARE,
+	GST_TRIGGER_SOFTWARE
+} TriggerModeType;
+
+typedef enum
+{
+	GST_ENGINE_CALLBACK,
+	GST_ENGINE_PULL
+} CaptureEngineType;
+
+typedef enum
+{
+	GST_TAP_CONFIGURATION_SINGLE,
+	GST_TAP_CONFIGURATION_DUAL,
+	GST_TAP_CONFIGURATION_QUAD
+} TapConfigurationType;
+
+typedef enum
+{
+	GST_TAP_CORRECTION_OFF,
+	GST_TAP_CORRECTION_SDK,
+	GST_TAP_CORRECTION_NATIVE
+} TapCorrectionType;
+
+typedef enum
+{
+	GST_ACCUMULATE_AVERAGE,
+	GST_ACCUMULATE_RUNNING_AVERAGE,
+	GST_ACCUMULATE_SUM
+} AccumulateModeType;
+
+// What set_caps negotiated, the frames are converted or packed to it
+typedef enum
+{
+	GST_OUTPUT_RGB,
+	GST_OUTPUT_BAYER,            // raw 8 bit
+	GST_OUTPUT_BAYER_PACKED10,   // from 16 bit frames
+	GST_OUTPUT_BAYER_PACKED12
+} OutputFormatType;
+
+typedef enum
+{
+	GST_FOCUS_METRIC_NONE,
+	GST_FOCUS_METRIC_LAPLACIAN,
+	GST_FOCUS_METRIC_TENENGRAD
+} FocusMetricType;
+
+// One band of rows of the frame statistics
+typedef struct
+{
+  const guint8 *raw;
+  gint width;
+  gint y0;
+  gint y1;
+  gint step;
+  guint32 hist[4][256];  // by Bayer site
+} GstLumeneraStatsJob;
+
+// A finished calibration capture, written out by its own thread
+typedef struct
+{
+  GstElement *element;  // ref held until the file is written
+  GstLumeneraCalKind kind;
+  guint32 *sum;
+  gchar *path;
+  guint frames;
+  gint width;
+  gint height;
+  GstLumeneraCalFrame *dark;  // subtracted from a flat field, or NULL
+  guint threshold;  // defect-threshold of a defect map
+} GstLumeneraCalJob;
+
+// A raw frame held in the arena, stamped when it arrived
+typedef struct
+{
+  guint64 timestamp;  // ns, as frame_timestamp
+  guint64 counter;
+  gboolean hw_timestamp;
+  gint64 arrival;  // monotonic us
+} GstLumeneraSlot;
+
+// Binned preview factors 2, 4 and 8, bit i of preview_factors is factor 2 << i
+#define GST_LUMENERA_PREVIEW_FACTORS 3
+
+// State of a preview_%u pad, its qdata, used by the streaming thread
+typedef struct
+{
+  guint factor;  // 0 until negotiated
+  gboolean started;  // stream-start and segment pushed
+  gint raw_width;  // of the frame it was negotiated for
+  gint raw_height;
+} GstLumeneraPreview;
+
+// Settings that are applied to the camera together at a frame boundary
+typedef struct
+{
+  volatile gint generation;  // 0 while the slot is being written
+  gfloat exposure;
+  gfloat gain;   // 0-100%
+  gfloat rgain;
+  gfloat ggain;
+  gfloat bgain;
+} GstLumeneraParams;
+
 struct _GstLumeneraSrc
 {
   GstPushSrc base_lumenera_src;
@@ -54,6 +165,7 @@ struct _GstLumeneraSrc
   LUCAM_CONVERSION_PARAMS conversionParams;
   LONG callbackID;  //
   volatile gboolean rgbImageOwnerIsProducer;
+  gboolean rgbImageFresh;  // rgbImage holds a converted frame not yet taken by create
 
   int lMemId;  // ID of the allocated memory
   int nWidth;
@@ -62,8 +174,9 @@ struct _GstLumeneraSrc
   int nBytesPerPixel;
   int nPitch;   // Stride in bytes between lines
   int nImageSize;  // Image size in bytes
+  OutputFormatType output;
 
-  unsigned char *rgbImage;
+  unsigned char *rgbImage;  // the output frame, RGB or (packed) Bayer
 
   gint gst_stride;  // Stride/pitch for the GStreamer buffer
 
@@ -80,18 +193,230 @@ struct _GstLumeneraSrc
   gint vflip;
   gint hflip;
   WhiteBalanceType whitebalance;
+  TriggerModeType triggermode;
+  gint triggerpin;
+  CaptureEngineType captureengine;
+  guint timeout;  // ms to wait for a frame before warning
+  guint refresh_interval;  // ms between reads of the camera state for get_property, 0 only after sets
+  guint control_lead;  // frames ahead that controlled properties are synced, to cover the sensor pipeline
+
+  // sensor readout, applied when the camera is opened
+  TapConfigurationType tap_configuration;
+  guint binning;
+  gchar *roi_string;
+  gint roi_x;
+  gint roi_y;
+  gint roi_width;  // 0 for the whole sensor
+  gint roi_height;
+  ULONG sensor_width;  // full sensor, as opened
+  ULONG sensor_height;
+  gchar *profile;  // lumenera-probe profile, applied on start
+  gchar *preferred_format;  // caps format from the profile, offered first
+  guint props_set;  // LU_SET_* of the properties the application set, a profile does not replace them
+
+  // triggered (fast frame) capture
+  LUCAM_SNAPSHOT snapshot;
+  gboolean fastFramesEnabled;
+  unsigned char *rawImage;  // raw frame returned by LucamTakeFastFrame or LucamTakeVideoEx
+  gboolean trigger_pending;  // a software trigger has been fired but its frame not yet taken
+  gint64 trigger_time;       // monotonic time (us) of the trigger for the frame being taken
+
+  // double buffered parameter block, written by set_property, read lock free by the streaming thread
+  GstLumeneraParams params[2];
+  GstLumeneraParams *params_current;  // published slot
+  GMutex params_lock;  // serialises writers, the poll thread also reads under it
+  gint params_generation;  // last generation published
+  gint params_applied;  // last generation applied to the camera, written by the streaming thread
+  GstLumeneraParams params_sent;  // last settings sent to the camera, streaming thread only
+  gboolean params_sent_valid;  // FALSE until the open camera has been sent all of them
+  gboolean params_tag_pending;  // next buffer is the first taken with the applied settings
+
+  // shadow of the camera state returned by get_property, refreshed by the poll thread
+  GstLumeneraParams shadow;  // protected by the object lock
+  gboolean shadow_valid;
+  GThread *poll_thread;
+  GMutex poll_lock;
+  GCond poll_cond;
+  gboolean poll_stop;
+  gboolean poll_now;  // refresh requested after settings were applied
+  gfloat temperature;  // sensor temperature, protected by the object lock
+  gboolean temperature_valid;
+
+  // 8 bit lookup table, loaded into the camera where the SDK supports it, otherwise applied to the raw frame
+  gchar *lut_string;
+  guint8 lut_tables[2][256];
+  guint8 *lut_current;  // published table, NULL when off, written under params_lock
+  volatile gboolean lut_in_camera;
+
+  // dual tap correction, state owned by the thread that receives raw frames
+  TapCorrectionType tapcorrection;
+  guint tap_frames;  // frames to calibrate from
+  volatile gint tap_recalibrate;
+  GstLumeneraTapStats tap_stats;
+  guint tap_frames_seen;
+  GstLumeneraTapCorrection tap;
+  gboolean tap_calibrated;
+
+  // dark frame, flat field and defect correction
+  GMutex cal_lock;  // protects the calibration frames and capture, held briefly per frame
+  gchar *dark_path;
+  gchar *flat_path;
+  gchar *defects_path;
+  GstLumeneraCalFrame *dark;
+  GstLumeneraCalFrame *flat;
+  GstLumeneraCalFrame *defects;
+  guint defect_threshold;
+  GstLumeneraCalKind cal_capture_kind;  // capture-calibration in progress while cal_capture_sum is set
+  gchar *cal_capture_path;
+  guint cal_capture_frames;
+  guint cal_capture_seen;
+  gint cal_capture_width;
+  gint cal_capture_height;
+  guint32 *cal_capture_sum;
+
+  // temporal accumulation, state owned by the thread that receives raw frames
+  guint accumulate_frames;
+  AccumulateModeType accumulate_mode;
+  volatile gint acc_reset;
+  AccumulateModeType acc_mode;  // mode and length src->acc was set up for
+  guint acc_length;
+  gpointer acc;  // guint16 or guint32 sums, or gfloat running average
+  gsize acc_size;
+  guint acc_seen;
+  guint acc_frames_out;  // frames combined into the last frame converted
+  guint acc_span;  // frame periods covered by the last frame converted
+
+  // frame statistics, computed on the thread that receives raw frames with help from stats_pool
+  gboolean frame_statistics;
+  guint statistics_subsample;
+  guint statistics_threads;
+  guint statistics_interval;  // ms between lumenera-frame-statistics messages
+  gint64 stats_posted;  // monotonic time of the last one
+  ULONG color_format;  // LUCAM_CF_*
+  GThreadPool *stats_pool;
+  GstLumeneraStatsJob *stats_jobs;
+  guint stats_n_jobs;
+  GMutex stats_lock;
+  GCond stats_cond;
+  guint stats_pending;  // jobs still running in the pool
+  GstLumeneraFrameStats stats;  // of the last frame converted
+  gboolean stats_valid;
+
+  // focus score, roi under the object lock
+  FocusMetricType focus_metric;
+  gchar *focus_roi_string;
+  gint focus_x;
+  gint focus_y;
+  gint focus_width;  // 0 for the whole frame
+  gint focus_height;
+  gdouble focus_score;  // of the last frame converted
+  gboolean focus_valid;
+  guint focus_interval;  // ms between lumenera-focus messages
+  gint64 focus_posted;  // monotonic time of the last one
+
+  // burst capture, raw frames into an arena at full rate, then converted and pushed at downstream's pace
+  guint burst_frames;  // 0 for off
+  gboolean burst_huge_pages;
+  gboolean burst_lock_memory;
+  GstLumeneraArena *arena;  // allocated by set_caps
+  gsize slot_size;
+  GstLumeneraSlot *slots;
+  volatile gint burst_captured;  // slots filled by the thread that receives raw frames
+  guint burst_pushed;
+  gint64 burst_push_start;  // monotonic us
+  GstClockTime burst_offset;  // of the last slot taken from the first
+  gdouble burst_capture_fps;  // under the object lock
+  gdouble burst_push_fps;
+
+  // pre-trigger ring, the last pretrigger_seconds of raw frames kept in the arena until a trigger releases
+  // them, live frames then follow through the ring. Positions under frame_lock.
+  gdouble pretrigger_seconds;  // 0 for off
+  guint ring_frames;  // slots, 0 when the arena is not a ring
+  guint ring_tail;  // oldest frame, held by create while it is converted
+  guint ring_count;
+  gboolean ring_released;
+  guint64 ring_seq;  // frames stored
+  guint64 ring_overruns;  // live frames dropped with the ring full
+  gint64 ring_arrival;  // of the last frame taken, monotonic us
+
+  // working frames (rgbImage, rawImage) and output buffers, allocated and faulted in by set_caps
+  gboolean frame_huge_pages;
+  gboolean frame_lock_memory;
+  GstLumeneraArena *work_arena;
+  GstAllocator *allocator;  // under the object lock, for the stats
+  GstBufferPool *pool;
+  gboolean work_huge_pages;  // as allocated, under the object lock
+  gboolean work_locked;
+
+  // decimation, camera frames skipped before any processing. Counted by the thread that receives frames,
+  // dec_span is handed over with the converted frame.
+  guint decimate;  // 1 for every frame
+  gint output_framerate_n;  // 0 for the camera's rate, overrides decimate
+  gint output_framerate_d;
+  guint dec_count;  // frames since the last one kept, decimate
+  gdouble dec_phase;  // output frames owed, in camera frames, output_framerate
+  guint dec_pending;  // frames skipped since the last frame converted
+  guint dec_span;  // frames skipped before the frame being pushed
+  guint64 n_decimated;
+
+  // preview_%u request pads, binned RGB made from the raw frame by the same call that converts it
+  GList *previews;  // of GstPad, under the object lock
+  guint preview_next;  // for the pad names
+  volatile gint preview_factors;  // wanted by some pad, set by create, read by the converting thread
+  guint preview_ready;  // rendered with the frame being pushed
+  guint8 *preview_image[GST_LUMENERA_PREVIEW_FACTORS];  // allocated by create before its factor is wanted
+
+  // CPU affinity and realtime priority of the threads that take and convert frames, applied by each thread
+  // the first time it runs. What each ended up with is under the object lock, for the stats.
+  gint capture_cpu;  // SDK callback and streaming threads, -1 for any
+  gchar *worker_cpus;  // statistics workers, NULL for any
+  gint realtime_priority;  // SCHED_FIFO priority, 0 for time-shared
+  GThread *streaming_thread;
+  GThread *callback_thread;
+  GstLumeneraThreadSched streaming_sched;
+  GstLumeneraThreadSaved streaming_saved;  // given back as the streaming task leaves the thread
+  GstLumeneraThreadSched callback_sched;
+  GstLumeneraThreadSched worker_sched;  // of the last worker scheduled
+  gboolean sched_warned;
+  gint frame_memory_node;  // NUMA node of the frame memory, -1 unknown, -2 not looked at yet
+
+  // frame metadata, written with the frame and read by create for the GstLumeneraFrameMeta
+  guint64 frame_counter;
+  guint64 frame_timestamp;  // ns
+  gboolean frame_hw_timestamp;
+  GstClockTime conversion_time;
+  guint64 timestamp_freq;  // camera timestamp ticks per second, 0 if the camera does not embed timestamps
 
   // stream
   gboolean acq_started;
+  GMutex frame_lock;  // protects the frame handoff, triggers and flushing
+  GCond frame_cond;
+  gboolean flushing;  // set by unlock to wake up the streaming thread
+  volatile gboolean playing;  // frames are only converted in PLAYING, the stream is kept running while PAUSED
+  guint stream_generation;  // bumped on pause so frames converted across a pause are not delivered
+  guint64 n_discarded;  // frames dropped unconverted while PAUSED
   gint n_frames;
   gint total_timeouts;
   GstClockTime duration;
   GstClockTime last_frame_time;
+
+  // stats, protected by the object lock
+  guint64 n_triggers;
+  guint64 n_triggers_ignored;
+  guint64 n_triggered_frames;
+  GstClockTime trigger_latency_last;
+  GstClockTime trigger_latency_min;
+  GstClockTime trigger_latency_max;
+  GstClockTime trigger_latency_total;
 };
 
 struct _GstLumeneraSrcClass
 {
   GstPushSrcClass base_lumenera_src_class;
+
+  // action signals
+  gboolean (*trigger) (GstLumeneraSrc * src);
+  gboolean (*capture_calibration) (GstLumeneraSrc * src, const gchar * kind, guint frames, const gchar * path);
 };
 
 GType gst_lumenera_src_get_type (void);
@@ -3,6 +3,8 @@
 #endif
 
 #include "gstlumenerasrc.h"
+#include "gstlumenerametaprivate.h"
+#include "gstlumenerabayerunpack.h"
 
 #define GST_CAT_DEFAULT gst_gstlumenera_debug
 GST_DEBUG_CATEGORY_STATIC (GST_CAT_DEFAULT);
@@ -13,11 +15,20 @@ plugin_init (GstPlugin * plugin)
   GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, "lumenerasrc", 0,
       "debug category for Lumenera elements");
 
+  // Register the meta APIs now so gst_buffer_get_lumenera_*_meta() can find them by name
+  gst_lumenera_frame_meta_api_get_type ();
+  gst_lumenera_stats_meta_api_get_type ();
+
   if (!gst_element_register (plugin, "lumenerasrc", GST_RANK_NONE,
           GST_TYPE_LU_SRC)) {
     return FALSE;
   }
 
+  if (!gst_element_register (plugin, "lumenerabayerunpack", GST_RANK_NONE,
+          GST_TYPE_LUMENERA_BAYER_UNPACK)) {
+    return FALSE;
+  }
+
   return TRUE;
 }
 
@@ -0,0 +1,520 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// Benchmarks of the conversion paths and of lumenerasrc itself, run by make bench.
+//
+// Each conversion is timed on its own for several frame sizes, then lumenerasrc is run into fakesink
+// against the simulated camera (see lucamsim.c) for each output format and number of statistics threads.
+// Results are written as JSON, one record per line, and compared with a baseline written earlier by
+// make bench-baseline on the same machine. The exit status is 1 if anything got slower than the tolerance.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h> // for memset
+#include <sys/resource.h> // for getrusage
+
+#include <gst/gst.h>
+
+#include "lucamapi.h"
+#include "gstlumeneraproc.h"
+#include "gstlumenerameta.h"
+
+#define LU_BENCH_REPEATS        3       // best of, for the conversions
+#define LU_BENCH_PIPELINE_FPS   200     // highest maxframerate lumenerasrc accepts
+#define LU_BENCH_KEY_LEN        64
+
+typedef struct {
+	gint width, height;
+} LuBenchSize;
+
+static const LuBenchSize sizes[] = {
+	{ 640, 480 }, { 1392, 1040 }, { 1920, 1080 }, { 2448, 2048 },
+};
+
+static const guint thread_counts[] = { 1, 2, 4 };
+
+typedef struct {
+	gchar key[LU_BENCH_KEY_LEN];
+	gdouble ns_per_frame;
+} LuBenchResult;
+
+static gint frames = 100;
+static gchar *output_path = NULL;
+static gchar *baseline_path = NULL;
+static gdouble tolerance = 10.0;
+static gboolean no_pipeline = FALSE;
+
+static FILE *out;
+static gboolean first_record = TRUE;
+static GArray *results;
+static guint failures = 0;  // benchmarks that recorded nothing
+
+static GOptionEntry entries[] = {
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames per measurement", "N" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &output_path, "Write the results to FILE instead of stdout", "FILE" },
+	{ "baseline", 'b', 0, G_OPTION_ARG_FILENAME, &baseline_path, "Compare with the results in FILE", "FILE" },
+	{ "tolerance", 't', 0, G_OPTION_ARG_DOUBLE, &tolerance, "Percent slower than the baseline that counts as a regression", "PERCENT" },
+	{ "no-pipeline", 0, 0, G_OPTION_ARG_NONE, &no_pipeline, "Only time the conversions, not lumenerasrc", NULL },
+	{ NULL }
+};
+
+//
+// One line per result. The first four fields identify the measurement and ns_per_frame is compared,
+// keep them first and in this order so the baseline can be read back with sscanf.
+//
+static void
+bench_record (const gchar * bench, gint width, gint height, guint threads, gdouble ns_per_frame, const gchar * extra)
+{
+	LuBenchResult r;
+
+	fprintf (out, "%s{\"bench\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %u, \"ns_per_frame\": %.0f, \"fps\": %.2f%s%s}",
+			first_record ? "[\n" : ",\n", bench, width, height, threads, ns_per_frame,
+			ns_per_frame > 0 ? 1e9 / ns_per_frame : 0.0, extra ? ", " : "", extra ? extra : "");
+	fflush (out);
+	first_record = FALSE;
+
+	g_snprintf (r.key, sizeof (r.key), "%s %dx%d %u", bench, width, height, threads);
+	r.ns_per_frame = ns_per_frame;
+	g_array_append_val (results, r);
+
+	if (out != stdout)
+		g_print ("%-40s %12.0f ns/frame %10.1f fps\n", r.key, ns_per_frame, ns_per_frame > 0 ? 1e9 / ns_per_frame : 0.0);
+}
+
+//
+// Conversions, timed on the calling thread
+//
+
+typedef struct {
+	gint width, height;
+	gsize n;
+	guint8 *raw;            // 8 bit Bayer
+	guint16 *raw16;         // 16 bit MSB aligned Bayer
+	guint8 *dst;            // big enough for RGB24
+	guint16 *dst16;
+	guint8 *packed;
+	guint32 *sum;
+	guint8 lut[256];
+	HANDLE cam;
+} LuBenchFrame;
+
+typedef void (*LuBenchFunc) (LuBenchFrame * f);
+
+static void
+bench_sdk_rgb24 (LuBenchFrame * f)
+{
+	LUCAM_IMAGE_FORMAT format = { sizeof (LUCAM_IMAGE_FORMAT), f->width, f->height, LUCAM_PF_8, f->n };
+	LUCAM_CONVERSION_PARAMS params;
+
+	memset (&params, 0, sizeof (params));
+	params.Size = sizeof (params);
+	params.DemosaicMethod = LUCAM_DM_FAST;
+	params.CorrectionMatrix = LUCAM_CM_NONE;
+	params.UseColorGainsOverWb = TRUE;
+	params.DigitalGainRed = params.DigitalGainGreen = params.DigitalGainBlue = 1;
+	LucamConvertFrameToRgb24Ex (f->cam, f->dst, f->raw, &format, &params);
+}
+
+static void
+bench_bayer8 (LuBenchFrame * f)
+{
+	memcpy (f->dst, f->raw, f->n);
+}
+
+static void
+bench_raw_lut (LuBenchFrame * f)
+{
+	gst_lumenera_proc_raw (f->dst, f->raw, f->width, f->height, NULL, NULL, NULL, f->lut);
+}
+
+static void
+bench_pack10 (LuBenchFrame * f)
+{
+	gst_lumenera_proc_pack10 (f->packed, f->raw16, f->n, 16 - 10);
+}
+
+static void
+bench_pack12 (LuBenchFrame * f)
+{
+	gst_lumenera_proc_pack12 (f->packed, f->raw16, f->n, 16 - 12);
+}
+
+static void
+bench_unpack12 (LuBenchFrame * f)
+{
+	gst_lumenera_proc_unpack12 (f->dst16, f->packed, f->n);
+}
+
+static void
+bench_accumulate (LuBenchFrame * f)
+{
+	gst_lumenera_proc_accumulate (f->sum, f->raw, f->n);
+}
+
+static void
+bench_histogram (LuBenchFrame * f)
+{
+	guint32 hist[4][256];
+
+	memset (hist, 0, sizeof (hist));
+	gst_lumenera_proc_histogram (hist, f->raw, f->width, 0, f->height, 1);
+}
+
+static const struct {
+	const gchar *name;
+	LuBenchFunc func;
+	gboolean needs_camera;
+} conversions[] = {
+	{ "sdk-rgb24", bench_sdk_rgb24, TRUE },
+	{ "bayer8", bench_bayer8, FALSE },
+	{ "raw-lut", bench_raw_lut, FALSE },
+	{ "pack10", bench_pack10, FALSE },
+	{ "pack12", bench_pack12, FALSE },
+	{ "unpack12", bench_unpack12, FALSE },
+	{ "accumulate", bench_accumulate, FALSE },
+	{ "histogram", bench_histogram, FALSE },
+};
+
+static void
+bench_conversions (HANDLE cam)
+{
+	guint s, c, rep;
+	gint i;
+
+	for (s = 0; s < G_N_ELEMENTS (sizes); s++) {
+		LuBenchFrame f;
+		gsize p;
+
+		f.width = sizes[s].width;
+		f.height = sizes[s].height;
+		f.n = (gsize) f.width * f.height;
+		f.raw = g_malloc (f.n);
+		f.raw16 = g_malloc (f.n * 2);
+		f.dst = g_malloc (f.n * 3);
+		f.dst16 = g_malloc (f.n * 2);
+		f.packed = g_malloc (f.n * 3 / 2);
+		f.sum = g_malloc0 (f.n * 4);
+		f.cam = cam;
+		gst_lumenera_proc_lut_gamma (f.lut, 0.45);
+		for (p = 0; p < f.n; p++) {
+			f.raw[p] = (p * 7 + p / f.width * 3) & 0xff;
+			f.raw16[p] = f.raw[p] << 8 | f.raw[p];
+		}
+		gst_lumenera_proc_pack12 (f.packed, f.raw16, f.n, 4);
+
+		for (c = 0; c < G_N_ELEMENTS (conversions); c++) {
+			gdouble best = G_MAXDOUBLE;
+
+			if (conversions[c].needs_camera && !cam)
+				continue;
+
+			conversions[c].func (&f);  // warm the caches and fault the pages in
+			for (rep = 0; rep < LU_BENCH_REPEATS; rep++) {
+				gint64 t0 = g_get_monotonic_time ();
+
+				for (i = 0; i < frames; i++)
+					conversions[c].func (&f);
+				best = MIN (best, (g_get_monotonic_time () - t0) * 1000.0 / frames);
+			}
+			bench_record (conversions[c].name, f.width, f.height, 1, best, NULL);
+		}
+
+		g_free (f.raw);
+		g_free (f.raw16);
+		g_free (f.dst);
+		g_free (f.dst16);
+		g_free (f.packed);
+		g_free (f.sum);
+	}
+}
+
+//
+// lumenerasrc into fakesink
+//
+
+typedef struct {
+	GArray *latency;        // ns from frame arrival to the buffer leaving create, gint64
+	guint64 bytes;
+} LuBenchRun;
+
+static GstPadProbeReturn
+bench_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	LuBenchRun *run = user_data;
+	GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER (info);
+	GstLumeneraFrameMeta *meta = gst_buffer_get_lumenera_frame_meta (buf);
+
+	// The simulated camera has no hardware timestamps, arrival is on the host monotonic clock
+	if (meta && !meta->hw_timestamp) {
+		gint64 latency = g_get_monotonic_time () * GST_USECOND - meta->timestamp;
+
+		g_array_append_val (run->latency, latency);
+	}
+	run->bytes += gst_buffer_get_size (buf);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static gint
+bench_compare_int64 (gconstpointer a, gconstpointer b)
+{
+	gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static gint64
+bench_percentile (GArray * a, gdouble p)
+{
+	if (!a->len)
+		return 0;
+	return g_array_index (a, gint64, MIN ((guint) (a->len * p), a->len - 1));
+}
+
+static gint64
+bench_cpu_time_us (void)
+{
+	struct rusage ru;
+
+	getrusage (RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * G_USEC_PER_SEC + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+//
+// ns_per_frame is the process CPU time per frame, the camera sets the frame rate so wall time would
+// say nothing about the element. fps is what was achieved, below the camera's rate if frames were lost.
+//
+static gboolean
+bench_pipeline (const gchar * name, gint width, gint height, const gchar * caps, const gchar * props, guint threads)
+{
+	GstElement *pipeline, *src;
+	GstPad *pad;
+	GstBus *bus;
+	GstMessage *msg;
+	GError *error = NULL;
+	LuBenchRun run = { g_array_new (FALSE, FALSE, sizeof (gint64)), 0 };
+	gchar *desc, *w, *h, *extra;
+	gint64 t0, cpu0, wall, cpu;
+	gboolean ok = FALSE;
+
+	w = g_strdup_printf ("%d", width);
+	h = g_strdup_printf ("%d", height);
+	g_setenv ("LUCAMSIM_WIDTH", w, TRUE);
+	g_setenv ("LUCAMSIM_HEIGHT", h, TRUE);
+	g_free (w);
+	g_free (h);
+
+	desc = g_strdup_printf ("lumenerasrc name=src num-buffers=%d exposure=1 maxframerate=%d %s ! %s ! fakesink sync=false",
+			frames, LU_BENCH_PIPELINE_FPS, props ? props : "", caps);
+	pipeline = gst_parse_launch (desc, &error);
+	g_free (desc);
+	if (!pipeline) {
+		g_printerr ("%s: %s\n", name, error->message);
+		g_clear_error (&error);
+		g_array_free (run.latency, TRUE);
+		failures++;
+		return FALSE;
+	}
+
+	src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+	pad = gst_element_get_static_pad (src, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, bench_probe, &run, NULL);
+	gst_object_unref (pad);
+	gst_object_unref (src);
+
+	t0 = g_get_monotonic_time ();
+	cpu0 = bench_cpu_time_us ();
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+	bus = gst_element_get_bus (pipeline);
+	msg = gst_bus_timed_pop_filtered (bus, (GstClockTime) (frames * 10 + 30) * GST_SECOND / 10,
+			GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	wall = g_get_monotonic_time () - t0;
+	cpu = bench_cpu_time_us () - cpu0;
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+
+	if (!msg)
+		g_printerr ("%s: timed out after %" G_GINT64_FORMAT " frames\n", name, (gint64) run.latency->len);
+	else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+		gst_message_parse_error (msg, &error, NULL);
+		g_printerr ("%s: %s\n", name, error->message);
+		g_clear_error (&error);
+	}
+	else if (run.latency->len) {
+		g_array_sort (run.latency, bench_compare_int64);
+		extra = g_strdup_printf ("\"wall_fps\": %.2f, \"latency_p50_ns\": %" G_GINT64_FORMAT ", \"latency_p99_ns\": %"
+				G_GINT64_FORMAT ", \"latency_max_ns\": %" G_GINT64_FORMAT ", \"bytes_per_frame\": %" G_GUINT64_FORMAT,
+				run.latency->len * (gdouble) G_USEC_PER_SEC / wall, bench_percentile (run.latency, 0.5),
+				bench_percentile (run.latency, 0.99), bench_percentile (run.latency, 1.0), run.bytes / run.latency->len);
+		bench_record (name, width, height, threads, cpu * 1000.0 / run.latency->len, extra);
+		g_free (extra);
+		ok = TRUE;
+	}
+	else
+		g_printerr ("%s: no frames\n", name);
+
+	if (!ok)
+		failures++;
+
+	if (msg)
+		gst_message_unref (msg);
+	gst_object_unref (bus);
+	gst_object_unref (pipeline);
+	g_array_free (run.latency, TRUE);
+
+	return ok;
+}
+
+static void
+bench_pipelines (void)
+{
+	guint s, t;
+
+	// Fast enough that lumenerasrc's maxframerate is the limit, not the simulated sensor
+	g_setenv ("LUCAMSIM_FPS", "1000", FALSE);
+
+	for (s = 0; s < G_N_ELEMENTS (sizes); s++) {
+		gint w = sizes[s].width, h = sizes[s].height;
+
+		bench_pipeline ("pipeline-rgb", w, h, "video/x-raw,format=RGB", NULL, 1);
+		bench_pipeline ("pipeline-bayer8", w, h, "video/x-bayer,format=rggb", NULL, 1);
+		bench_pipeline ("pipeline-bayer12p", w, h, "video/x-bayer,format=rggb12p", NULL, 1);
+		bench_pipeline ("pipeline-rgb-pull", w, h, "video/x-raw,format=RGB", "capture-engine=pull", 1);
+		for (t = 0; t < G_N_ELEMENTS (thread_counts); t++) {
+			gchar *props = g_strdup_printf ("frame-statistics=true statistics-threads=%u", thread_counts[t]);
+
+			bench_pipeline ("pipeline-rgb-statistics", w, h, "video/x-raw,format=RGB", props, thread_counts[t]);
+			g_free (props);
+		}
+	}
+}
+
+//
+// Compare with the baseline, returns the number of regressions. A measurement in the baseline that
+// this run did not make is one too, as is having no baseline at all: the gate must not pass on nothing.
+//
+static guint
+bench_compare (const gchar * path)
+{
+	gchar *contents, **lines, **l;
+	GError *error = NULL;
+	guint i, regressions = 0, compared = 0;
+
+	if (!g_file_get_contents (path, &contents, NULL, &error)) {
+		g_printerr ("No baseline, nothing compared: %s\nRecord one with make bench-baseline\n", error->message);
+		g_clear_error (&error);
+		return 1;
+	}
+
+	g_print ("\nCompared with %s, tolerance %.0f%%:\n", path, tolerance);
+	lines = g_strsplit (contents, "\n", -1);
+	for (l = lines; *l; l++) {
+		gchar bench[LU_BENCH_KEY_LEN], key[LU_BENCH_KEY_LEN];
+		gint width, height;
+		guint threads;
+		gdouble ns;
+
+		if (sscanf (*l, "{\"bench\": \"%40[^\"]\", \"width\": %d, \"height\": %d, \"threads\": %u, \"ns_per_frame\": %lf",
+				bench, &width, &height, &threads, &ns) != 5)
+			continue;
+		g_snprintf (key, sizeof (key), "%s %dx%d %u", bench, width, height, threads);
+		if (no_pipeline && g_str_has_prefix (bench, "pipeline-"))
+			continue;
+
+		for (i = 0; i < results->len; i++) {
+			LuBenchResult *r = &g_array_index (results, LuBenchResult, i);
+			gdouble change;
+
+			if (strcmp (r->key, key))
+				continue;
+			change = ns > 0 ? (r->ns_per_frame - ns) * 100 / ns : 0;
+			compared++;
+			if (change > tolerance) {
+				regressions++;
+				g_print ("  REGRESSION %-40s %12.0f -> %12.0f ns/frame (%+.1f%%)\n", key, ns, r->ns_per_frame, change);
+			}
+			else if (change < -tolerance)
+				g_print ("  faster     %-40s %12.0f -> %12.0f ns/frame (%+.1f%%)\n", key, ns, r->ns_per_frame, change);
+			break;
+		}
+		if (i == results->len) {
+			regressions++;
+			g_print ("  MISSING    %-40s %12.0f ns/frame in the baseline, not measured\n", key, ns);
+		}
+	}
+	g_print ("%u compared, %u regressions\n", compared, regressions);
+
+	g_strfreev (lines);
+	g_free (contents);
+	return regressions;
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	HANDLE cam;
+	guint regressions = 0;
+
+	context = g_option_context_new ("- benchmark lumenerasrc and its conversions");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		return 2;
+	}
+	g_option_context_free (context);
+	frames = MAX (frames, 1);
+
+	out = output_path ? fopen (output_path, "w") : stdout;
+	if (!out) {
+		g_printerr ("Could not write %s\n", output_path);
+		return 2;
+	}
+	results = g_array_new (FALSE, FALSE, sizeof (LuBenchResult));
+
+	// The camera is only needed for its conversion, closed before lumenerasrc opens it
+	cam = LucamCameraOpen (1);
+	if (!cam)
+		g_printerr ("No camera, sdk-rgb24 skipped\n");
+	bench_conversions (cam);
+	if (cam)
+		LucamCameraClose (cam);
+
+	if (!no_pipeline)
+		bench_pipelines ();
+
+	fprintf (out, first_record ? "[]\n" : "\n]\n");
+	if (out != stdout)
+		fclose (out);
+
+	if (baseline_path)
+		regressions = bench_compare (baseline_path);
+	if (failures)
+		g_printerr ("%u benchmarks failed\n", failures);
+
+	g_array_free (results, TRUE);
+	return (regressions || failures) ? 1 : 0;
+}
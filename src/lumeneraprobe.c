@@ -0,0 +1,507 @@
+/* GStreamer lumenera Plugin
+ * Copyright (C) 2014 Gray Cancer Institute
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+//
+// lumenera-probe: find which readout and output configurations this host keeps up with.
+//
+// Runs lumenerasrc into fakesink for every combination of tap configuration, binning, roi, output format
+// and capture engine asked for, on the attached camera or the simulator, and measures the rate the camera
+// produced, the rate delivered, the frames lost in between and the CPU time per frame. Prints a table,
+// optionally writes the results as JSON, and writes a profile for lumenerasrc's profile property naming
+// the fastest configuration that lost no more than --max-drop percent of the frames.
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h> // for atoi
+#include <string.h> // for strcmp
+#include <sys/resource.h> // for getrusage
+
+#include <gst/gst.h>
+
+#include "lucamapi.h"
+#include "gstlumenerameta.h"
+
+typedef struct {
+	const gchar *name;
+	const gchar *caps;
+} LuProbeFormat;
+
+static const LuProbeFormat formats[] = {
+	{ "rgb", "video/x-raw,format=RGB" },
+	{ "bayer8", "video/x-bayer,format=(string){rggb,grbg,gbrg,bggr}" },
+	{ "bayer10p", "video/x-bayer,format=(string){rggb10p,grbg10p,gbrg10p,bggr10p}" },
+	{ "bayer12p", "video/x-bayer,format=(string){rggb12p,grbg12p,gbrg12p,bggr12p}" },
+};
+
+typedef struct {
+	// configuration
+	gchar *taps;
+	guint binning;
+	gchar *roi_name;
+	gchar *roi;             // x,y,width,height or NULL for the whole sensor
+	const LuProbeFormat *format;
+	gchar *engine;
+
+	// results
+	gboolean ran;
+	gchar *error;           // why the configuration could not be used
+	gchar *caps_format;     // what was negotiated
+	guint frames;
+	gdouble camera_fps;     // from the spacing of the capture timestamps
+	gdouble delivered_fps;  // buffers out of lumenerasrc per second
+	gdouble drop_rate;      // frames the camera produced that never left lumenerasrc
+	gdouble cpu_ns_per_frame;
+	gboolean viable;
+} LuProbeConfig;
+
+typedef struct {
+	GArray *timestamps;     // capture time (ns) of each buffer, guint64
+	gint64 first, last;     // monotonic time (us) of the first and last buffer
+} LuProbeRun;
+
+static gint frames = 150;
+static gdouble max_drop = 1.0;
+static gdouble exposure = 1.0;
+static gdouble maxframerate = 200;
+static gchar *taps_list = "single,dual,quad";
+static gchar *binning_list = "1,2";
+static gchar **roi_list = NULL;
+static gchar *formats_list = "rgb,bayer8,bayer12p";
+static gchar *engines_list = "callback,pull";
+static gchar *json_path = NULL;
+static gchar *profile_path = NULL;
+
+static GOptionEntry entries[] = {
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Frames per configuration (150)", "N" },
+	{ "max-drop", 'd', 0, G_OPTION_ARG_DOUBLE, &max_drop, "Percent of frames that may be lost in a viable configuration (1)", "PERCENT" },
+	{ "exposure", 'e', 0, G_OPTION_ARG_DOUBLE, &exposure, "Exposure (ms), short so readout sets the rate (1)", "MS" },
+	{ "maxframerate", 'm', 0, G_OPTION_ARG_DOUBLE, &maxframerate, "lumenerasrc maxframerate (200)", "FPS" },
+	{ "taps", 0, 0, G_OPTION_ARG_STRING, &taps_list, "Tap configurations (single,dual,quad)", "LIST" },
+	{ "binning", 0, 0, G_OPTION_ARG_STRING, &binning_list, "Binning factors (1,2)", "LIST" },
+	{ "roi", 0, 0, G_OPTION_ARG_STRING_ARRAY, &roi_list, "Region: full, half, quarter (centred) or x,y,width,height, "
+			"repeat for several (full and half)", "ROI" },
+	{ "formats", 0, 0, G_OPTION_ARG_STRING, &formats_list, "Output formats: rgb, bayer8, bayer10p, bayer12p (rgb,bayer8,bayer12p)", "LIST" },
+	{ "engines", 0, 0, G_OPTION_ARG_STRING, &engines_list, "Capture engines (callback,pull)", "LIST" },
+	{ "json", 'j', 0, G_OPTION_ARG_FILENAME, &json_path, "Write every result to FILE as JSON", "FILE" },
+	{ "profile", 'o', 0, G_OPTION_ARG_FILENAME, &profile_path, "Write a profile for lumenerasrc's profile property to FILE", "FILE" },
+	{ NULL }
+};
+
+static gint64
+probe_cpu_time_us (void)
+{
+	struct rusage ru;
+
+	getrusage (RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * G_USEC_PER_SEC + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static GstPadProbeReturn
+probe_buffer (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	LuProbeRun *run = user_data;
+	GstLumeneraFrameMeta *meta = gst_buffer_get_lumenera_frame_meta (GST_PAD_PROBE_INFO_BUFFER (info));
+
+	run->last = g_get_monotonic_time ();
+	if (!run->timestamps->len)
+		run->first = run->last;
+	if (meta)
+		g_array_append_val (run->timestamps, meta->timestamp);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static gint
+probe_compare_uint64 (gconstpointer a, gconstpointer b)
+{
+	guint64 x = *(const guint64 *) a, y = *(const guint64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+//
+// The camera's frame period is the median spacing of the capture timestamps, a gap of n periods
+// means n - 1 frames were lost
+//
+static void
+probe_analyse (LuProbeConfig * c, LuProbeRun * run)
+{
+	GArray *gaps;
+	gdouble period, lost = 0;
+	guint i;
+
+	c->frames = run->timestamps->len;
+	if (c->frames < 3)
+		return;
+
+	gaps = g_array_sized_new (FALSE, FALSE, sizeof (guint64), c->frames - 1);
+	for (i = 1; i < c->frames; i++) {
+		guint64 gap = g_array_index (run->timestamps, guint64, i) - g_array_index (run->timestamps, guint64, i - 1);
+
+		g_array_append_val (gaps, gap);
+	}
+	g_array_sort (gaps, probe_compare_uint64);
+	period = MAX (g_array_index (gaps, guint64, gaps->len / 2), 1);
+	for (i = 0; i < gaps->len; i++)
+		lost += MAX ((gint64) (g_array_index (gaps, guint64, i) / period + 0.5) - 1, 0);
+	g_array_free (gaps, TRUE);
+
+	c->camera_fps = GST_SECOND / period;
+	c->drop_rate = lost / (c->frames + lost);
+	if (run->last > run->first)
+		c->delivered_fps = (c->frames - 1) * (gdouble) G_USEC_PER_SEC / (run->last - run->first);
+}
+
+static void
+probe_run (LuProbeConfig * c)
+{
+	GstElement *pipeline, *src;
+	GstPad *pad;
+	GstBus *bus;
+	GstCaps *caps = NULL;
+	GError *error = NULL;
+	LuProbeRun run = { g_array_new (FALSE, FALSE, sizeof (guint64)), 0, 0 };
+	gchar *desc;
+	gint64 cpu0;
+	gboolean done = FALSE;
+
+	desc = g_strdup_printf ("lumenerasrc name=src num-buffers=%d exposure=%f maxframerate=%f tap-configuration=%s binning=%u "
+			"roi=\"%s\" capture-engine=%s ! %s ! fakesink sync=false", frames, exposure, maxframerate, c->taps, c->binning,
+			c->roi ? c->roi : "", c->engine, c->format->caps);
+	pipeline = gst_parse_launch (desc, &error);
+	g_free (desc);
+	if (!pipeline) {
+		c->error = g_strdup (error->message);
+		g_clear_error (&error);
+		g_array_free (run.timestamps, TRUE);
+		return;
+	}
+
+	src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+	pad = gst_element_get_static_pad (src, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, probe_buffer, &run, NULL);
+
+	cpu0 = probe_cpu_time_us ();
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+	// A warning from lumenerasrc means the camera did not take the configuration as asked
+	bus = gst_element_get_bus (pipeline);
+	while (!done) {
+		GstMessage *msg = gst_bus_timed_pop_filtered (bus, (GstClockTime) (frames / 10 + 10) * GST_SECOND,
+				GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_WARNING);
+
+		if (!msg) {
+			c->error = g_strdup_printf ("timed out after %u frames", run.timestamps->len);
+			break;
+		}
+		switch (GST_MESSAGE_TYPE (msg)) {
+		case GST_MESSAGE_EOS:
+			done = TRUE;
+			break;
+		case GST_MESSAGE_ERROR:
+			done = TRUE;
+			// fall through
+		case GST_MESSAGE_WARNING:
+			if (!c->error) {
+				if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+					gst_message_parse_error (msg, &error, NULL);
+				else
+					gst_message_parse_warning (msg, &error, NULL);
+				c->error = g_strdup (error->message);
+				g_clear_error (&error);
+			}
+			break;
+		default:
+			break;
+		}
+		gst_message_unref (msg);
+	}
+
+	caps = gst_pad_get_current_caps (pad);
+	if (caps) {
+		c->caps_format = g_strdup (gst_structure_get_string (gst_caps_get_structure (caps, 0), "format"));
+		gst_caps_unref (caps);
+	}
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+
+	probe_analyse (c, &run);
+	if (c->frames)
+		c->cpu_ns_per_frame = (probe_cpu_time_us () - cpu0) * 1000.0 / c->frames;
+	c->ran = TRUE;
+	c->viable = !c->error && c->frames >= (guint) frames && c->drop_rate * 100 <= max_drop;
+
+	gst_object_unref (bus);
+	gst_object_unref (pad);
+	gst_object_unref (src);
+	gst_object_unref (pipeline);
+	g_array_free (run.timestamps, TRUE);
+}
+
+//
+// full, half, quarter or x,y,width,height to what lumenerasrc's roi property takes, NULL for the whole sensor
+//
+static gchar *
+probe_roi (const gchar * name, gint sensor_width, gint sensor_height)
+{
+	gint div;
+
+	if (!strcmp (name, "full"))
+		return NULL;
+	if (!strcmp (name, "half"))
+		div = 2;
+	else if (!strcmp (name, "quarter"))
+		div = 4;
+	else
+		return g_strdup (name);
+
+	return g_strdup_printf ("%d,%d,%d,%d", (sensor_width - sensor_width / div) / 2, (sensor_height - sensor_height / div) / 2,
+			sensor_width / div, sensor_height / div);
+}
+
+//
+// Fastest delivered, then least CPU among those within 1% of it
+//
+static LuProbeConfig *
+probe_best (GPtrArray * configs)
+{
+	LuProbeConfig *best = NULL;
+	guint i;
+
+	for (i = 0; i < configs->len; i++) {
+		LuProbeConfig *c = g_ptr_array_index (configs, i);
+
+		if (!c->viable)
+			continue;
+		if (!best || c->delivered_fps > best->delivered_fps * 1.01
+				|| (c->delivered_fps >= best->delivered_fps * 0.99 && c->cpu_ns_per_frame < best->cpu_ns_per_frame))
+			best = c;
+	}
+	return best;
+}
+
+static void
+probe_print_row (LuProbeConfig * c)
+{
+	g_print ("%-7s %3u  %-22s %-9s %-8s ", c->taps, c->binning, c->roi ? c->roi : "full", c->caps_format ? c->caps_format : c->format->name,
+			c->engine);
+	if (c->frames)
+		g_print ("%8.1f %9.1f %6.2f%% %9.0f  %s\n", c->camera_fps, c->delivered_fps, c->drop_rate * 100, c->cpu_ns_per_frame / 1000,
+				c->viable ? "yes" : "no");
+	else
+		g_print ("%8s %9s %7s %9s  no\n", "-", "-", "-", "-");
+	if (c->error)
+		g_print ("        %s\n", c->error);
+}
+
+static void
+probe_write_json (GPtrArray * configs, const gchar * path)
+{
+	FILE *f = fopen (path, "w");
+	guint i;
+
+	if (!f) {
+		g_printerr ("Could not write %s\n", path);
+		return;
+	}
+
+	fprintf (f, "[\n");
+	for (i = 0; i < configs->len; i++) {
+		LuProbeConfig *c = g_ptr_array_index (configs, i);
+
+		fprintf (f, "{\"tap-configuration\": \"%s\", \"binning\": %u, \"roi\": \"%s\", \"format\": \"%s\", \"capture-engine\": \"%s\", "
+				"\"frames\": %u, \"camera_fps\": %.2f, \"delivered_fps\": %.2f, \"drop_rate\": %.4f, \"cpu_ns_per_frame\": %.0f, "
+				"\"viable\": %s}%s\n", c->taps, c->binning, c->roi ? c->roi : "", c->caps_format ? c->caps_format : c->format->name,
+				c->engine, c->frames, c->camera_fps, c->delivered_fps, c->drop_rate, c->cpu_ns_per_frame,
+				c->viable ? "true" : "false", i + 1 < configs->len ? "," : "");
+	}
+	fprintf (f, "]\n");
+	fclose (f);
+}
+
+static void
+probe_set_config (GKeyFile * kf, const gchar * group, LuProbeConfig * c)
+{
+	g_key_file_set_string (kf, group, "tap-configuration", c->taps);
+	g_key_file_set_integer (kf, group, "binning", c->binning);
+	g_key_file_set_string (kf, group, "roi", c->roi ? c->roi : "");
+	g_key_file_set_string (kf, group, "format", c->caps_format ? c->caps_format : "");
+	g_key_file_set_string (kf, group, "capture-engine", c->engine);
+	g_key_file_set_double (kf, group, "camera-fps", c->camera_fps);
+	g_key_file_set_double (kf, group, "delivered-fps", c->delivered_fps);
+	g_key_file_set_double (kf, group, "drop-rate", c->drop_rate);
+	g_key_file_set_double (kf, group, "cpu-ns-per-frame", c->cpu_ns_per_frame);
+	g_key_file_set_boolean (kf, group, "viable", c->viable);
+}
+
+static gboolean
+probe_write_profile (GPtrArray * configs, LuProbeConfig * best, gint sensor_width, gint sensor_height, const gchar * path)
+{
+	GKeyFile *kf = g_key_file_new ();
+	GDateTime *now = g_date_time_new_now_local ();
+	gchar *date = g_date_time_format (now, "%Y-%m-%dT%H:%M:%S%z");
+	GError *error = NULL;
+	gboolean ok;
+	guint i;
+
+	g_key_file_set_comment (kf, NULL, NULL, " Written by lumenera-probe, use with lumenerasrc profile=<this file>", NULL);
+	g_key_file_set_string (kf, "probe", "host", g_get_host_name ());
+	g_key_file_set_string (kf, "probe", "date", date);
+	g_key_file_set_integer (kf, "probe", "sensor-width", sensor_width);
+	g_key_file_set_integer (kf, "probe", "sensor-height", sensor_height);
+	g_key_file_set_integer (kf, "probe", "frames", frames);
+	g_key_file_set_double (kf, "probe", "max-drop-rate", max_drop / 100);
+	probe_set_config (kf, "recommended", best);
+	for (i = 0; i < configs->len; i++) {
+		gchar *group = g_strdup_printf ("config-%u", i);
+
+		probe_set_config (kf, group, g_ptr_array_index (configs, i));
+		g_free (group);
+	}
+
+	ok = g_key_file_save_to_file (kf, path, &error);
+	if (!ok) {
+		g_printerr ("Could not write %s: %s\n", path, error->message);
+		g_clear_error (&error);
+	}
+
+	g_free (date);
+	g_date_time_unref (now);
+	g_key_file_free (kf);
+	return ok;
+}
+
+static void
+probe_config_free (LuProbeConfig * c)
+{
+	g_free (c->taps);
+	g_free (c->roi_name);
+	g_free (c->roi);
+	g_free (c->engine);
+	g_free (c->error);
+	g_free (c->caps_format);
+	g_free (c);
+}
+
+int
+main (int argc, char *argv[])
+{
+	static gchar *default_rois[] = { "full", "half", NULL };
+	GOptionContext *context;
+	GError *error = NULL;
+	GPtrArray *configs;
+	LuProbeConfig *best;
+	HANDLE cam;
+	gchar **taps, **binnings, **fmts, **engines, **t, **b, **r, **f, **e;
+	gint sensor_width, sensor_height;
+	float value;
+	LONG flags;
+	guint i;
+
+	context = g_option_context_new ("- find the fastest lumenerasrc configuration this host keeps up with");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		return 2;
+	}
+	g_option_context_free (context);
+	frames = MAX (frames, 10);
+
+	// The sensor size, for the regions and to tie the profile to the camera, closed before lumenerasrc opens it
+	cam = LucamCameraOpen (1);
+	if (!cam) {
+		g_printerr ("No camera found\n");
+		return 2;
+	}
+	sensor_width = LucamGetProperty (cam, LUCAM_PROP_MAX_WIDTH, &value, &flags) ? (gint) value : 0;
+	sensor_height = LucamGetProperty (cam, LUCAM_PROP_MAX_HEIGHT, &value, &flags) ? (gint) value : 0;
+	if (!sensor_width || !sensor_height) {
+		LUCAM_FRAME_FORMAT format;
+
+		LucamGetFormat (cam, &format, &value);
+		sensor_width = format.xOffset + format.width;
+		sensor_height = format.yOffset + format.height;
+	}
+	LucamCameraClose (cam);
+
+	taps = g_strsplit (taps_list, ",", -1);
+	binnings = g_strsplit (binning_list, ",", -1);
+	fmts = g_strsplit (formats_list, ",", -1);
+	engines = g_strsplit (engines_list, ",", -1);
+	configs = g_ptr_array_new_with_free_func ((GDestroyNotify) probe_config_free);
+
+	for (t = taps; *t; t++)
+		for (b = binnings; *b; b++)
+			for (r = roi_list ? roi_list : default_rois; *r; r++)
+				for (f = fmts; *f; f++)
+					for (e = engines; *e; e++) {
+						LuProbeConfig *c = g_new0 (LuProbeConfig, 1);
+
+						for (i = 0; i < G_N_ELEMENTS (formats); i++)
+							if (!strcmp (*f, formats[i].name))
+								c->format = &formats[i];
+						if (!c->format) {
+							g_printerr ("Unknown format %s\n", *f);
+							g_free (c);
+							return 2;
+						}
+						c->taps = g_strdup (*t);
+						c->binning = atoi (*b);
+						c->roi_name = g_strdup (*r);
+						c->roi = probe_roi (*r, sensor_width, sensor_height);
+						c->engine = g_strdup (*e);
+						g_ptr_array_add (configs, c);
+					}
+
+	g_print ("Sensor %dx%d, %u configurations of %d frames\n\n", sensor_width, sensor_height, configs->len, frames);
+	g_print ("%-7s %3s  %-22s %-9s %-8s %8s %9s %7s %9s  %s\n", "taps", "bin", "roi", "format", "engine",
+			"cam-fps", "out-fps", "drop", "cpu-us", "viable");
+	for (i = 0; i < configs->len; i++) {
+		LuProbeConfig *c = g_ptr_array_index (configs, i);
+
+		probe_run (c);
+		probe_print_row (c);
+	}
+
+	best = probe_best (configs);
+	g_print ("\n");
+	if (best) {
+		g_print ("Fastest viable: ");
+		probe_print_row (best);
+	}
+	else
+		g_print ("No configuration lost %.1f%% of frames or fewer\n", max_drop);
+
+	if (json_path)
+		probe_write_json (configs, json_path);
+	if (profile_path && best && probe_write_profile (configs, best, sensor_width, sensor_height, profile_path))
+		g_print ("Profile written to %s\n", profile_path);
+
+	g_strfreev (taps);
+	g_strfreev (binnings);
+	g_strfreev (fmts);
+	g_strfreev (engines);
+	g_ptr_array_free (configs, TRUE);
+
+	return best ? 0 : 1;
+}